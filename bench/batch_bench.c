@@ -0,0 +1,88 @@
+/* Lane-parallel batch evaluation against evaluating main once per input.
+ *
+ * Usage: batch_bench [file] [inputs]
+ * Without a file, a program mixing arithmetic with data dependent branches
+ * and recursion is used. Inputs are 0, 1, 2, ... */
+
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *example =
+    "valdef scale: int = 7;\n"
+    "funcdef steps(n: int, c: int) -> int =\n"
+    "    if n <= 1 || c >= 40 then c\n"
+    "    else if n % 2 == 0 then steps(n / 2, c + 1)\n"
+    "    else steps(3 * n + 1, c + 1);\n"
+    "funcdef mix(n: int) -> int =\n"
+    "    (n * scale + 3) * (n + -5) % 1009 + (if n > 100 then 1 else -1);\n"
+    "funcdef main(n: int) -> int = mix(n) + steps(n % 1000 + 1, 0);\n";
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    Source source = {0};
+    filename = argc > 1 ? argv[1] : "<example>";
+    if (argc > 1) {
+        if (!load_source(argv[1], &source)) {
+            fprintf(stderr, "Could not open file \"%s\"\n", argv[1]);
+            return 1;
+        }
+    } else {
+        source.length = strlen(example);
+        source.data = calloc(source.length + 2, 1);
+        memcpy(source.data, example, source.length);
+    }
+
+    ast = ast_table_new(100);
+    if (parse_buffer(source.data, source.length)) {
+        fprintf(stderr, "%s\n", syntax_error_msg);
+        return 1;
+    }
+    if (!verify_semantics()) {
+        fprintf(stderr, "Semantic Error: %s\n", semantic_error_msg);
+        return 1;
+    }
+    if (!initialize_globals()) {
+        fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+        return 1;
+    }
+
+    int *inputs = malloc(count * sizeof(int) + 1);
+    int *scalar_outputs = malloc(count * sizeof(int) + 1);
+    int *batch_outputs = malloc(count * sizeof(int) + 1);
+    bool *scalar_failed = malloc(count + 1);
+    bool *batch_failed = malloc(count + 1);
+    for (size_t i = 0; i < count; i++) {
+        inputs[i] = (int)i;
+    }
+
+    double start = monotonic_seconds();
+    for (size_t i = 0; i < count; i++) {
+        scalar_failed[i] =
+            !interpret_function("main", inputs + i, 1, scalar_outputs + i);
+    }
+    double scalar_time = monotonic_seconds() - start;
+
+    start = monotonic_seconds();
+    if (!interpret_batch(inputs, count, batch_outputs, batch_failed)) {
+        fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+        return 1;
+    }
+    double batch_time = monotonic_seconds() - start;
+
+    printf("Inputs: %zu\n", count);
+    printf("one at a time: %10.0f inputs/s\n", count / scalar_time);
+    printf("batch:         %10.0f inputs/s (%.2fx)\n", count / batch_time,
+           scalar_time / batch_time);
+
+    for (size_t i = 0; i < count; i++) {
+        if ((scalar_failed[i] != batch_failed[i]) ||
+            ((!scalar_failed[i]) && (scalar_outputs[i] != batch_outputs[i]))) {
+            printf("Outputs differ for input %d\n", inputs[i]);
+            return 1;
+        }
+    }
+    printf("Outputs match\n");
+    return 0;
+}
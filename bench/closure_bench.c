@@ -0,0 +1,83 @@
+/* The syntax tree engine against the closure engine.
+ *
+ * Usage: closure_bench [file] [inputs]
+ * Without a file, a program of small recursive arithmetic functions is
+ * used. Inputs are 0, 1, 2, ... */
+
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *example =
+    "valdef limit: int = 2;\n"
+    "funcdef fib(n: int) -> int =\n"
+    "    if n < limit then n else fib(n + -1) + fib(n + -2);\n"
+    "funcdef collatz(n: int, steps: int) -> int =\n"
+    "    if n <= 1 then steps\n"
+    "    else if n % 2 == 0 then collatz(n / 2, steps + 1)\n"
+    "    else collatz(3 * n + 1, steps + 1);\n"
+    "funcdef main(n: int) -> int = fib(n % 16) + collatz(n + 1, 0);\n";
+
+static double run_main(size_t count, int *outputs, bool *failed) {
+    double start = monotonic_seconds();
+    for (size_t i = 0; i < count; i++) {
+        int input = (int)i;
+        failed[i] = !interpret_function("main", &input, 1, outputs + i);
+    }
+    return monotonic_seconds() - start;
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+
+    Source source = {0};
+    filename = argc > 1 ? argv[1] : "<example>";
+    if (argc > 1) {
+        if (!load_source(argv[1], &source)) {
+            fprintf(stderr, "Could not open file \"%s\"\n", argv[1]);
+            return 1;
+        }
+    } else {
+        source.length = strlen(example);
+        source.data = calloc(source.length + 2, 1);
+        memcpy(source.data, example, source.length);
+    }
+
+    ast = ast_table_new(100);
+    if (parse_buffer(source.data, source.length)) {
+        fprintf(stderr, "%s\n", syntax_error_msg);
+        return 1;
+    }
+    if (!verify_semantics()) {
+        fprintf(stderr, "Semantic Error: %s\n", semantic_error_msg);
+        return 1;
+    }
+    if (!initialize_globals()) {
+        fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+        return 1;
+    }
+
+    int *tree_outputs = malloc(count * sizeof(int) + 1);
+    int *closure_outputs = malloc(count * sizeof(int) + 1);
+    bool *tree_failed = malloc(count + 1);
+    bool *closure_failed = malloc(count + 1);
+
+    double tree_time = run_main(count, tree_outputs, tree_failed);
+    use_closure_engine = true;
+    double closure_time = run_main(count, closure_outputs, closure_failed);
+
+    printf("Inputs: %zu\n", count);
+    printf("tree:    %10.0f inputs/s\n", count / tree_time);
+    printf("closure: %10.0f inputs/s (%.2fx)\n", count / closure_time,
+           tree_time / closure_time);
+
+    for (size_t i = 0; i < count; i++) {
+        if ((tree_failed[i] != closure_failed[i]) ||
+            ((!tree_failed[i]) && (tree_outputs[i] != closure_outputs[i]))) {
+            printf("Outputs differ for input %zu\n", i);
+            return 1;
+        }
+    }
+    printf("Outputs match\n");
+    return 0;
+}
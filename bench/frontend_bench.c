@@ -0,0 +1,226 @@
+/* Scaling of the front end phases over growing synthetic programs.
+ *
+ * Usage: frontend_bench [shape] [max size]
+ *
+ * Every size runs in a forked child, so peak memory is per size and a crash,
+ * for example on a deep parser stack, only fails that size. After each
+ * shape, the growth of every phase is fitted on a log-log scale and phases
+ * growing faster than SUPER_LINEAR_EXPONENT are flagged. */
+
+#include "common.h"
+#include "program_generator.h"
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MIN_SIZE 1000
+#define SUPER_LINEAR_EXPONENT 1.3
+/* Phases faster than this are noise and left out of the fit */
+#define MIN_FITTED_SECONDS 0.002
+
+typedef enum { LEX, PARSE, INSERT, VERIFY, PHASE_COUNT } Phase;
+
+static const char *phase_names[PHASE_COUNT] = {"lex", "parse", "insert",
+                                               "verify"};
+
+typedef struct {
+    bool succeeded;
+    double seconds[PHASE_COUNT];
+    long peak_kilobytes;
+    size_t bytes;
+    char error[200];
+} Measurement;
+
+static const size_t default_max_sizes[PROGRAM_SHAPE_COUNT] = {
+    [WIDE_PROGRAM] = 128000,
+    [DEEP_PROGRAM] = 16000,
+    [CALLS_PROGRAM] = 128000,
+    [GLOBALS_PROGRAM] = 128000,
+};
+
+static void measure_phases(ProgramShape shape, size_t size,
+                           Measurement *result) {
+    size_t length;
+    char *program = generate_program(shape, size, &length);
+    result->bytes = length;
+
+    double start = monotonic_seconds();
+    FastLexer lexer;
+    fast_lexer_init(&lexer, program, length, 1, 1);
+    while (fast_lexer_next(&lexer))
+        ;
+    result->seconds[LEX] = monotonic_seconds() - start;
+
+    /* Parsing includes inserting into ast, like file_interpretation does */
+    filename = "<generated>";
+    use_fast_lexer = true;
+    ast = ast_table_new(100);
+    start = monotonic_seconds();
+    if (parse_buffer(program, length)) {
+        snprintf(result->error, sizeof(result->error), "%s",
+                 syntax_error_msg);
+        return;
+    }
+    result->seconds[PARSE] = monotonic_seconds() - start;
+
+    /* Insertion on its own, into a table sized like the parser's */
+    size_t count = ast_table_size(ast);
+    char **names = malloc(count * sizeof(char *) + 1);
+    AST *trees = malloc(count * sizeof(AST) + 1);
+    char *key;
+    AST *tree;
+    size_t len = 0;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        names[len] = key;
+        trees[len++] = *tree;
+    }
+    ast_table_t *copy = ast_table_new(100);
+    start = monotonic_seconds();
+    for (size_t i = 0; i < len; i++) {
+        ast_table_insert(copy, names[i], trees[i]);
+    }
+    result->seconds[INSERT] = monotonic_seconds() - start;
+
+    start = monotonic_seconds();
+    if (!verify_semantics()) {
+        snprintf(result->error, sizeof(result->error), "Semantic Error: %s",
+                 semantic_error_msg);
+        return;
+    }
+    result->seconds[VERIFY] = monotonic_seconds() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result->peak_kilobytes = usage.ru_maxrss;
+    result->succeeded = true;
+}
+
+static Measurement measure(ProgramShape shape, size_t size) {
+    Measurement result = {0};
+    int fds[2];
+    if (pipe(fds)) {
+        snprintf(result.error, sizeof(result.error), "pipe failed");
+        return result;
+    }
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        measure_phases(shape, size, &result);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    int status = 0;
+    ssize_t got = child > 0 ? read(fds[0], &result, sizeof(result)) : 0;
+    close(fds[0]);
+    if (child > 0)
+        waitpid(child, &status, 0);
+
+    if (got != sizeof(result)) {
+        result = (Measurement){0};
+        if ((child > 0) && (WIFSIGNALED(status)))
+            snprintf(result.error, sizeof(result.error), "killed by signal %d",
+                     WTERMSIG(status));
+        else
+            snprintf(result.error, sizeof(result.error), "no result");
+    }
+    return result;
+}
+
+/* Least squares slope of log(seconds) over log(size) */
+static bool growth_exponent(const size_t *sizes, const Measurement *results,
+                            size_t len, Phase phase, double *exponent) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if ((!results[i].succeeded) ||
+            (results[i].seconds[phase] < MIN_FITTED_SECONDS))
+            continue;
+        double x = log((double)sizes[i]);
+        double y = log(results[i].seconds[phase]);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        n++;
+    }
+    if ((n < 3) || (n * sxx - sx * sx <= 0))
+        return false;
+    *exponent = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    return true;
+}
+
+static bool run_shape(ProgramShape shape, size_t max_size) {
+    size_t sizes[64];
+    Measurement results[64];
+    size_t len = 0;
+
+    printf("\n%s\n%9s %10s", program_shape_names[shape], "size", "bytes");
+    for (Phase phase = 0; phase < PHASE_COUNT; phase++) {
+        printf(" %9s", phase_names[phase]);
+    }
+    printf(" %10s\n", "peak KB");
+
+    for (size_t size = MIN_SIZE; (size <= max_size) && (len < 64); size *= 2) {
+        Measurement result = measure(shape, size);
+        sizes[len] = size;
+        results[len++] = result;
+
+        printf("%9zu %10zu", size, result.bytes);
+        if (!result.succeeded) {
+            printf(" failed: %s\n", result.error);
+            continue;
+        }
+        for (Phase phase = 0; phase < PHASE_COUNT; phase++) {
+            printf(" %8.4fs", result.seconds[phase]);
+        }
+        printf(" %10ld\n", result.peak_kilobytes);
+    }
+
+    bool linear = true;
+    for (Phase phase = 0; phase < PHASE_COUNT; phase++) {
+        double exponent;
+        if (!growth_exponent(sizes, results, len, phase, &exponent))
+            continue;
+        bool super_linear = exponent > SUPER_LINEAR_EXPONENT;
+        printf("%9s grows as size^%.2f%s\n", phase_names[phase], exponent,
+               super_linear ? "  <-- SUPER-LINEAR" : "");
+        linear = linear && (!super_linear);
+    }
+    for (size_t i = 0; i < len; i++) {
+        linear = linear && results[i].succeeded;
+    }
+    return linear;
+}
+
+int main(int argc, char *argv[]) {
+    ProgramShape only_shape = WIDE_PROGRAM;
+    bool one_shape = argc > 1;
+    if ((one_shape) && (!parse_program_shape(argv[1], &only_shape))) {
+        fprintf(stderr, "Usage: %s [wide|deep|calls|globals] [max size]\n",
+                argv[0]);
+        return 1;
+    }
+    size_t max_size = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+
+    /* One thread, so that times do not depend on the machine's cores */
+    set_thread_count(1);
+
+    bool linear = true;
+    for (ProgramShape shape = 0; shape < PROGRAM_SHAPE_COUNT; shape++) {
+        if ((one_shape) && (shape != only_shape))
+            continue;
+        linear = run_shape(shape, max_size ? max_size
+                                           : default_max_sizes[shape]) &&
+                 linear;
+    }
+
+    /* A failing exit status lets CI catch scaling regressions */
+    return linear ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+/* Writes a synthetic program to stdout.
+ *
+ * Usage: generate_program <wide|deep|calls|globals> <size> */
+
+#include "program_generator.h"
+
+int main(int argc, char *argv[]) {
+    ProgramShape shape;
+    if ((argc != 3) || (!parse_program_shape(argv[1], &shape))) {
+        fprintf(stderr, "Usage: %s <wide|deep|calls|globals> <size>\n",
+                argv[0]);
+        return 1;
+    }
+
+    size_t length;
+    char *program = generate_program(shape, strtoul(argv[2], NULL, 10),
+                                     &length);
+    fwrite(program, 1, length, stdout);
+    free(program);
+    return 0;
+}
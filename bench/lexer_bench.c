@@ -0,0 +1,125 @@
+/* Lexing throughput of lexer.l (flex) against the hand written fast lexer.
+ *
+ * Usage: lexer_bench [file] [repetitions]
+ * Without a file, a synthetic program of about 8 MB is generated. */
+
+#include "common.h"
+#include "parser.tab.h"
+#include <stdio.h>
+#include <string.h>
+
+void *yy_scan_buffer(char *, size_t);
+void yy_delete_buffer(void *);
+int flex_lex(void);
+
+static const char *example =
+    "// synthetic copy %d of the README example\n"
+    "valdef zero%d: int = 0;\n"
+    "valdef two%d: int = 1 + 1;\n"
+    "funcdef _sum%d(c: int, n: int) -> int =\n"
+    "    if n == zero%d then\n"
+    "        c\n"
+    "    else\n"
+    "        _sum%d(c + n, n + -1);\n"
+    "funcdef fib%d(n: int) -> int =\n"
+    "    if n < two%d then\n"
+    "        n\n"
+    "    else\n"
+    "        fib%d(n + -1) + fib%d(n + -two%d);\n";
+
+static char *generate_program(size_t target_size, size_t *length) {
+    char *data = malloc(target_size + 1024);
+    *length = 0;
+    for (int i = 0; *length < target_size; i++) {
+        *length += sprintf(data + *length, example, i, i, i, i, i, i, i, i, i,
+                           i, i);
+    }
+    return data;
+}
+
+/* Folds every token with its position and value into a checksum */
+static inline uint64_t mix(uint64_t sum, int token, int line, int column,
+                           int integer, SourceView view) {
+    sum = (sum ^ token) * 0x100000001b3;
+    sum = (sum ^ line) * 0x100000001b3;
+    sum = (sum ^ column) * 0x100000001b3;
+    if (token == INTEGER)
+        sum = (sum ^ (unsigned)integer) * 0x100000001b3;
+    if (token == IDENTIFIER)
+        sum = (sum ^ content_hash(view.start, view.length)) * 0x100000001b3;
+    return sum;
+}
+
+static uint64_t run_flex(char *data, size_t length, size_t *tokens) {
+    uint64_t sum = 0xcbf29ce484222325;
+    yylineno = 1;
+    void *buffer = yy_scan_buffer(data, length + 2);
+    int token;
+    while ((token = flex_lex())) {
+        sum = mix(sum, token, yylineno, column, yylval.integer, yylval.view);
+        (*tokens)++;
+    }
+    yy_delete_buffer(buffer);
+    return sum;
+}
+
+static uint64_t run_fast(char *data, size_t length, size_t *tokens) {
+    uint64_t sum = 0xcbf29ce484222325;
+    FastLexer lexer;
+    fast_lexer_init(&lexer, data, length, 1, 1);
+    int token;
+    while ((token = fast_lexer_next(&lexer))) {
+        sum = mix(sum, token, lexer.token_line, lexer.token_column,
+                  lexer.integer, lexer.view);
+        (*tokens)++;
+    }
+    return sum;
+}
+
+int main(int argc, char *argv[]) {
+    Source source = {0};
+    size_t repetitions = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+
+    if (argc > 1) {
+        if (!load_source(argv[1], &source)) {
+            fprintf(stderr, "Could not open file \"%s\"\n", argv[1]);
+            return 1;
+        }
+    } else {
+        source.data = generate_program(8 << 20, &source.length);
+        source.data[source.length] = source.data[source.length + 1] = 0;
+    }
+
+    size_t flex_tokens = 0, fast_tokens = 0;
+    uint64_t flex_sum = run_flex(source.data, source.length, &flex_tokens);
+    uint64_t fast_sum = run_fast(source.data, source.length, &fast_tokens);
+
+    double start = monotonic_seconds();
+    for (size_t i = 0; i < repetitions; i++) {
+        size_t tokens = 0;
+        run_flex(source.data, source.length, &tokens);
+    }
+    double flex_time = monotonic_seconds() - start;
+
+    start = monotonic_seconds();
+    for (size_t i = 0; i < repetitions; i++) {
+        size_t tokens = 0;
+        run_fast(source.data, source.length, &tokens);
+    }
+    double fast_time = monotonic_seconds() - start;
+
+    double megabytes = source.length * (double)repetitions / (1 << 20);
+    printf("Input: %.1f MB, %zu tokens\n", source.length / (double)(1 << 20),
+           flex_tokens);
+    printf("flex lexer: %8.1f MB/s\n", megabytes / flex_time);
+    printf("fast lexer: %8.1f MB/s (%.2fx)\n", megabytes / fast_time,
+           flex_time / fast_time);
+
+    if ((flex_sum != fast_sum) || (flex_tokens != fast_tokens)) {
+        printf("Token streams differ (%zu and %zu tokens)\n", flex_tokens,
+               fast_tokens);
+        return 1;
+    }
+    printf("Token streams match\n");
+    return 0;
+}
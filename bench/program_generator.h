@@ -0,0 +1,130 @@
+/* Synthetic KariLang programs for the benchmarks. Every shape is a valid
+ * program whose main takes an int. */
+
+#ifndef PROGRAM_GENERATOR_H
+#define PROGRAM_GENERATOR_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    WIDE_PROGRAM,    /* size functions, each calling the previous one */
+    DEEP_PROGRAM,    /* one expression nested size levels deep */
+    CALLS_PROGRAM,   /* size functions making several 8 argument calls */
+    GLOBALS_PROGRAM, /* size values, each using the previous one */
+} ProgramShape;
+
+static const char *program_shape_names[] = {"wide", "deep", "calls",
+                                            "globals"};
+
+#define PROGRAM_SHAPE_COUNT                                                    \
+    (sizeof(program_shape_names) / sizeof(program_shape_names[0]))
+
+static inline bool parse_program_shape(const char *name, ProgramShape *shape) {
+    for (size_t i = 0; i < PROGRAM_SHAPE_COUNT; i++) {
+        if (!strcmp(name, program_shape_names[i])) {
+            *shape = (ProgramShape)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} ProgramBuffer;
+
+static void append_program(ProgramBuffer *buffer, const char *format, ...) {
+    va_list args;
+    while (true) {
+        size_t left = buffer->capacity - buffer->length;
+        va_start(args, format);
+        int written = vsnprintf(buffer->data + buffer->length, left, format,
+                                args);
+        va_end(args);
+        /* two bytes stay free for the NUL terminators parse_buffer needs */
+        if ((size_t)written + 2 <= left) {
+            buffer->length += written;
+            return;
+        }
+        buffer->capacity = buffer->capacity * 2 + written + 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (!buffer->data) {
+            fprintf(stderr, "Memory Error\n");
+            exit(1);
+        }
+    }
+}
+
+/* Returns a malloc'ed program followed by two NUL bytes */
+static char *generate_program(ProgramShape shape, size_t size,
+                              size_t *length) {
+    ProgramBuffer buffer = {0};
+    if (!size)
+        size = 1;
+
+    switch (shape) {
+    case WIDE_PROGRAM:
+        append_program(&buffer,
+                       "funcdef main(n: int) -> int = f%zu(n, true);\n",
+                       size - 1);
+        append_program(&buffer, "funcdef f0(n: int, b: bool) -> int = n;\n");
+        for (size_t i = 1; i < size; i++) {
+            append_program(&buffer,
+                           "funcdef f%zu(n: int, b: bool) -> int =\n"
+                           "    if b && n > %zu then n * %zu + n %% 7\n"
+                           "    else f%zu(n + -1, !b);\n",
+                           i, i, i, i - 1);
+        }
+        break;
+    case DEEP_PROGRAM:
+        append_program(&buffer, "funcdef main(n: int) -> int = ");
+        for (size_t i = 0; i < size; i++) {
+            append_program(&buffer, "(n + ");
+        }
+        append_program(&buffer, "1");
+        for (size_t i = 0; i < size; i++) {
+            append_program(&buffer, ")");
+        }
+        append_program(&buffer, ";\n");
+        break;
+    case CALLS_PROGRAM:
+        append_program(&buffer,
+                       "funcdef main(n: int) -> int = "
+                       "c%zu(n, n, n, n, n, n, n, n);\n",
+                       size - 1);
+        append_program(&buffer, "funcdef c0(a: int, b: int, c: int, d: int, "
+                                "e: int, f: int, g: int, h: int) -> int = "
+                                "a + b + c + d + e + f + g + h;\n");
+        for (size_t i = 1; i < size; i++) {
+            append_program(&buffer,
+                           "funcdef c%zu(a: int, b: int, c: int, d: int, "
+                           "e: int, f: int, g: int, h: int) -> int =\n"
+                           "    c%zu(a + 1, b, c, d, e, f, g, h) +\n"
+                           "    c0(h, g, f, e, d, c, b, a) *\n"
+                           "    c0(a, a, b, b, c, c, d, %zu);\n",
+                           i, i - 1, i);
+        }
+        break;
+    case GLOBALS_PROGRAM:
+        append_program(&buffer, "valdef g0: int = 0;\n");
+        for (size_t i = 1; i < size; i++) {
+            append_program(&buffer, "valdef g%zu: int = g%zu %% 1000 + %zu;\n",
+                           i, i - 1, i);
+        }
+        append_program(&buffer, "funcdef main(n: int) -> int = n + g%zu;\n",
+                       size - 1);
+        break;
+    }
+
+    buffer.data[buffer.length] = buffer.data[buffer.length + 1] = 0;
+    *length = buffer.length;
+    return buffer.data;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/* Passing every argument evaluated against passing the ones a function does
+ * not always use lazily.
+ *
+ * Usage: strictness_bench [file] [inputs]
+ * Without a file, a program of guard-style functions given expensive
+ * fallbacks is used. Inputs are 0, 1, 2, ... */
+
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *example =
+    "funcdef cost(n: int, d: int) -> int =\n"
+    "    if d == 0 then n else cost(n * 31 % 1009, d + -1);\n"
+    "funcdef guard(ok: bool, value: int, fallback: int) -> int =\n"
+    "    if ok then value else fallback;\n"
+    "funcdef sum(n: int, acc: int) -> int =\n"
+    "    if n == 0 then acc\n"
+    "    else sum(n + -1, acc + guard(n % 10 != 0, n, cost(n, 40)));\n"
+    "funcdef main(n: int) -> int = sum(n % 200 + 1, 0);\n";
+
+static double run_main(size_t count, int *outputs, bool *failed) {
+    double start = monotonic_seconds();
+    for (size_t i = 0; i < count; i++) {
+        int input = (int)i;
+        failed[i] = !interpret_function("main", &input, 1, outputs + i);
+    }
+    return monotonic_seconds() - start;
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+
+    Source source = {0};
+    filename = argc > 1 ? argv[1] : "<example>";
+    if (argc > 1) {
+        if (!load_source(argv[1], &source)) {
+            fprintf(stderr, "Could not open file \"%s\"\n", argv[1]);
+            return 1;
+        }
+    } else {
+        source.length = strlen(example);
+        source.data = calloc(source.length + 2, 1);
+        memcpy(source.data, example, source.length);
+    }
+
+    ast = ast_table_new(100);
+    if (parse_buffer(source.data, source.length)) {
+        fprintf(stderr, "%s\n", syntax_error_msg);
+        return 1;
+    }
+    if (!verify_semantics()) {
+        fprintf(stderr, "Semantic Error: %s\n", semantic_error_msg);
+        return 1;
+    }
+    if (!initialize_globals()) {
+        fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+        return 1;
+    }
+
+    int *eager_outputs = malloc(count * sizeof(int) + 1);
+    int *lazy_outputs = malloc(count * sizeof(int) + 1);
+    bool *eager_failed = malloc(count + 1);
+    bool *lazy_failed = malloc(count + 1);
+
+    double eager_time = run_main(count, eager_outputs, eager_failed);
+    analyze_strictness();
+    double lazy_time = run_main(count, lazy_outputs, lazy_failed);
+
+    size_t lazy_count = 0;
+    size_t argument_count = 0;
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if (tree->type != AST_FUNCTION)
+            continue;
+        for (size_t i = 0; i < tree->value.func->arglen; i++) {
+            lazy_count += tree->value.func->args[i].lazy;
+        }
+        argument_count += tree->value.func->arglen;
+    }
+
+    printf("Inputs: %zu, lazy arguments: %zu of %zu\n", count, lazy_count,
+           argument_count);
+    printf("eager: %10.0f inputs/s\n", count / eager_time);
+    printf("lazy:  %10.0f inputs/s (%.2fx)\n", count / lazy_time,
+           eager_time / lazy_time);
+
+    /* lazy arguments may skip an error, never add one */
+    for (size_t i = 0; i < count; i++) {
+        if ((lazy_failed[i] && !eager_failed[i]) ||
+            ((!eager_failed[i]) && (eager_outputs[i] != lazy_outputs[i]))) {
+            printf("Outputs differ for input %zu\n", i);
+            return 1;
+        }
+    }
+    printf("Outputs match\n");
+    return 0;
+}
@@ -6,6 +6,14 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Allocation functions, which can be defined before including this file */
+#ifndef DS_MALLOC
+#define DS_MALLOC malloc
+#define DS_CALLOC calloc
+#define DS_REALLOC realloc
+#define DS_FREE free
+#endif
+
 #define DS_ARRAY_DEC(name, TYPE)                                               \
     typedef struct _##name##_array_t name##_array_t;                           \
     name##_array_t *name##_array_new();                                        \
@@ -51,15 +59,15 @@
     typedef struct _##name##_array_t name##_array_t;                           \
                                                                                \
     name##_array_t *name##_array_new() {                                       \
-        name##_array_t *arr = malloc(sizeof(name##_array_t));                  \
+        name##_array_t *arr = DS_MALLOC(sizeof(name##_array_t));               \
         if (!arr) {                                                            \
             errno = ENOMEM;                                                    \
             return NULL;                                                       \
         }                                                                      \
                                                                                \
-        arr->array = calloc(4, sizeof(TYPE));                                  \
+        arr->array = DS_CALLOC(4, sizeof(TYPE));                               \
         if (!arr->array) {                                                     \
-            free(arr);                                                         \
+            DS_FREE(arr);                                                      \
             errno = ENOMEM;                                                    \
             return NULL;                                                       \
         }                                                                      \
@@ -78,7 +86,7 @@
             return true;                                                       \
         } else {                                                               \
             arr->array =                                                       \
-                realloc(arr->array, (arr->capacity * 2 * sizeof(TYPE)));       \
+                DS_REALLOC(arr->array, (arr->capacity * 2 * sizeof(TYPE)));    \
             if (arr->array) {                                                  \
                 arr->capacity *= 2;                                            \
                 arr->array[arr->size] = val;                                   \
@@ -100,7 +108,7 @@
                                                                                \
         if (arr->size * 2 < arr->capacity) {                                   \
             arr->array =                                                       \
-                realloc(arr->array, (arr->capacity / 2) * sizeof(TYPE));       \
+                DS_REALLOC(arr->array, (arr->capacity / 2) * sizeof(TYPE));    \
             arr->capacity /= 2;                                                \
         }                                                                      \
         return last_value;                                                     \
@@ -142,8 +150,8 @@
                 delFunc(arr->array + i);                                       \
             }                                                                  \
         }                                                                      \
-        free(arr->array);                                                      \
-        free(arr);                                                             \
+        DS_FREE(arr->array);                                                   \
+        DS_FREE(arr);                                                          \
         return true;                                                           \
     }
 
@@ -171,7 +179,7 @@
     };                                                                         \
                                                                                \
     name##_list_t *name##_list_new() {                                         \
-        name##_list_t *li = malloc(sizeof(name##_list_t));                     \
+        name##_list_t *li = DS_MALLOC(sizeof(name##_list_t));                  \
         if (!li) {                                                             \
             errno = ENOMEM;                                                    \
             return NULL;                                                       \
@@ -186,7 +194,7 @@
     size_t name##_list_size(const name##_list_t *li) { return li->size; }      \
                                                                                \
     bool name##_list_append(name##_list_t *li, TYPE val) {                     \
-        name##_list_node *new = malloc(sizeof(name##_list_node));              \
+        name##_list_node *new = DS_MALLOC(sizeof(name##_list_node));           \
         if (!new) {                                                            \
             errno = ENOMEM;                                                    \
             return false;                                                      \
@@ -217,7 +225,7 @@
         li->size--;                                                            \
                                                                                \
         TYPE element = last->element;                                          \
-        free(last);                                                            \
+        DS_FREE(last);                                                         \
         return element;                                                        \
     }                                                                          \
                                                                                \
@@ -274,10 +282,10 @@
             if (delFunc) {                                                     \
                 delFunc(&(node->element));                                     \
             }                                                                  \
-            free(node);                                                        \
+            DS_FREE(node);                                                     \
             node = next;                                                       \
         }                                                                      \
-        free(li);                                                              \
+        DS_FREE(li);                                                           \
         return true;                                                           \
     }
 
@@ -299,11 +307,10 @@
 
 #define IMPLEMENT_HASH_FUNCTION                                                \
     size_t hash_function(const char *str) {                                    \
-        /* TODO: not calculate length here */                                  \
         size_t hash = 0xcbf29ce484222325;                                      \
-        for (size_t i = 0; i < strlen(str); i++) {                             \
+        for (; *str; str++) {                                                  \
             hash *= 0x100000001b3;                                             \
-            hash ^= str[i];                                                    \
+            hash ^= *str;                                                      \
         }                                                                      \
         return hash;                                                           \
     }
@@ -330,15 +337,16 @@
     };                                                                         \
                                                                                \
     name##_table_t *name##_table_new(size_t size) {                            \
-        name##_table_t *tb = calloc(1, sizeof(name##_table_t));                \
+        name##_table_t *tb = DS_CALLOC(1, sizeof(name##_table_t));             \
         if (!tb) {                                                             \
             errno = ENOMEM;                                                    \
             return NULL;                                                       \
         }                                                                      \
                                                                                \
-        tb->table_list = calloc(size, sizeof(_##name##_hash_table_list_node)); \
+        tb->table_list =                                                       \
+            DS_CALLOC(size, sizeof(_##name##_hash_table_list_node));           \
         if (!tb->table_list) {                                                 \
-            free(tb);                                                          \
+            DS_FREE(tb);                                                       \
             errno = ENOMEM;                                                    \
             return NULL;                                                       \
         }                                                                      \
@@ -373,6 +381,60 @@
         return NULL;                                                           \
     }                                                                          \
                                                                                \
+    static void name##_table_free_chains(_##name##_hash_table_list_node *list, \
+                                         size_t length) {                      \
+        for (size_t i = 0; i < length; i++) {                                  \
+            _##name##_hash_table_list_node *node = list[i].next;               \
+            while (node) {                                                     \
+                _##name##_hash_table_list_node *next = node->next;             \
+                DS_FREE(node);                                                 \
+                node = next;                                                   \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    /* Doubles the buckets, so chains stay short as the table fills. Values    \
+     * move, so pointers to them and iterations do not survive an insert. */   \
+    static bool name##_table_grow(name##_table_t *tb) {                        \
+        size_t length = tb->array_length * 2;                                  \
+        _##name##_hash_table_list_node *list =                                 \
+            DS_CALLOC(length, sizeof(_##name##_hash_table_list_node));         \
+        if (!list)                                                             \
+            return false;                                                      \
+                                                                               \
+        for (size_t i = 0; i < tb->array_length; i++) {                        \
+            if (!tb->table_list[i].item_pair.key)                              \
+                continue;                                                      \
+            for (_##name##_hash_table_list_node *node =                        \
+                     tb->table_list + i;                                       \
+                 node;                                                         \
+                 node = node->next) {                                          \
+                _##name##_hash_table_list_node *bucket =                       \
+                    list + hash_function(node->item_pair.key) % length;        \
+                if (!bucket->item_pair.key) {                                  \
+                    bucket->item_pair = node->item_pair;                       \
+                    continue;                                                  \
+                }                                                              \
+                _##name##_hash_table_list_node *chained =                      \
+                    DS_CALLOC(1, sizeof(_##name##_hash_table_list_node));      \
+                if (!chained) {                                                \
+                    name##_table_free_chains(list, length);                    \
+                    DS_FREE(list);                                             \
+                    return false;                                              \
+                }                                                              \
+                chained->item_pair = node->item_pair;                          \
+                chained->next = bucket->next;                                  \
+                bucket->next = chained;                                        \
+            }                                                                  \
+        }                                                                      \
+                                                                               \
+        name##_table_free_chains(tb->table_list, tb->array_length);            \
+        DS_FREE(tb->table_list);                                               \
+        tb->table_list = list;                                                 \
+        tb->array_length = length;                                             \
+        return true;                                                           \
+    }                                                                          \
+                                                                               \
     bool name##_table_insert(name##_table_t *tb, const char *key,              \
                              TYPE value) {                                     \
         size_t hash = hash_function(key) % tb->array_length;                   \
@@ -400,7 +462,7 @@
         }                                                                      \
                                                                                \
         item_list_node->next =                                                 \
-            calloc(1, sizeof(_##name##_hash_table_list_node));                 \
+            DS_CALLOC(1, sizeof(_##name##_hash_table_list_node));              \
         if (!item_list_node->next) {                                           \
             errno = ENOMEM;                                                    \
             return false;                                                      \
@@ -409,6 +471,9 @@
         item_list_node->next->item_pair.key = key;                             \
         item_list_node->next->item_pair.value = value;                         \
         tb->count++;                                                           \
+        /* failing to grow only makes chains longer */                         \
+        if (tb->count > 2 * tb->array_length)                                  \
+            name##_table_grow(tb);                                             \
         return true;                                                           \
     }                                                                          \
                                                                                \
@@ -469,18 +534,19 @@
             return false;                                                      \
         }                                                                      \
                                                                                \
-        bool is_first = true;                                                  \
+        _##name##_hash_table_list_node *previous = NULL;                       \
                                                                                \
         do {                                                                   \
             if (!strcmp(key, item_list_node->item_pair.key)) {                 \
                 delFunc(item_list_node->item_pair.value);                      \
                                                                                \
-                void *to_free = item_list_node->next;                          \
-                if (item_list_node->next) {                                    \
-                    *item_list_node = *item_list_node->next;                   \
-                    if (!is_first) {                                           \
-                        free(to_free);                                         \
-                    }                                                          \
+                _##name##_hash_table_list_node *next = item_list_node->next;   \
+                if (next) {                                                    \
+                    *item_list_node = *next;                                   \
+                    DS_FREE(next);                                             \
+                } else if (previous) {                                         \
+                    previous->next = NULL;                                     \
+                    DS_FREE(item_list_node);                                   \
                 } else {                                                       \
                     *item_list_node = (_##name##_hash_table_list_node){0};     \
                 }                                                              \
@@ -488,7 +554,7 @@
                 return true;                                                   \
             }                                                                  \
                                                                                \
-            is_first = false;                                                  \
+            previous = item_list_node;                                         \
             item_list_node = item_list_node->next;                             \
         } while (item_list_node);                                              \
                                                                                \
@@ -497,6 +563,22 @@
     }                                                                          \
                                                                                \
     bool name##_table_clear(name##_table_t *tb) {                              \
-        /* TODO: Implement */                                                  \
+        for (size_t i = 0; i < tb->array_length; i++) {                        \
+            _##name##_hash_table_list_node *item_list_node =                   \
+                tb->table_list[i].next;                                        \
+            if (tb->table_list[i].item_pair.key) {                             \
+                delFunc(tb->table_list[i].item_pair.value);                    \
+            }                                                                  \
+            while (item_list_node) {                                           \
+                _##name##_hash_table_list_node *next = item_list_node->next;   \
+                if (item_list_node->item_pair.key) {                           \
+                    delFunc(item_list_node->item_pair.value);                  \
+                }                                                              \
+                DS_FREE(item_list_node);                                       \
+                item_list_node = next;                                         \
+            }                                                                  \
+        }                                                                      \
+        DS_FREE(tb->table_list);                                               \
+        DS_FREE(tb);                                                           \
         return true;                                                           \
     }
@@ -0,0 +1,12 @@
+#include "common.h"
+
+char *STDOUT_REDIRECT_STRING;
+char *STDERR_REDIRECT_STRING;
+
+IMPLEMENT_HASH_FUNCTION;
+DS_TABLE_DEF(ast, AST, clear_ast);
+
+_Thread_local ast_table_t *ast;
+_Thread_local const char *filename;
+
+bool cli_interpretation_mode = false;
@@ -1,17 +1,11 @@
 #include "common.h"
 #include <stdarg.h>
 
-typedef union {
-    int integer;
-    bool boolean;
-} ExpressionResult;
-
 typedef struct {
     size_t arglen;
     Argument *args;
 } Context;
 
-ExpressionResult evaluate_expression(Expression *exp, Context *cxt);
 bool verify_expression_type(Expression *exp, Type type, Context *cxt);
 bool verify_ast_semantics(AST *tree);
 static inline int my_print(FILE *file, const char *msg, ...);
@@ -26,6 +20,7 @@ static inline bool cli_interpret(AST tree) {
         }
         if (!ast_table_insert(ast, tree.value.var->name, tree)) {
             my_print(stderr, "AST insertion Error\n");
+            arena_release(tree.arena);
             errno = 0;
             return false;
         }
@@ -38,19 +33,22 @@ static inline bool cli_interpret(AST tree) {
         }
         if (!ast_table_insert(ast, tree.value.func->funcname, tree)) {
             my_print(stderr, "AST insertion Error\n");
+            arena_release(tree.arena);
             errno = 0;
             return false;
         }
     } else {
+        int output;
         if (verify_expression_type(tree.value.exp, BOOL, NULL)) {
-            my_print(stdout, evaluate_expression(tree.value.exp, NULL).boolean
-                                 ? "true\n"
-                                 : "false\n");
+            if (!interpret_expression(tree.value.exp, BOOL, &output))
+                goto runtime_error;
+            my_print(stdout, output ? "true\n" : "false\n");
             return true;
         }
         if (verify_expression_type(tree.value.exp, INT, NULL)) {
-            my_print(stdout, "%d\n",
-                     evaluate_expression(tree.value.exp, NULL).integer);
+            if (!interpret_expression(tree.value.exp, INT, &output))
+                goto runtime_error;
+            my_print(stdout, "%d\n", output);
             return true;
         }
 
@@ -61,25 +59,35 @@ static inline bool cli_interpret(AST tree) {
         return false;
     }
 
-    if (!verify_ast_semantics(&tree)) {
+    /* verified where it is kept, so that it is known whether it verified */
+    AST *kept = ast_table_get_ptr(
+        ast, tree.type == AST_VARIABLE ? tree.value.var->name
+                                       : tree.value.func->funcname);
+    if (!verify_ast_semantics(kept)) {
         my_print(stderr, "Semantic Error: %s\n", semantic_error_msg);
         semantic_error_msg[0] = 0;
         return false;
     }
 
     if (tree.type == AST_VARIABLE) {
+        int output;
+        if (!interpret_expression(tree.value.var->expression,
+                                  tree.value.var->type, &output))
+            goto runtime_error;
         if (tree.value.var->type == INT) {
-            assert(integer_table_insert(
-                globalIntegers, tree.value.var->name,
-                evaluate_expression(tree.value.var->expression, NULL).integer));
+            assert(integer_table_insert(globalIntegers, tree.value.var->name,
+                                        output));
         } else {
-            assert(boolean_table_insert(
-                globalBooleans, tree.value.var->name,
-                evaluate_expression(tree.value.var->expression, NULL).boolean));
+            assert(boolean_table_insert(globalBooleans, tree.value.var->name,
+                                        output));
         }
     }
 
     return true;
+
+runtime_error:
+    my_print(stderr, "Runtime Error: %s\n", runtime_error_msg);
+    return false;
 }
 
 static inline int my_print(FILE *file, const char *msg, ...) {
@@ -2,23 +2,141 @@
 
 #define YYERROR_VERBOSE 1
 
-#include "DS.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
+
+/* Memory Accounting */
+
+typedef enum {
+    MEMORY_LEXER,       /* sources and lexer buffers */
+    MEMORY_AST,         /* nodes, interned names and the parser stack */
+    MEMORY_TABLES,      /* DS.h containers */
+    MEMORY_INTERPRETER, /* verification and evaluation working memory */
+    MEMORY_TAG_COUNT,
+} MemoryTag;
+
+void enable_memory_tracking();
+void *tracked_malloc(MemoryTag tag, size_t size);
+void *tracked_calloc(MemoryTag tag, size_t count, size_t size);
+void *tracked_realloc(MemoryTag tag, void *ptr, size_t size);
+void tracked_free(void *ptr);
+void account_memory(MemoryTag tag, ptrdiff_t bytes);
+void print_memory_stats(FILE *out);
+
+/* Bump allocated memory freed all at once, reference counted so that its
+ * owner can share it */
+typedef struct _Arena Arena;
+
+Arena *arena_new();
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t size);
+void arena_retain(Arena *arena);
+void arena_release(Arena *arena);
+
+/* Where the parser allocates nodes, until a definition takes them */
+extern _Thread_local Arena *node_arena;
+void *node_alloc(size_t size);
+void *node_realloc(void *ptr, size_t old_size, size_t size);
+Arena *take_node_arena();
+void discard_node_arena();
+
+#define DS_MALLOC(size) tracked_malloc(MEMORY_TABLES, size)
+#define DS_CALLOC(count, size) tracked_calloc(MEMORY_TABLES, count, size)
+#define DS_REALLOC(ptr, size) tracked_realloc(MEMORY_TABLES, ptr, size)
+#define DS_FREE tracked_free
+
+#include "DS.h"
 
 extern FILE *yyin;
-extern int yylex(void);
 extern int yyparse(void);
-extern void yyerror(char const *s);
 extern int yylineno;
 extern int column;
 extern char *yytext;
-extern const char *filename;
+extern _Thread_local const char *filename;
 
 extern bool cli_interpretation_mode;
 
-extern char syntax_error_msg[];
+extern _Thread_local char syntax_error_msg[];
+
+/* Source Loading */
+
+typedef struct {
+    char *data; /* followed by two NUL bytes, as yy_scan_buffer expects */
+    size_t length;
+    size_t mapping_length;
+} Source;
+
+bool load_source(const char *file_name, Source *source);
+void unload_source(Source *source);
+
+/* Text of a token, pointing into the buffer being scanned */
+typedef struct {
+    const char *start;
+    size_t length;
+} SourceView;
+
+/* Names interned while this thread has a pool set go to it and are freed
+ * with it; otherwise they live as long as the process */
+typedef struct _InternPool InternPool;
+extern _Thread_local InternPool *intern_pool;
+InternPool *intern_pool_new();
+void intern_pool_free(InternPool *pool);
+const char *intern_string(const char *str, size_t length);
+
+/* Source text of an expression whose parsing was deferred */
+typedef struct {
+    const char *start;
+    size_t length;
+    int line;
+    int column;
+} DeferredExpression;
+
+/* Hand written scanner producing the same tokens and positions as lexer.l */
+typedef struct {
+    const char *cursor;
+    const char *end;
+    int line;
+    int column;
+    /* position and value of the last token */
+    const char *token_start;
+    int token_line;
+    int token_column;
+    int integer;
+    SourceView view;
+    DeferredExpression deferred;
+    /* returned before anything else is scanned */
+    int pending_token;
+    /* return function bodies as a single DEFERRED_BODY token */
+    bool defer_function_bodies;
+    bool in_function_signature;
+    bool at_function_body;
+} FastLexer;
+
+extern _Thread_local FastLexer *fast_lexer;
+void fast_lexer_init(FastLexer *lexer, const char *data, size_t length,
+                     int line, int column);
+int fast_lexer_next(FastLexer *lexer);
+
+/* Parses data into ast; data must be followed by two NUL bytes */
+extern bool use_fast_lexer;
+extern bool defer_function_bodies;
+int parse_buffer(char *data, size_t length);
+/* Parses part of a file, starting at line and column, with the fast lexer,
+ * numbering its definitions from first_index */
+int parse_buffer_at(const char *data, size_t length, int line, int column,
+                    size_t first_index);
+/* Where the numbering of the definitions the REPL parses goes on from */
+size_t next_definition_index();
+void set_next_definition_index(size_t index);
+
+static inline const char *intern_view(SourceView view) {
+    return intern_string(view.start, view.length);
+}
 
 typedef enum {
     UNDEFINED,
@@ -41,6 +159,14 @@ typedef enum {
     LESSER_EQUALS_EXPRESSION,
     IF_EXPRESSION,
     FUNCTION_CALL_EXPRESSION,
+    /* written by fuse_program, for the tree engine only */
+    ARGUMENT_EXPRESSION,     /* a variable naming an argument */
+    ADD_CONSTANT_EXPRESSION, /* a sum whose second operand is a literal */
+    BRANCH_EXPRESSION, /* an if comparing with a literal as second operand */
+    CALL1_EXPRESSION,  /* calls whose frame has a fixed size */
+    CALL2_EXPRESSION,
+    CALL3_EXPRESSION,
+    CALL4_EXPRESSION,
 } ExpressionType;
 
 typedef enum {
@@ -62,12 +188,31 @@ struct _Variable {
 typedef struct {
     const char *name;
     Type type;
+    bool lazy; /* not always used, so passed unevaluated */
 } Argument;
 
+/* A function of the shape
+ *     f(acc, n, ...) = if <n compared to limit> then base
+ *                      else f(acc op operand, n + step, ...)
+ * with op associative and its other arguments passed on unchanged, which
+ * folds operand over a range of n */
+typedef struct {
+    size_t accumulator; /* index in args */
+    size_t counter;
+    ExpressionType op;
+    Expression *operand;
+    Expression *step;
+    ExpressionType comparison; /* of n to limit, true for the base case */
+    Expression *limit;
+    Expression *base;
+} Reduction;
+
 struct _Function {
     const char *funcname;
     Type return_type;
-    Expression *expression;
+    Expression *expression; /* NULL until a deferred body is parsed */
+    DeferredExpression deferred_body;
+    Reduction *reduction; /* set by find_reductions */
     size_t arglen;
     Argument args[];
 };
@@ -93,11 +238,24 @@ union _ExpressionValue {
         size_t arglen;
         Expression **args;
     } function_call;
+    struct {
+        const char *name;
+        size_t slot; /* in the frame of the function */
+    } argument;
+    struct {
+        const char *funcname;
+        Function *func; /* the callee, looked up once */
+        Expression **args;
+    } call;
 };
 
 struct _Expression {
     // Type result_type;
     ExpressionType type;
+    int line; /* of its first token */
+    int column;
+    int end_line; /* of the last character of its last token */
+    int end_column;
     ExpressionValue value;
 };
 
@@ -112,6 +270,8 @@ typedef enum {
 struct _AST {
     AST_TYPE type;
     bool semantically_correct;
+    size_t definition_index; /* position among the definitions of its file */
+    Arena *arena;            /* owns every node of the definition */
     union {
         Function *func;
         Variable *var;
@@ -123,13 +283,261 @@ typedef struct _AST AST;
 
 DS_TABLE_DEC(ast, AST);
 
-extern ast_table_t *ast;
+/* The program being worked on. Thread local, so that every server worker can
+ * point it at the program of the request it is serving. */
+extern _Thread_local ast_table_t *ast;
+
+/* Parses a function body left unparsed by defer_function_bodies */
+bool parse_function_body(Function *func, Arena *arena);
 
-extern char semantic_error_msg[];
+extern _Thread_local char semantic_error_msg[];
 bool verify_semantics();
+bool verify_reachable_semantics(const char *entry);
 
-extern char runtime_error_msg[];
+typedef enum {
+    EVALUATION_ERROR,
+    CALL_BUDGET_EXHAUSTED,
+    DEADLINE_EXCEEDED,
+    DEPTH_EXCEEDED,
+    EXECUTION_INTERRUPTED,
+} RuntimeErrorType;
+
+/* Limits for a single evaluation, 0 means no limit */
+typedef struct {
+    size_t max_calls;
+    double max_seconds;
+    size_t max_depth; /* of nested calls, before the stack overflows */
+} ExecutionBudget;
+
+extern _Thread_local char runtime_error_msg[];
+extern _Thread_local RuntimeErrorType runtime_error_type;
+void set_execution_budget(ExecutionBudget budget);
+ExecutionBudget get_execution_budget();
+/* Evaluations fail until the interruption is cleared */
+void interrupt_execution();
+void clear_interruption();
 bool interpret(int input, int *output);
+bool initialize_globals();
+/* Evaluate the global variables missing from the tables */
+bool evaluate_globals();
+bool evaluate_global(Variable *var);
+/* Runs main on input, once globals are initialized */
+bool interpret_main(int input, int *output);
+bool interpret_function(const char *funcname, const int *inputs, size_t len,
+                        int *output);
+bool interpret_expression(Expression *exp, Type type, int *output);
+/* Evaluates main over every input, many at a time; failed is set for the
+ * inputs whose evaluation raised a runtime error */
+bool interpret_batch(const int *inputs, size_t count, int *outputs,
+                     bool *failed);
+
+/* Sampling Profiler */
+
+/* Functions being executed, outermost first, for the profiler to sample.
+ * Frames deeper than the capacity are counted but not kept. */
+#define SHADOW_STACK_CAPACITY 1024
+
+typedef struct {
+    Function *frames[SHADOW_STACK_CAPACITY];
+    size_t depth;
+} ShadowStack;
+
+extern _Thread_local ShadowStack shadow_stack;
+
+static inline void push_shadow_frame(Function *func) {
+    if (shadow_stack.depth < SHADOW_STACK_CAPACITY)
+        shadow_stack.frames[shadow_stack.depth] = func;
+    /* the signal handler must not see the depth before the frame */
+    atomic_signal_fence(memory_order_release);
+    shadow_stack.depth++;
+}
+
+static inline void pop_shadow_frame() { shadow_stack.depth--; }
+
+extern bool profiling;
+bool start_profiler(const char *path, unsigned rate);
+void flush_profile_samples();
+bool stop_profiler();
+
+/* Optimization */
+
+/* Folds constants and specializes functions for the constant arguments they
+ * are called with; run on a verified program */
+void optimize_program();
+
+/* Strictness Analysis */
+
+/* Marks the arguments a function does not always evaluate as lazy */
+void analyze_strictness();
+
+/* Parallel Reductions */
+
+/* Finds the functions folding an associative operator over a range, which
+ * are then evaluated in chunks on every thread */
+void find_reductions();
+
+/* Superinstructions */
+
+/* Rewrites common shapes of verified bodies into node kinds evaluated with
+ * fewer dispatches: arguments read by slot, sums and comparisons with a
+ * literal, and calls of up to four arguments with fixed size frames */
+void fuse_program();
+
+/* Closure Engine */
+
+/* Evaluates programs compiled into closures instead of walking the syntax
+ * tree */
+extern bool use_closure_engine;
+
+/* Memo Cache */
+
+/* Results of expensive calls, kept in a file across runs of a program */
+#define MEMO_MAX_ARGS 6
+
+extern bool memoizing;
+bool open_memo_cache(const char *path, size_t max_bytes);
+void set_memo_program(uint64_t program_hash);
+bool memo_lookup(Function *func, const int *args, int *result);
+void memo_store(Function *func, const int *args, int result);
+void close_memo_cache();
+
+/* Hot Spots */
+
+/* Counts the evaluations of every expression while set */
+extern bool counting_hits;
+void count_hits(Expression *exp, size_t hits);
+bool write_hotspots(const char *source_file, const char *path);
+
+/* Tracing */
+
+/* Phases and definitions are recorded as spans while tracing */
+extern bool tracing;
+bool start_trace(const char *path);
+double trace_begin();
+void trace_end(const char *category, const char *name, double start);
+bool finish_trace();
+
+/* Parallelism */
+
+/* Tasks run on other threads, so thread local state such as ast has to be
+ * passed to them through data */
+typedef void (*ParallelTask)(size_t index, void *data);
+
+void set_thread_count(size_t threads);
+void parallel_for(size_t count, ParallelTask task, void *data);
+
+/* REPL */
+
+/* Inputs are parsed and evaluated in order on a thread of their own, so
+ * that reading goes on during an evaluation and Ctrl-C cancels it */
+void start_repl_evaluator(const char *prompt);
+/* prompt is printed once input is evaluated, after what it printed */
+void evaluate_repl_input(const char *input);
+/* Returns once every input given so far is evaluated */
+void wait_repl_inputs();
+
+/* Binary Serialization, of snapshots and module artifacts */
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} Writer;
+
+typedef struct {
+    const char *cursor;
+    const char *end;
+    Arena *arena; /* of the definition being read */
+    bool failed;
+} Reader;
+
+void put_bytes(Writer *writer, const void *data, size_t size);
+/* Expressions are written in prefix order, names written out */
+void put_expression(Writer *writer, Expression *exp);
+
+bool take_bytes(Reader *reader, void *data, size_t size);
+/* Names are interned again, nodes allocated in the arena of reader */
+const char *take_string(Reader *reader);
+void *take_node(Reader *reader, size_t size);
+Expression *take_expression(Reader *reader);
+
+static inline void put_byte(Writer *writer, uint8_t value) {
+    put_bytes(writer, &value, sizeof(value));
+}
+
+static inline void put_int(Writer *writer, int32_t value) {
+    put_bytes(writer, &value, sizeof(value));
+}
+
+static inline void put_size(Writer *writer, uint64_t value) {
+    put_bytes(writer, &value, sizeof(value));
+}
+
+static inline void put_string(Writer *writer, const char *str) {
+    size_t length = strlen(str);
+    put_size(writer, length);
+    put_bytes(writer, str, length);
+}
+
+static inline uint8_t take_byte(Reader *reader) {
+    uint8_t value;
+    take_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static inline int32_t take_int(Reader *reader) {
+    int32_t value;
+    take_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static inline uint64_t take_size(Reader *reader) {
+    uint64_t value;
+    take_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static inline Type take_type(Reader *reader) {
+    uint8_t type = take_byte(reader);
+    if (type > INT)
+        reader->failed = true;
+    return type;
+}
+
+/* The definitions and globals of a REPL session, saved with :save FILE and
+ * restored with --restore FILE */
+bool save_snapshot(const char *path);
+bool restore_snapshot(const char *path);
+
+/* Modules */
+
+/* Loads each file in order, verified against the ones before it. With
+ * cache_dir, a file is compiled once into an artifact there, which later
+ * loads open without reading more than its header. program_hash is set to a
+ * hash of the sources loaded. */
+bool import_modules(const char **paths, size_t count, const char *cache_dir,
+                    uint64_t *program_hash);
+/* Adds to ast the declarations of the imported definitions that its
+ * unverified trees refer to, verified and without bodies, and reports the
+ * imported names they define again */
+bool import_references();
+/* Loads the bodies of the imported declarations in ast, with the
+ * definitions they refer to, directly or not */
+bool import_bodies();
+
+/* Watch Mode */
+
+/* Runs main on input each time the file is written, reparsing only the
+ * definitions whose text changed */
+int watch_interpretation(const char *file_name, int input);
+
+/* Server Mode */
+
+/* Programs are compiled with the optimizations given, as for a file */
+int server_interpretation(const char *socket_path, size_t workers,
+                          size_t cache_size, bool optimize, bool lazy_args,
+                          bool fuse);
 
 #define STDOUT_STRING_LENGTH 500
 #define STDERR_STRING_LENGTH 500
@@ -140,11 +548,45 @@ extern char *STDERR_REDIRECT_STRING;
 DS_TABLE_DEC(integer, int);
 DS_TABLE_DEC(boolean, bool);
 
-extern integer_table_t *globalIntegers;
-extern boolean_table_t *globalBooleans;
+extern _Thread_local integer_table_t *globalIntegers;
+extern _Thread_local boolean_table_t *globalBooleans;
 
 // FIXME: Check if memory allocations fail
 
+static inline double monotonic_seconds() {
+#ifdef _WIN32
+    return (double)clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+static inline uint64_t content_hash(const char *data, size_t len) {
+    /* FNV-1a over the raw source bytes */
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/* Hashes data a word at a time, as content_hash, going a byte at a time, is
+ * bound by the latency of its multiplications */
+static inline uint64_t word_hash(const char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325 ^ len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+        hash ^= hash >> 32;
+    }
+    return hash ^ content_hash(data + i, len - i);
+}
+
 static inline const char *const Type_to_string(Type type) {
     // FIXME: should not be static inlined?
     switch (type) {
@@ -157,8 +599,30 @@ static inline const char *const Type_to_string(Type type) {
     }
 }
 
+static inline bool is_comparison(ExpressionType type) {
+    return (type >= EQUALS_EXPRESSION) && (type <= LESSER_EQUALS_EXPRESSION);
+}
+
+/* The comparison with its operands swapped, a < b being b > a */
+static inline ExpressionType swapped_comparison(ExpressionType type) {
+    switch (type) {
+    case GREATER_EXPRESSION:
+        return LESSER_EXPRESSION;
+    case GREATER_EQUALS_EXPRESSION:
+        return LESSER_EQUALS_EXPRESSION;
+    case LESSER_EXPRESSION:
+        return GREATER_EXPRESSION;
+    case LESSER_EQUALS_EXPRESSION:
+        return GREATER_EQUALS_EXPRESSION;
+    default:
+        return type;
+    }
+}
+
 static inline Function *make_function() {
-    return calloc(1, sizeof(Function) + sizeof(Argument));
+    Function *func = node_alloc(sizeof(Function) + sizeof(Argument));
+    *func = (Function){0};
+    return func;
 }
 
 static inline Function *set_function_name(Function *func,
@@ -174,6 +638,12 @@ static inline Function *set_function_return_value(Function *func, Type type,
     return func;
 }
 
+static inline Function *set_function_deferred_body(Function *func,
+                                                   DeferredExpression body) {
+    func->deferred_body = body;
+    return func;
+}
+
 static inline Function *add_function_argument(Function *func,
                                               const char *argname, Type type) {
     if (func->arglen == 0) {
@@ -181,18 +651,20 @@ static inline Function *add_function_argument(Function *func,
         func->arglen = 1;
         return func;
     }
-    func =
-        realloc(func, sizeof(Function) + sizeof(Argument) * (func->arglen + 1));
+    func = node_realloc(func,
+                        sizeof(Function) + sizeof(Argument) * func->arglen,
+                        sizeof(Function) +
+                            sizeof(Argument) * (func->arglen + 1));
     func->args[func->arglen] = (Argument){.type = type, .name = argname};
     func->arglen += 1;
     return func;
 }
 
 static inline Expression *make_function_call_expression() {
-    Expression *result = malloc(sizeof(Expression));
-    *result = (Expression){.type = FUNCTION_CALL_EXPRESSION,
-                           .value.function_call.args =
-                               calloc(1, sizeof(Expression *))};
+    Expression *result = node_alloc(sizeof(Expression));
+    *result = (Expression){
+        .type = FUNCTION_CALL_EXPRESSION,
+        .value.function_call.args = node_alloc(sizeof(Expression *))};
     return result;
 }
 
@@ -214,7 +686,8 @@ add_function_call_argument_expression(Expression *func, Expression *exp) {
         FUNC.arglen = 1;
         return func;
     }
-    FUNC.args = realloc(FUNC.args, sizeof(Expression *) * (FUNC.arglen + 1));
+    FUNC.args = node_realloc(FUNC.args, sizeof(Expression *) * FUNC.arglen,
+                             sizeof(Expression *) * (FUNC.arglen + 1));
     FUNC.args[FUNC.arglen] = exp;
     FUNC.arglen += 1;
 #undef FUNC
@@ -223,33 +696,33 @@ add_function_call_argument_expression(Expression *func, Expression *exp) {
 
 static inline Variable *make_variable(const char *varname, Type type,
                                       Expression *exp) {
-    Variable *result = malloc(sizeof(Variable));
+    Variable *result = node_alloc(sizeof(Variable));
     *result = (Variable){.type = type, .name = varname, .expression = exp};
     return result;
 }
 
 static inline Expression *make_integer_expression(int n) {
-    Expression *result = malloc(sizeof(Expression));
+    Expression *result = node_alloc(sizeof(Expression));
     *result = (Expression){.type = INTEGER_EXPRESSION, .value.integer = n};
     return result;
 }
 
 static inline Expression *make_variable_expression(const char *varname) {
-    Expression *result = malloc(sizeof(Expression));
+    Expression *result = node_alloc(sizeof(Expression));
     *result =
         (Expression){.type = VARIABLE_EXPRESSION, .value.variable = varname};
     return result;
 }
 
 static inline Expression *make_boolean_expression(bool b) {
-    Expression *result = malloc(sizeof(Expression));
+    Expression *result = node_alloc(sizeof(Expression));
     *result = (Expression){.type = BOOLEAN_EXPRESSION, .value.boolean = b};
     return result;
 }
 
 static inline Expression *
 make_binary_expression(Expression *fst, Expression *snd, ExpressionType type) {
-    Expression *result = malloc(sizeof(Expression));
+    Expression *result = node_alloc(sizeof(Expression));
     *result = (Expression){
         .type = type, .value.binary.fst = fst, .value.binary.snd = snd};
     return result;
@@ -257,14 +730,14 @@ make_binary_expression(Expression *fst, Expression *snd, ExpressionType type) {
 
 static inline Expression *make_unary_expression(Expression *fst,
                                                 ExpressionType type) {
-    Expression *result = malloc(sizeof(Expression));
+    Expression *result = node_alloc(sizeof(Expression));
     *result = (Expression){.type = type, .value.unary.fst = fst};
     return result;
 }
 
 static inline Expression *make_if_expression(Expression *condition,
                                              Expression *yes, Expression *no) {
-    Expression *result = malloc(sizeof(Expression));
+    Expression *result = node_alloc(sizeof(Expression));
     *result = (Expression){.type = IF_EXPRESSION,
                            .value.if_statement.condition = condition,
                            .value.if_statement.yes = yes,
@@ -446,21 +919,8 @@ static inline void print_ast_table(ast_table_t *ast) {
     }
 }
 
-static inline void clear_expression(Expression *exp) {
-    // TODO: implement
-}
-
-static inline void clear_variable(Variable *var) {
-    // TODO: implement
-}
-
-static inline void clear_function(Function *func) {
-    // TODO: implement
-}
-
-static inline void clear_ast(AST tree) {
-    // TODO: implement
-}
+/* Nodes are not freed one by one, the arena of their definition owns them */
+static inline void clear_ast(AST tree) { arena_release(tree.arena); }
 
 static inline void clean_integer(int x) {}
 static inline void clean_boolean(bool x) {}
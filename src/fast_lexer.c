@@ -0,0 +1,320 @@
+#include "common.h"
+#include "parser.tab.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Used by yylex instead of flex while a buffer is scanned with it */
+_Thread_local FastLexer *fast_lexer;
+
+YYSTYPE yylval;
+
+int flex_lex(void);
+extern char *yytext;
+
+/* From the first character of a token to its last */
+static inline YYLTYPE token_location(int line, int column, int end_line,
+                                     int end_column) {
+    return (YYLTYPE){.first_line = line,
+                     .first_column = column,
+                     .last_line = end_line,
+                     .last_column = end_column};
+}
+
+/* Reports a character no token starts with as a syntax error, at its
+ * position, escaped unless printable; the parser gives up without calling
+ * yyerror again */
+static int invalid_character(YYLTYPE *location, char c) {
+    char msg[32];
+    if (isprint((unsigned char)c))
+        snprintf(msg, sizeof(msg), "Invalid character '%c'", c);
+    else
+        snprintf(msg, sizeof(msg), "Invalid character '\\x%02x'",
+                 (unsigned char)c);
+    yyerror(location, msg);
+    return YYerror;
+}
+
+/* flex keeps its state in globals, so only the fast lexer is used by more
+ * than one thread */
+int yylex(YYSTYPE *value, YYLTYPE *location) {
+    if (!fast_lexer) {
+        int token = flex_lex();
+        *value = yylval;
+        /* no token flex returns spans lines */
+        *location = token_location(yylineno, column, yylineno,
+                                   column + (int)strlen(yytext) - 1);
+        return token == YYUNDEF ? invalid_character(location, *yytext)
+                                : token;
+    }
+
+    int token = fast_lexer_next(fast_lexer);
+    /* the lexer is past the token */
+    *location =
+        token_location(fast_lexer->token_line, fast_lexer->token_column,
+                       fast_lexer->line, fast_lexer->column - 1);
+    if (token == YYUNDEF)
+        return invalid_character(location, *fast_lexer->token_start);
+    if (token == IDENTIFIER)
+        value->view = fast_lexer->view;
+    else if (token == INTEGER)
+        value->integer = fast_lexer->integer;
+    else if (token == DEFERRED_BODY)
+        value->deferred = fast_lexer->deferred;
+    return token;
+}
+
+/* Keywords, placed by (first char + 6 * last char + length) % 16 */
+static const struct {
+    const char *word;
+    size_t length;
+    int token;
+} keywords[16] = {
+    [0] = {"valdef", 6, KW_VALDEF}, [1] = {"funcdef", 7, KW_FUNCDEF},
+    [14] = {"bool", 4, KW_BOOL},    [4] = {"int", 3, KW_INT},
+    [6] = {"true", 4, KW_TRUE},     [9] = {"false", 5, KW_FALSE},
+    [15] = {"if", 2, KW_IF},        [12] = {"then", 4, KW_THEN},
+    [7] = {"else", 4, KW_ELSE},
+};
+
+static inline int keyword_token(const char *start, size_t length) {
+    if ((length < 2) || (length > 7))
+        return IDENTIFIER;
+    size_t slot = ((unsigned char)start[0] +
+                   6 * (unsigned char)start[length - 1] + length) &
+                  15;
+    if ((keywords[slot].length == length) &&
+        (!memcmp(keywords[slot].word, start, length)))
+        return keywords[slot].token;
+    return IDENTIFIER;
+}
+
+static const bool identifier_chars[256] = {
+    ['0' ... '9'] = true, ['a' ... 'z'] = true, ['A' ... 'Z'] = true,
+    ['_'] = true,
+};
+
+/* Returns the first character from p that is not a space or tab */
+static inline const char *skip_blanks(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i tabs = _mm_set1_epi8('\t');
+    const __m128i returns = _mm_set1_epi8('\r');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        unsigned blanks = _mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, spaces),
+                         _mm_cmpeq_epi8(chunk, tabs)),
+            _mm_cmpeq_epi8(chunk, returns)));
+        if (blanks != 0xFFFF)
+            return p + __builtin_ctz(~blanks);
+        p += 16;
+    }
+#endif
+    while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r')))
+        p++;
+    return p;
+}
+
+/* Returns the first newline from p, or end */
+static inline const char *find_newline(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i newlines = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        unsigned found = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newlines));
+        if (found)
+            return p + __builtin_ctz(found);
+        p += 16;
+    }
+#endif
+    while ((p < end) && (*p != '\n'))
+        p++;
+    return p;
+}
+
+void fast_lexer_init(FastLexer *lexer, const char *data, size_t length,
+                     int line, int column) {
+    *lexer = (FastLexer){.cursor = data,
+                         .end = data + length,
+                         .line = line,
+                         .column = column,
+                         .token_line = line,
+                         .token_column = column};
+}
+
+/* Scans up to the STATEMENT_END of a function body and returns it as one
+ * DEFERRED_BODY token, leaving the STATEMENT_END to be read next */
+static int defer_function_body(FastLexer *lexer) {
+    const char *start = lexer->cursor;
+    int line = lexer->line;
+    int column = lexer->column;
+
+    lexer->defer_function_bodies = false;
+    int token;
+    do {
+        token = fast_lexer_next(lexer);
+    } while (token && (token != STATEMENT_END));
+    lexer->defer_function_bodies = true;
+
+    const char *body_end = lexer->cursor;
+    if (token) {
+        /* STATEMENT_END is one character, step back over it */
+        body_end = lexer->token_start;
+        lexer->cursor = lexer->token_start;
+        lexer->line = lexer->token_line;
+        lexer->column = lexer->token_column;
+    }
+
+    lexer->deferred = (DeferredExpression){
+        .start = start, .length = body_end - start, .line = line,
+        .column = column};
+    lexer->token_line = line;
+    lexer->token_column = column;
+    return DEFERRED_BODY;
+}
+
+int fast_lexer_next(FastLexer *lexer) {
+    if (lexer->pending_token) {
+        int token = lexer->pending_token;
+        lexer->pending_token = 0;
+        return token;
+    }
+    if (lexer->at_function_body) {
+        lexer->at_function_body = false;
+        return defer_function_body(lexer);
+    }
+
+    const char *p = lexer->cursor;
+    const char *end = lexer->end;
+
+    while (p < end) {
+        const char *start = p;
+
+        switch (*p) {
+        case ' ':
+        case '\t':
+        case '\r': /* of a CRLF line ending */
+            p = skip_blanks(p, end);
+            lexer->column += p - start;
+            continue;
+        case '\n':
+            lexer->line++;
+            lexer->column = 1;
+            p++;
+            continue;
+        case '/':
+            /* like lexer.l, a comment needs at least one character after
+             * the slashes, otherwise they are two divisions */
+            if ((end - p > 2) && (p[1] == '/') && (p[2] != '\n')) {
+                p = find_newline(p, end);
+                continue;
+            }
+            break;
+        default:
+            break;
+        }
+
+        lexer->token_start = p;
+        lexer->token_line = lexer->line;
+        lexer->token_column = lexer->column;
+
+        int token;
+        if ((identifier_chars[(unsigned char)*p]) &&
+            ((*p < '0') || (*p > '9'))) {
+            do {
+                p++;
+            } while ((p < end) && (identifier_chars[(unsigned char)*p]));
+            lexer->view = (SourceView){start, p - start};
+            token = keyword_token(start, p - start);
+        } else if ((*p >= '0') && (*p <= '9')) {
+            /* same result as atoi, saturating like strtol does */
+            int64_t value = 0;
+            do {
+                int digit = *p - '0';
+                value = value <= (INT64_MAX - digit) / 10 ? value * 10 + digit
+                                                          : INT64_MAX;
+                p++;
+            } while ((p < end) && (*p >= '0') && (*p <= '9'));
+            lexer->integer = (int)value;
+            token = INTEGER;
+        } else {
+            char next = end - p > 1 ? p[1] : 0;
+            p++;
+            switch (*start) {
+            case ';':
+                token = STATEMENT_END;
+                break;
+            case ':':
+                token = TYPE_OF;
+                break;
+            case ',':
+                token = COMMA;
+                break;
+            case '+':
+                token = PLUS;
+                break;
+            case '-':
+                token = next == '>' ? (p++, RETURN) : MINUS;
+                break;
+            case '*':
+                token = MULTIPLY;
+                break;
+            case '/':
+                token = DIVIDE;
+                break;
+            case '%':
+                token = MODULO;
+                break;
+            case '&':
+                token = next == '&' ? (p++, AND) : YYUNDEF;
+                break;
+            case '|':
+                token = next == '|' ? (p++, OR) : YYUNDEF;
+                break;
+            case '!':
+                token = next == '=' ? (p++, NOT_EQUALS) : NOT;
+                break;
+            case '=':
+                token = next == '=' ? (p++, EQUALS) : ASSIGN;
+                break;
+            case '>':
+                token = next == '=' ? (p++, GREATER_EQUALS) : GREATER;
+                break;
+            case '<':
+                token = next == '=' ? (p++, LESSER_EQUALS) : LESSER;
+                break;
+            case '(':
+                token = OPEN_BRACKETS;
+                break;
+            case ')':
+                token = CLOSE_BRACKETS;
+                break;
+            default:
+                /* reported by yylex */
+                token = YYUNDEF;
+            }
+        }
+
+        lexer->column += p - start;
+
+        lexer->cursor = p;
+        if (lexer->defer_function_bodies) {
+            /* the first ASSIGN after funcdef starts the body */
+            if (token == KW_FUNCDEF) {
+                lexer->in_function_signature = true;
+            } else if ((token == ASSIGN) && (lexer->in_function_signature)) {
+                lexer->in_function_signature = false;
+                lexer->at_function_body = true;
+            }
+        }
+        return token;
+    }
+
+    lexer->cursor = p;
+    return 0;
+}
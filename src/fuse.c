@@ -0,0 +1,119 @@
+#include "common.h"
+#include <errno.h>
+#include <string.h>
+
+static inline void swap_operands(Expression *exp) {
+    Expression *fst = exp->value.binary.fst;
+    exp->value.binary.fst = exp->value.binary.snd;
+    exp->value.binary.snd = fst;
+}
+
+/* Moves a literal operand of exp to the right, which for a comparison
+ * means swapping it too; returns whether there is one */
+static bool literal_on_right(Expression *exp) {
+    if ((exp->value.binary.fst->type == INTEGER_EXPRESSION) &&
+        (exp->value.binary.snd->type != INTEGER_EXPRESSION)) {
+        swap_operands(exp);
+        exp->type = swapped_comparison(exp->type);
+    }
+    return exp->value.binary.snd->type == INTEGER_EXPRESSION;
+}
+
+/* Arguments evaluated when called, so that the frame is filled in order */
+static bool has_fixed_frame(Function *func) {
+    if ((func->reduction) || (!func->arglen) || (func->arglen > 4))
+        return false;
+    for (size_t i = 0; i < func->arglen; i++) {
+        if (func->args[i].lazy)
+            return false;
+    }
+    return true;
+}
+
+/* Rewrites exp, in a body of scope or a variable for a NULL scope, operands
+ * first */
+static void fuse_expression(Expression *exp, Function *scope) {
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return;
+    case ARGUMENT_EXPRESSION:
+    case ADD_CONSTANT_EXPRESSION:
+    case BRANCH_EXPRESSION:
+    case CALL1_EXPRESSION:
+    case CALL2_EXPRESSION:
+    case CALL3_EXPRESSION:
+    case CALL4_EXPRESSION:
+        /* fused already, in a subtree reached twice */
+        return;
+    case VARIABLE_EXPRESSION:
+        for (size_t i = 0; (scope) && (i < scope->arglen); i++) {
+            if (strcmp(scope->args[i].name, exp->value.variable))
+                continue;
+            const char *name = exp->value.variable;
+            exp->type = ARGUMENT_EXPRESSION;
+            exp->value.argument.name = name;
+            exp->value.argument.slot = i;
+            return;
+        }
+        return;
+    case MINUS_EXPRESSION:
+        fuse_expression(exp->value.unary.fst, scope);
+        /* how the parser reads a negative literal */
+        if (exp->value.unary.fst->type == INTEGER_EXPRESSION) {
+            unsigned value = exp->value.unary.fst->value.integer;
+            exp->type = INTEGER_EXPRESSION;
+            exp->value.integer = (int)(0u - value);
+        }
+        return;
+    case NOT_EXPRESSION:
+        fuse_expression(exp->value.unary.fst, scope);
+        return;
+    case IF_EXPRESSION: {
+        Expression *condition = exp->value.if_statement.condition;
+        fuse_expression(condition, scope);
+        fuse_expression(exp->value.if_statement.yes, scope);
+        fuse_expression(exp->value.if_statement.no, scope);
+        if ((is_comparison(condition->type)) && (literal_on_right(condition)))
+            exp->type = BRANCH_EXPRESSION;
+        return;
+    }
+    case FUNCTION_CALL_EXPRESSION: {
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            fuse_expression(exp->value.function_call.args[i], scope);
+        }
+        AST *tree = ast_table_get_ptr(ast, exp->value.function_call.funcname);
+        errno = 0;
+        if ((!tree) || (!has_fixed_frame(tree->value.func)))
+            return;
+        /* func takes the place of arglen, the type tells it */
+        exp->type = CALL1_EXPRESSION + tree->value.func->arglen - 1;
+        exp->value.call.func = tree->value.func;
+        return;
+    }
+    default:
+        fuse_expression(exp->value.binary.fst, scope);
+        fuse_expression(exp->value.binary.snd, scope);
+        if ((exp->type == PLUS_EXPRESSION) && (literal_on_right(exp)))
+            exp->type = ADD_CONSTANT_EXPRESSION;
+        return;
+    }
+}
+
+/* Runs on a verified program, after every other pass, as they only know
+ * the node kinds of the parser */
+void fuse_program() {
+    double start = trace_begin();
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if (!tree->semantically_correct)
+            continue;
+        if ((tree->type == AST_FUNCTION) && (tree->value.func->expression))
+            fuse_expression(tree->value.func->expression, tree->value.func);
+        else if (tree->type == AST_VARIABLE)
+            fuse_expression(tree->value.var->expression, NULL);
+    }
+    trace_end("phase", "fuse", start);
+}
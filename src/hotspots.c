@@ -0,0 +1,186 @@
+#include "common.h"
+#include <string.h>
+
+/* Evaluations of every expression node, kept apart from the nodes so that
+ * they stay small when nothing is counted. Open addressing on the node
+ * address; the capacity is always a power of 2. */
+typedef struct {
+    Expression *node;
+    size_t hits;
+} NodeHits;
+
+/* The hottest node starting on a line, and the hits of all of them */
+typedef struct {
+    size_t hits;
+    Expression *hottest;
+    size_t hottest_hits;
+} LineHits;
+
+bool counting_hits = false;
+
+static NodeHits *node_hits;
+static size_t node_hits_capacity;
+static size_t node_hits_count;
+
+static const char *expression_names[] = {
+    [UNDEFINED] = "?",
+    [INTEGER_EXPRESSION] = "integer",
+    [VARIABLE_EXPRESSION] = "variable",
+    [BOOLEAN_EXPRESSION] = "boolean",
+    [PLUS_EXPRESSION] = "+",
+    [MINUS_EXPRESSION] = "unary -",
+    [MULTIPLY_EXPRESSION] = "*",
+    [DIVIDE_EXPRESSION] = "/",
+    [MODULO_EXPRESSION] = "%",
+    [AND_EXPRESSION] = "&&",
+    [OR_EXPRESSION] = "||",
+    [NOT_EXPRESSION] = "!",
+    [EQUALS_EXPRESSION] = "==",
+    [NOT_EQUALS_EXPRESSION] = "!=",
+    [GREATER_EXPRESSION] = ">",
+    [GREATER_EQUALS_EXPRESSION] = ">=",
+    [LESSER_EXPRESSION] = "<",
+    [LESSER_EQUALS_EXPRESSION] = "<=",
+    [IF_EXPRESSION] = "if",
+    [FUNCTION_CALL_EXPRESSION] = "call",
+};
+
+static inline size_t node_slot(Expression *node, size_t capacity) {
+    return ((uintptr_t)node >> 4) * 0x9e3779b97f4a7c15 & (capacity - 1);
+}
+
+static bool grow_node_hits() {
+    size_t capacity = node_hits_capacity ? node_hits_capacity * 2 : 1024;
+    NodeHits *grown = tracked_calloc(MEMORY_INTERPRETER, capacity,
+                                     sizeof(NodeHits));
+    if (!grown)
+        return false;
+
+    for (size_t i = 0; i < node_hits_capacity; i++) {
+        if (!node_hits[i].node)
+            continue;
+        size_t slot = node_slot(node_hits[i].node, capacity);
+        while (grown[slot].node)
+            slot = (slot + 1) & (capacity - 1);
+        grown[slot] = node_hits[i];
+    }
+    tracked_free(node_hits);
+    node_hits = grown;
+    node_hits_capacity = capacity;
+    return true;
+}
+
+/* Called by the evaluators for every node they evaluate while counting */
+void count_hits(Expression *exp, size_t hits) {
+    if (((node_hits_count + 1) * 2 > node_hits_capacity) &&
+        (!grow_node_hits()))
+        return;
+
+    size_t slot = node_slot(exp, node_hits_capacity);
+    while ((node_hits[slot].node) && (node_hits[slot].node != exp))
+        slot = (slot + 1) & (node_hits_capacity - 1);
+    if (!node_hits[slot].node) {
+        node_hits[slot].node = exp;
+        node_hits_count++;
+    }
+    node_hits[slot].hits += hits;
+}
+
+/* Whether a starts first on their line, or as well and ends after b, so that
+ * of nested expressions as hot as each other the outer one is shown */
+static inline bool encloses(Expression *a, Expression *b) {
+    if (a->column != b->column)
+        return a->column < b->column;
+    return (a->end_line > b->end_line) ||
+           ((a->end_line == b->end_line) && (a->end_column > b->end_column));
+}
+
+static void write_line_hits(FILE *out, const char *line, size_t length,
+                            size_t number, LineHits *hits, size_t total) {
+    if (hits->hits)
+        fprintf(out, "%12zu %6.2f%% %5zu | %.*s\n", hits->hits,
+                100.0 * hits->hits / total, number, (int)length, line);
+    else
+        fprintf(out, "%12s %7s %5zu | %.*s\n", "", "", number, (int)length,
+                line);
+    if (!hits->hottest)
+        return;
+
+    /* the hottest expression underlined up to its end or the end of the
+     * line, keeping tabs so it lines up */
+    Expression *hottest = hits->hottest;
+    int end = (size_t)hottest->end_line == number ? hottest->end_column
+                                                   : (int)length;
+    fprintf(out, "%12s %7s %5s | ", "", "", "");
+    for (int i = 1; (i < hottest->column) && ((size_t)i <= length); i++) {
+        fputc(line[i - 1] == '\t' ? '\t' : ' ', out);
+    }
+    fputc('^', out);
+    for (int i = hottest->column + 1; (i <= end) && ((size_t)i <= length);
+         i++) {
+        fputc(line[i - 1] == '\t' ? '\t' : '~', out);
+    }
+    fprintf(out, " %zu (%s)\n", hits->hottest_hits,
+            expression_names[hottest->type]);
+}
+
+/* Writes source_file with the evaluations of the expressions starting on
+ * every line, and where the hottest of them is */
+bool write_hotspots(const char *source_file, const char *path) {
+    Source source;
+    if (!load_source(source_file, &source)) {
+        fprintf(stderr, "Could not open file \"%s\"\n", source_file);
+        return false;
+    }
+
+    size_t line_count = 1;
+    for (size_t i = 0; i < source.length; i++) {
+        line_count += source.data[i] == '\n';
+    }
+    LineHits *lines =
+        tracked_calloc(MEMORY_INTERPRETER, line_count + 1, sizeof(LineHits));
+    FILE *out = strcmp(path, "-") ? fopen(path, "w") : stderr;
+    if ((!lines) || (!out)) {
+        fprintf(stderr, "Could not write hot spots to \"%s\"\n", path);
+        tracked_free(lines);
+        unload_source(&source);
+        return false;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < node_hits_capacity; i++) {
+        Expression *node = node_hits[i].node;
+        if ((!node) || (node->line < 1) || ((size_t)node->line > line_count))
+            continue;
+        LineHits *line = lines + node->line;
+        line->hits += node_hits[i].hits;
+        total += node_hits[i].hits;
+        if ((!line->hottest) || (node_hits[i].hits > line->hottest_hits) ||
+            ((node_hits[i].hits == line->hottest_hits) &&
+             (encloses(node, line->hottest)))) {
+            line->hottest = node;
+            line->hottest_hits = node_hits[i].hits;
+        }
+    }
+
+    fprintf(out, "Hot spots of %s, %zu expression evaluations\n",
+            source_file, total);
+    fprintf(out, "%12s %7s %5s |\n", "hits", "%", "line");
+    const char *line = source.data;
+    const char *end = source.data + source.length;
+    for (size_t number = 1; number <= line_count; number++) {
+        const char *newline = memchr(line, '\n', end - line);
+        size_t length = (newline ? newline : end) - line;
+        if ((length) && (line[length - 1] == '\r'))
+            length--; /* of a CRLF line ending */
+        write_line_hits(out, line, length, number, lines + number,
+                        total ? total : 1);
+        line = newline ? newline + 1 : end;
+    }
+
+    if (out != stderr)
+        fclose(out);
+    tracked_free(lines);
+    unload_source(&source);
+    return true;
+}
@@ -0,0 +1,145 @@
+#include "common.h"
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* Interned names are packed into large chunks, freed with their pool */
+#define INTERN_CHUNK_SIZE 65536
+
+typedef struct {
+    uint64_t hash;
+    size_t length;
+    const char *string;
+} InternedString;
+
+typedef struct _InternChunk {
+    struct _InternChunk *next;
+    char data[];
+} InternChunk;
+
+struct _InternPool {
+    InternedString *interned;
+    size_t interned_capacity; /* always a power of 2 */
+    size_t interned_count;
+
+    InternChunk *chunks;
+    char *chunk;
+    size_t chunk_left;
+};
+
+_Thread_local InternPool *intern_pool;
+
+/* Names interned without a pool of their own live as long as the process.
+ * Programs parsed on several threads at once, by --check and the server,
+ * each have a pool, so this lock is only taken by single threaded modes. */
+static InternPool process_pool;
+#ifndef _WIN32
+static pthread_mutex_t process_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+InternPool *intern_pool_new() {
+    return tracked_calloc(MEMORY_AST, 1, sizeof(InternPool));
+}
+
+void intern_pool_free(InternPool *pool) {
+    if (!pool)
+        return;
+    InternChunk *chunk = pool->chunks;
+    while (chunk) {
+        InternChunk *next = chunk->next;
+        tracked_free(chunk);
+        chunk = next;
+    }
+    tracked_free(pool->interned);
+    tracked_free(pool);
+}
+
+static const char *copy_to_chunk(InternPool *pool, const char *str,
+                                 size_t length) {
+    if (length + 1 > pool->chunk_left) {
+        size_t size =
+            length + 1 > INTERN_CHUNK_SIZE ? length + 1 : INTERN_CHUNK_SIZE;
+        InternChunk *chunk =
+            tracked_malloc(MEMORY_AST, sizeof(InternChunk) + size);
+        if (!chunk) {
+            pool->chunk_left = 0;
+            return NULL;
+        }
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        pool->chunk = chunk->data;
+        pool->chunk_left = size;
+    }
+
+    char *copy = pool->chunk;
+    memcpy(copy, str, length);
+    copy[length] = 0;
+    pool->chunk += length + 1;
+    pool->chunk_left -= length + 1;
+    return copy;
+}
+
+static bool grow_interned(InternPool *pool) {
+    size_t capacity =
+        pool->interned_capacity ? pool->interned_capacity * 2 : 1024;
+    InternedString *entries =
+        tracked_calloc(MEMORY_AST, capacity, sizeof(InternedString));
+    if (!entries)
+        return false;
+
+    for (size_t i = 0; i < pool->interned_capacity; i++) {
+        if (!pool->interned[i].string)
+            continue;
+        size_t j = pool->interned[i].hash & (capacity - 1);
+        while (entries[j].string)
+            j = (j + 1) & (capacity - 1);
+        entries[j] = pool->interned[i];
+    }
+
+    tracked_free(pool->interned);
+    pool->interned = entries;
+    pool->interned_capacity = capacity;
+    return true;
+}
+
+static const char *find_or_insert(InternPool *pool, const char *str,
+                                  size_t length, uint64_t hash) {
+    if (((pool->interned_count + 1) * 2 > pool->interned_capacity) &&
+        (!grow_interned(pool)))
+        return NULL;
+
+    size_t mask = pool->interned_capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        InternedString *entry = pool->interned + i;
+        if (!entry->string) {
+            const char *copy = copy_to_chunk(pool, str, length);
+            if (!copy)
+                return NULL;
+            *entry = (InternedString){
+                .hash = hash, .length = length, .string = copy};
+            pool->interned_count++;
+            return copy;
+        }
+        if ((entry->hash == hash) && (entry->length == length) &&
+            (!memcmp(entry->string, str, length)))
+            return entry->string;
+    }
+}
+
+const char *intern_string(const char *str, size_t length) {
+    uint64_t hash = content_hash(str, length);
+    if (intern_pool)
+        return find_or_insert(intern_pool, str, length, hash);
+
+#ifndef _WIN32
+    pthread_mutex_lock(&process_pool_lock);
+#endif
+    const char *interned_string =
+        find_or_insert(&process_pool, str, length, hash);
+#ifndef _WIN32
+    pthread_mutex_unlock(&process_pool_lock);
+#endif
+    return interned_string;
+}
@@ -1,28 +1,46 @@
-#include "DS.h"
 #include "common.h"
 #include <assert.h>
 #include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 
 #define ERROR_MSG_LEN 500
 
-char runtime_error_msg[ERROR_MSG_LEN];
+/* Number of calls between two checks of the clock and interrupt flag */
+#define BUDGET_CHECK_INTERVAL 4096
+
+/* Calls needed to evaluate a call for its result to be memoized; cheaper
+ * calls cost less to redo than to look up */
+#define MEMO_MIN_CALLS 256
+
+_Thread_local char runtime_error_msg[ERROR_MSG_LEN];
+_Thread_local RuntimeErrorType runtime_error_type;
 
 typedef union {
     int integer;
     bool boolean;
 } ExpressionResult;
 
+typedef struct _Context Context;
+
 struct _context {
     const char *var_name;
     ExpressionResult var_value;
+    /* a lazy argument not evaluated yet, in the context of its caller,
+     * which outlives the call */
+    Expression *thunk;
+    Context *thunk_context;
 };
 
-typedef struct {
+struct _Context {
     size_t len;
     struct _context *variable;
-} Context;
+};
 
 size_t hash_function(const char *str);
 
@@ -33,15 +51,208 @@ ExpressionResult evaluate_expression(Expression *exp, Context *cxt);
 ExpressionResult execute_function_call(Function *func, Expression **args,
                                        Context *cxt);
 
-integer_table_t *globalIntegers;
-boolean_table_t *globalBooleans;
+static ExecutionBudget execution_budget;
+static volatile sig_atomic_t execution_interrupted;
+
+/* Counts down to the next budget check, decremented on every call */
+static _Thread_local size_t budget_countdown = BUDGET_CHECK_INTERVAL;
+static _Thread_local size_t budget_interval = BUDGET_CHECK_INTERVAL;
+static _Thread_local size_t budget_calls;
+static _Thread_local double budget_deadline;
+static _Thread_local size_t budget_max_depth = SIZE_MAX;
+
+/* Where runtime errors unwind to, NULL outside of an evaluation */
+static _Thread_local jmp_buf *runtime_error_handler;
+
+_Thread_local integer_table_t *globalIntegers;
+_Thread_local boolean_table_t *globalBooleans;
+
+static void runtime_error(RuntimeErrorType type, const char *msg, ...) {
+    va_list args;
+    va_start(args, msg);
+    vsnprintf(runtime_error_msg, ERROR_MSG_LEN, msg, args);
+    va_end(args);
+    runtime_error_type = type;
+
+    if (runtime_error_handler)
+        longjmp(*runtime_error_handler, 1);
+
+    fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+    exit(1);
+}
+
+/* Raises the errors of fst / snd and fst % snd, which C leaves undefined */
+static inline void check_division(int fst, int snd) {
+    if (snd == 0)
+        runtime_error(EVALUATION_ERROR, "Division by zero");
+    if ((fst == INT_MIN) && (snd == -1))
+        runtime_error(EVALUATION_ERROR, "Integer overflow in division");
+}
+
+void set_execution_budget(ExecutionBudget budget) { execution_budget = budget; }
+
+ExecutionBudget get_execution_budget() { return execution_budget; }
+
+void interrupt_execution() { execution_interrupted = 1; }
+
+void clear_interruption() { execution_interrupted = 0; }
+
+static void set_next_budget_check() {
+    budget_interval = BUDGET_CHECK_INTERVAL;
+    if ((execution_budget.max_calls) &&
+        (execution_budget.max_calls - budget_calls < BUDGET_CHECK_INTERVAL))
+        budget_interval = execution_budget.max_calls - budget_calls + 1;
+    budget_countdown = budget_interval;
+}
+
+static void start_execution_budget() {
+    budget_calls = 0;
+    budget_max_depth =
+        execution_budget.max_depth ? execution_budget.max_depth : SIZE_MAX;
+    budget_deadline = execution_budget.max_seconds
+                          ? monotonic_seconds() + execution_budget.max_seconds
+                          : 0;
+    set_next_budget_check();
+}
+
+/* Calls made since the evaluation started */
+static inline size_t calls_made() {
+    return budget_calls + budget_interval - budget_countdown;
+}
+
+static void check_execution_budget() {
+    budget_calls += budget_interval;
+    flush_profile_samples();
+
+    if (execution_interrupted)
+        runtime_error(EXECUTION_INTERRUPTED, "Execution interrupted");
+    if ((execution_budget.max_calls) &&
+        (budget_calls > execution_budget.max_calls))
+        runtime_error(CALL_BUDGET_EXHAUSTED,
+                      "Execution budget exhausted after %zu function calls",
+                      execution_budget.max_calls);
+    if ((budget_deadline) && (monotonic_seconds() >= budget_deadline))
+        runtime_error(DEADLINE_EXCEEDED,
+                      "Execution budget exhausted after %g seconds",
+                      execution_budget.max_seconds);
+
+    set_next_budget_check();
+}
+
+/* Checked on every call rather than with the rest of the budget, as the
+ * stack can overflow in between */
+static inline void check_call_depth() {
+    if (shadow_stack.depth >= budget_max_depth)
+        runtime_error(DEPTH_EXCEEDED,
+                      "Execution budget exhausted at a call depth of %zu",
+                      execution_budget.max_depth);
+}
+
+/* Evaluates exp, returning false if a runtime error was raised instead */
+static bool guarded_evaluate(Expression *exp, Context *cxt,
+                             ExpressionResult *result) {
+    jmp_buf handler;
+    jmp_buf *previous_handler = runtime_error_handler;
+    size_t shadow_depth = shadow_stack.depth;
+
+    if (setjmp(handler)) {
+        runtime_error_handler = previous_handler;
+        shadow_stack.depth = shadow_depth;
+        return false;
+    }
+
+    runtime_error_handler = &handler;
+    if (!previous_handler)
+        start_execution_budget();
+
+    *result = evaluate_expression(exp, cxt);
+    runtime_error_handler = previous_handler;
+    return true;
+}
+
+/* Returns main if it takes and returns an integer */
+static Function *find_main_function() {
+    AST *tree = ast_table_get_ptr(ast, "main");
+    errno = 0;
+    if ((!tree) || (tree->type != AST_FUNCTION)) {
+        snprintf(runtime_error_msg, ERROR_MSG_LEN, "%s",
+                 "Could not find 'main' function");
+        return NULL;
+    }
+
+    Function *main_func = tree->value.func;
+    if (main_func->return_type != INT) {
+        snprintf(runtime_error_msg, ERROR_MSG_LEN, "%s",
+                 "'main' function should return an integer");
+        return NULL;
+    }
+    if ((main_func->arglen != 1) || (main_func->args[0].type != INT)) {
+        snprintf(runtime_error_msg, ERROR_MSG_LEN, "%s",
+                 "'main' function should have only 1 integer argument");
+        return NULL;
+    }
+    return main_func;
+}
+
+/* initialize_globals in a span of its own */
+static bool trace_initialize_globals() {
+    double start = trace_begin();
+    bool initialized = initialize_globals();
+    trace_end("phase", "initialize globals", start);
+    return initialized;
+}
+
+static bool compile_closures();
+static bool interpret_closures(Function *func, const int *inputs,
+                               int *output);
 
 bool interpret(int input, int *output) {
+    return trace_initialize_globals() && interpret_main(input, output);
+}
+
+bool interpret_main(int input, int *output) {
+    if (!find_main_function())
+        return false;
+    if ((use_closure_engine) && (!compile_closures()))
+        return false;
+
+    double start = trace_begin();
+    bool evaluated = interpret_function("main", &input, 1, output);
+    trace_end("phase", "run", start);
+    return evaluated;
+}
+
+bool initialize_globals() {
     // initialize global variables table
     globalBooleans = boolean_table_new(100);
     globalIntegers = integer_table_new(100);
+    return evaluate_globals();
+}
+
+bool evaluate_global(Variable *var) {
+    if (integer_table_get_ptr(globalIntegers, var->name))
+        return true;
+    errno = 0;
+    if (boolean_table_get_ptr(globalBooleans, var->name))
+        return true;
+    errno = 0;
+
+    ExpressionResult result;
+    double start = trace_begin();
+    bool evaluated = guarded_evaluate(var->expression, NULL, &result);
+    trace_end("global", var->name, start);
+    if (!evaluated)
+        return false;
+
+    if (var->type == INT) {
+        assert(integer_table_insert(globalIntegers, var->name, result.integer));
+    } else {
+        assert(boolean_table_insert(globalBooleans, var->name, result.boolean));
+    }
+    return true;
+}
 
-    Function *main_func = NULL;
+bool evaluate_globals() {
     char *key;
     AST *tree;
     ast_table_iter(ast);
@@ -49,44 +260,10 @@ bool interpret(int input, int *output) {
     while (NULL != (tree = ast_table_iter_next(ast, &key))) {
         switch (tree->type) {
         case AST_VARIABLE:
-            if (integer_table_get_ptr(globalIntegers, tree->value.var->name)) {
-                break;
-            }
-            errno = 0;
-            if (tree->value.var->type == INT) {
-                assert(integer_table_insert(
-                    globalIntegers, tree->value.var->name,
-                    evaluate_expression(tree->value.var->expression, NULL)
-                        .integer));
-                break;
-            }
-            if (boolean_table_get_ptr(globalBooleans, tree->value.var->name)) {
-                break;
-            }
-            errno = 0;
-            if (tree->value.var->type == BOOL) {
-                assert(boolean_table_insert(
-                    globalBooleans, tree->value.var->name,
-                    evaluate_expression(tree->value.var->expression, NULL)
-                        .boolean));
-            }
+            if (!evaluate_global(tree->value.var))
+                return false;
             break;
         case AST_FUNCTION:
-            if (!strcmp(tree->value.func->funcname, "main")) {
-                main_func = tree->value.func;
-                if (main_func->return_type != INT) {
-                    snprintf(runtime_error_msg, ERROR_MSG_LEN, "%s",
-                             "'main' function should return an integer");
-                    return false;
-                }
-                if ((main_func->arglen != 1) ||
-                    (main_func->args[0].type != INT)) {
-                    snprintf(
-                        runtime_error_msg, ERROR_MSG_LEN, "%s",
-                        "'main' function should have only 1 integer argument");
-                    return false;
-                }
-            }
             break;
         case AST_EXPRESSION:
             snprintf(syntax_error_msg, ERROR_MSG_LEN, "Internal Error");
@@ -95,22 +272,124 @@ bool interpret(int input, int *output) {
         }
     }
 
-    if (!main_func) {
-        snprintf(runtime_error_msg, ERROR_MSG_LEN, "%s",
-                 "Could not find 'main' function");
+    return true;
+}
+
+bool interpret_function(const char *funcname, const int *inputs, size_t len,
+                        int *output) {
+    AST *tree = ast_table_get_ptr(ast, funcname);
+    errno = 0;
+    if ((!tree) || (tree->type != AST_FUNCTION)) {
+        snprintf(runtime_error_msg, ERROR_MSG_LEN,
+                 "Could not find '%s' function", funcname);
+        return false;
+    }
+
+    Function *func = tree->value.func;
+    if (func->arglen != len) {
+        snprintf(runtime_error_msg, ERROR_MSG_LEN,
+                 "'%s' function takes %zu arguments, but got %zu", funcname,
+                 func->arglen, len);
         return false;
     }
+    if (use_closure_engine)
+        return interpret_closures(func, inputs, output);
+
+    /* Arguments are stored in reverse order of their declaration */
+    struct _context args[len ? len : 1];
+    for (size_t i = 0; i < len; i++) {
+        Argument arg = func->args[len - 1 - i];
+        args[len - 1 - i] = (struct _context){
+            .var_name = arg.name,
+            .var_value = arg.type == INT
+                             ? (ExpressionResult){.integer = inputs[i]}
+                             : (ExpressionResult){.boolean = inputs[i] != 0}};
+    }
+    Context cxt = {.len = len, .variable = args};
 
-    struct _context args[1] = {
-        {.var_name = main_func->args[0].name,
-         .var_value = (ExpressionResult){.integer = input}}};
-    Context cxt = {.len = 1, .variable = args};
+    ExpressionResult result;
+    push_shadow_frame(func);
+    bool evaluated = guarded_evaluate(func->expression, &cxt, &result);
+    pop_shadow_frame();
+    if (!evaluated)
+        return false;
+    *output = func->return_type == INT ? result.integer : result.boolean;
+    return true;
+}
 
-    *output = evaluate_expression(main_func->expression, &cxt).integer;
+bool interpret_expression(Expression *exp, Type type, int *output) {
+    ExpressionResult result;
+    if (!guarded_evaluate(exp, NULL, &result))
+        return false;
+    *output = type == INT ? result.integer : result.boolean;
     return true;
 }
 
+/* Evaluates a lazy argument the first time it is used */
+static void force_argument(struct _context *variable) {
+    variable->var_value =
+        evaluate_expression(variable->thunk, variable->thunk_context);
+    variable->thunk = NULL;
+}
+
+/* The condition of a BRANCH_EXPRESSION, whose second operand is a literal */
+static inline bool compare_with_literal(Expression *condition, Context *cxt) {
+    int fst = evaluate_expression(condition->value.binary.fst, cxt).integer;
+    int snd = condition->value.binary.snd->value.integer;
+    switch (condition->type) {
+    case EQUALS_EXPRESSION:
+        return fst == snd;
+    case NOT_EQUALS_EXPRESSION:
+        return fst != snd;
+    case GREATER_EXPRESSION:
+        return fst > snd;
+    case GREATER_EQUALS_EXPRESSION:
+        return fst >= snd;
+    case LESSER_EXPRESSION:
+        return fst < snd;
+    default:
+        return fst <= snd;
+    }
+}
+
+/* Calls fused by fuse_program, to a function whose arguments are all
+ * evaluated when called: the frame has a fixed size and the callee is not
+ * looked up. Memo keys are made by execute_function_call. */
+#define FIXED_CALL(arity)                                                      \
+    static ExpressionResult fixed_call_##arity(Expression *exp,                \
+                                               Context *cxt) {                 \
+        Function *func = exp->value.call.func;                                 \
+        Expression **args = exp->value.call.args;                              \
+        if (memoizing)                                                         \
+            return execute_function_call(func, args, cxt);                     \
+        if (!--budget_countdown)                                               \
+            check_execution_budget();                                          \
+        check_call_depth();                                                    \
+                                                                               \
+        struct _context variables[arity];                                      \
+        for (size_t i = 0; i < arity; i++) {                                   \
+            variables[i] = (struct _context){                                  \
+                .var_name = func->args[i].name,                                \
+                .var_value = evaluate_expression(args[i], cxt)};               \
+        }                                                                      \
+        Context frame = {.len = arity, .variable = variables};                 \
+        push_shadow_frame(func);                                               \
+        ExpressionResult result =                                              \
+            evaluate_expression(func->expression, &frame);                     \
+        pop_shadow_frame();                                                    \
+        return result;                                                         \
+    }
+
+FIXED_CALL(1)
+FIXED_CALL(2)
+FIXED_CALL(3)
+FIXED_CALL(4)
+#undef FIXED_CALL
+
 ExpressionResult evaluate_expression(Expression *exp, Context *cxt) {
+    if (counting_hits)
+        count_hits(exp, 1);
+
     switch (exp->type) {
     case INTEGER_EXPRESSION:
         return (ExpressionResult){.integer = exp->value.integer};
@@ -120,8 +399,11 @@ ExpressionResult evaluate_expression(Expression *exp, Context *cxt) {
         // check the context
         if (cxt) {
             for (size_t i = 0; i < cxt->len; i++) {
-                if (!strcmp(cxt->variable[i].var_name, exp->value.variable))
-                    return cxt->variable[i].var_value;
+                if (strcmp(cxt->variable[i].var_name, exp->value.variable))
+                    continue;
+                if (cxt->variable[i].thunk)
+                    force_argument(cxt->variable + i);
+                return cxt->variable[i].var_value;
             }
         }
 
@@ -167,13 +449,14 @@ ExpressionResult evaluate_expression(Expression *exp, Context *cxt) {
             .integer = evaluate_expression(exp->value.binary.fst, cxt).integer *
                        evaluate_expression(exp->value.binary.snd, cxt).integer};
     case DIVIDE_EXPRESSION:
-        return (ExpressionResult){
-            .integer = evaluate_expression(exp->value.binary.fst, cxt).integer /
-                       evaluate_expression(exp->value.binary.snd, cxt).integer};
-    case MODULO_EXPRESSION:
-        return (ExpressionResult){
-            .integer = evaluate_expression(exp->value.binary.fst, cxt).integer %
-                       evaluate_expression(exp->value.binary.snd, cxt).integer};
+    case MODULO_EXPRESSION: {
+        int fst = evaluate_expression(exp->value.binary.fst, cxt).integer;
+        int snd = evaluate_expression(exp->value.binary.snd, cxt).integer;
+        check_division(fst, snd);
+        return (ExpressionResult){.integer = exp->type == DIVIDE_EXPRESSION
+                                                 ? fst / snd
+                                                 : fst % snd};
+    }
     case AND_EXPRESSION:
         return (ExpressionResult){
             .boolean =
@@ -221,38 +504,1061 @@ ExpressionResult evaluate_expression(Expression *exp, Context *cxt) {
             return evaluate_expression(exp->value.if_statement.yes, cxt);
         return evaluate_expression(exp->value.if_statement.no, cxt);
     case FUNCTION_CALL_EXPRESSION: {
-        Function *f = ast_table_get(ast, exp->value.function_call.funcname)
-                          .value.func; /* ???: direct dereferening the pointer
-                                          with checking for NULL. Should be safe
-                                          because of the semantic checker */
-        return execute_function_call(f, exp->value.function_call.args, cxt);
+        /* the REPL keeps definitions that did not verify, which verified
+         * ones may call */
+        AST *tree = ast_table_get_ptr(ast, exp->value.function_call.funcname);
+        if ((!tree) || (!tree->semantically_correct))
+            runtime_error(EVALUATION_ERROR, "'%s' function did not verify",
+                          exp->value.function_call.funcname);
+        return execute_function_call(tree->value.func,
+                                     exp->value.function_call.args, cxt);
+    }
+    case ARGUMENT_EXPRESSION: {
+        struct _context *variable = cxt->variable + exp->value.argument.slot;
+        if (variable->thunk)
+            force_argument(variable);
+        return variable->var_value;
     }
+    case ADD_CONSTANT_EXPRESSION:
+        return (ExpressionResult){
+            .integer = evaluate_expression(exp->value.binary.fst, cxt).integer +
+                       exp->value.binary.snd->value.integer};
+    case BRANCH_EXPRESSION:
+        if (compare_with_literal(exp->value.if_statement.condition, cxt))
+            return evaluate_expression(exp->value.if_statement.yes, cxt);
+        return evaluate_expression(exp->value.if_statement.no, cxt);
+    case CALL1_EXPRESSION:
+        return fixed_call_1(exp, cxt);
+    case CALL2_EXPRESSION:
+        return fixed_call_2(exp, cxt);
+    case CALL3_EXPRESSION:
+        return fixed_call_3(exp, cxt);
+    case CALL4_EXPRESSION:
+        return fixed_call_4(exp, cxt);
     default:
     error:
-        fprintf(stderr, "Error Encounter while interpreting");
-        exit(1);
+        runtime_error(EVALUATION_ERROR, "Error Encounter while interpreting");
+    }
+    return (ExpressionResult){0};
+}
+
+/* Parallel Reductions */
+
+/* Shorter reductions are evaluated call by call */
+#define REDUCTION_MIN_ITERATIONS 4096
+/* Iterations a task folds; the tasks are spread over the pool */
+#define REDUCTION_TASK_ITERATIONS 1024
+
+/* A call of a reduction, folded by tasks on every thread, which is why the
+ * thread local state they need is passed along */
+typedef struct {
+    ast_table_t *ast;
+    integer_table_t *globalIntegers;
+    boolean_table_t *globalBooleans;
+    Reduction *reduction;
+    Context *cxt;
+    int64_t first; /* counter of the first call */
+    int64_t step;
+    size_t iterations;
+    ExpressionResult *partials;
+    bool *failed;
+} ParallelReduction;
+
+static inline ExpressionResult reduction_identity(ExpressionType op) {
+    switch (op) {
+    case PLUS_EXPRESSION:
+        return (ExpressionResult){.integer = 0};
+    case MULTIPLY_EXPRESSION:
+        return (ExpressionResult){.integer = 1};
+    case AND_EXPRESSION:
+        return (ExpressionResult){.boolean = true};
+    default:
+        return (ExpressionResult){.boolean = false};
+    }
+}
+
+/* Wraps around like the call by call evaluation does on the targets it runs
+ * on, which keeps + and * associative */
+static inline ExpressionResult combine_reduction(ExpressionType op,
+                                                 ExpressionResult a,
+                                                 ExpressionResult b) {
+    switch (op) {
+    case PLUS_EXPRESSION:
+        return (ExpressionResult){
+            .integer = (int)((unsigned)a.integer + (unsigned)b.integer)};
+    case MULTIPLY_EXPRESSION:
+        return (ExpressionResult){
+            .integer = (int)((unsigned)a.integer * (unsigned)b.integer)};
+    case AND_EXPRESSION:
+        return (ExpressionResult){.boolean = a.boolean && b.boolean};
+    default:
+        return (ExpressionResult){.boolean = a.boolean || b.boolean};
+    }
+}
+
+static void reduce_task(size_t index, void *data) {
+    ParallelReduction *parallel = data;
+    Reduction *reduction = parallel->reduction;
+    ast = parallel->ast;
+    globalIntegers = parallel->globalIntegers;
+    globalBooleans = parallel->globalBooleans;
+
+    struct _context variables[parallel->cxt->len];
+    memcpy(variables, parallel->cxt->variable, sizeof(variables));
+    Context cxt = {.len = parallel->cxt->len, .variable = variables};
+    size_t start = index * REDUCTION_TASK_ITERATIONS;
+    size_t end = start + REDUCTION_TASK_ITERATIONS < parallel->iterations
+                     ? start + REDUCTION_TASK_ITERATIONS
+                     : parallel->iterations;
+
+    jmp_buf handler;
+    jmp_buf *previous_handler = runtime_error_handler;
+    size_t shadow_depth = shadow_stack.depth;
+    if (setjmp(handler)) {
+        runtime_error_handler = previous_handler;
+        shadow_stack.depth = shadow_depth;
+        parallel->failed[index] = true;
+        return;
+    }
+    runtime_error_handler = &handler;
+
+    ExpressionResult partial = reduction_identity(reduction->op);
+    for (size_t i = start; i < end; i++) {
+        variables[reduction->counter].var_value.integer =
+            (int)(parallel->first + (int64_t)i * parallel->step);
+        partial = combine_reduction(
+            reduction->op, partial,
+            evaluate_expression(reduction->operand, &cxt));
+    }
+    runtime_error_handler = previous_handler;
+    parallel->partials[index] = partial;
+}
+
+/* Calls made before the comparison of the counter to limit is true, false
+ * if that never happens before the counter wraps around */
+static bool count_iterations(ExpressionType comparison, int64_t first,
+                             int64_t limit, int64_t step, size_t *iterations) {
+    int64_t count;
+    switch (comparison) {
+    case EQUALS_EXPRESSION:
+        if ((limit - first) % step)
+            return false;
+        count = (limit - first) / step;
+        break;
+    case NOT_EQUALS_EXPRESSION:
+        count = first == limit;
+        break;
+    case LESSER_EXPRESSION:
+        count = first < limit ? 0 : step < 0 ? (first - limit) / -step + 1 : -1;
+        break;
+    case LESSER_EQUALS_EXPRESSION:
+        count = first <= limit ? 0
+                : step < 0     ? (first - limit - step - 1) / -step
+                               : -1;
+        break;
+    case GREATER_EXPRESSION:
+        count = first > limit ? 0 : step > 0 ? (limit - first) / step + 1 : -1;
+        break;
+    default:
+        count = first >= limit ? 0
+                : step > 0     ? (limit - first + step - 1) / step
+                               : -1;
+        break;
+    }
+    int64_t last = first + count * step;
+    *iterations = count;
+    return (count >= 0) && (last >= INT32_MIN) && (last <= INT32_MAX);
+}
+
+/* Evaluates a call of a reduction, with its arguments in cxt, by folding
+ * chunks of its range on every thread. Returns false for it to be
+ * evaluated call by call instead: when it is short, when running on other
+ * threads would escape the budget, profiler or hit counts, or when a chunk
+ * raised an error, which is then raised in the right order. */
+static bool evaluate_reduction(Function *func, Context *cxt,
+                               ExpressionResult *result) {
+    Reduction *reduction = func->reduction;
+    if ((memoizing) || (counting_hits) || (profiling) ||
+        (execution_budget.max_calls) || (execution_budget.max_seconds) ||
+        (execution_budget.max_depth))
+        return false;
+    /* the recursive calls of a reduction evaluated call by call */
+    size_t depth = shadow_stack.depth;
+    if ((depth) && (depth <= SHADOW_STACK_CAPACITY) &&
+        (shadow_stack.frames[depth - 1] == func))
+        return false;
+    for (size_t i = 0; i < cxt->len; i++) {
+        if (cxt->variable[i].thunk)
+            return false;
+    }
+
+    ExpressionResult limit, step;
+    size_t iterations;
+    if ((!guarded_evaluate(reduction->limit, cxt, &limit)) ||
+        (!guarded_evaluate(reduction->step, cxt, &step)) ||
+        (!step.integer) ||
+        (!count_iterations(reduction->comparison,
+                           cxt->variable[reduction->counter].var_value.integer,
+                           limit.integer, step.integer, &iterations)) ||
+        (iterations < REDUCTION_MIN_ITERATIONS))
+        return false;
+
+    size_t tasks = (iterations + REDUCTION_TASK_ITERATIONS - 1) /
+                   REDUCTION_TASK_ITERATIONS;
+    ExpressionResult *partials =
+        tracked_malloc(MEMORY_INTERPRETER, tasks * sizeof(ExpressionResult));
+    bool *failed = tracked_calloc(MEMORY_INTERPRETER, tasks, sizeof(bool));
+    if ((!partials) || (!failed)) {
+        tracked_free(partials);
+        tracked_free(failed);
+        return false;
+    }
+
+    ParallelReduction parallel = {
+        .ast = ast,
+        .globalIntegers = globalIntegers,
+        .globalBooleans = globalBooleans,
+        .reduction = reduction,
+        .cxt = cxt,
+        .first = cxt->variable[reduction->counter].var_value.integer,
+        .step = step.integer,
+        .iterations = iterations,
+        .partials = partials,
+        .failed = failed};
+    parallel_for(tasks, reduce_task, &parallel);
+
+    bool reduced = true;
+    ExpressionResult accumulated =
+        cxt->variable[reduction->accumulator].var_value;
+    for (size_t i = 0; i < tasks; i++) {
+        reduced = reduced && !failed[i];
+        accumulated = combine_reduction(reduction->op, accumulated,
+                                        partials[i]);
+    }
+    tracked_free(partials);
+    tracked_free(failed);
+    if (!reduced)
+        return false;
+
+    /* the base case, in the context of the last call */
+    struct _context variables[cxt->len];
+    memcpy(variables, cxt->variable, sizeof(variables));
+    Context last = {.len = cxt->len, .variable = variables};
+    variables[reduction->accumulator].var_value = accumulated;
+    variables[reduction->counter].var_value.integer =
+        (int)(parallel.first + (int64_t)iterations * parallel.step);
+    push_shadow_frame(func);
+    *result = evaluate_expression(reduction->base, &last);
+    pop_shadow_frame();
+    return true;
+}
+
+/* Evaluates a call whose arguments are in cxt through the memo cache */
+static ExpressionResult execute_memoized(Function *func, Context *cxt) {
+    int args[MEMO_MAX_ARGS];
+    for (size_t i = 0; i < func->arglen; i++) {
+        ExpressionResult value = cxt->variable[i].var_value;
+        args[i] = func->args[i].type == INT ? value.integer : value.boolean;
+    }
+
+    int memoized;
+    if (memo_lookup(func, args, &memoized))
+        return func->return_type == INT
+                   ? (ExpressionResult){.integer = memoized}
+                   : (ExpressionResult){.boolean = memoized != 0};
+
+    size_t calls = calls_made();
+    push_shadow_frame(func);
+    ExpressionResult result = evaluate_expression(func->expression, cxt);
+    pop_shadow_frame();
+    if (calls_made() - calls >= MEMO_MIN_CALLS)
+        memo_store(func, args,
+                   func->return_type == INT ? result.integer : result.boolean);
+    return result;
+}
+
+/* Whether passing arg lazily can save anything: calls and conditions may
+ * be expensive, other operations cost less to evaluate than to delay. A
+ * variable holding a lazy argument stays lazy. */
+static inline bool delays_evaluation(Expression *arg, Context *cxt) {
+    switch (arg->type) {
+    case FUNCTION_CALL_EXPRESSION:
+    case IF_EXPRESSION:
+    case BRANCH_EXPRESSION:
+    case CALL1_EXPRESSION:
+    case CALL2_EXPRESSION:
+    case CALL3_EXPRESSION:
+    case CALL4_EXPRESSION:
+        return true;
+    case ARGUMENT_EXPRESSION:
+        return cxt->variable[arg->value.argument.slot].thunk != NULL;
+    case VARIABLE_EXPRESSION:
+        for (size_t i = 0; (cxt) && (i < cxt->len); i++) {
+            if (!strcmp(cxt->variable[i].var_name, arg->value.variable))
+                return cxt->variable[i].thunk != NULL;
+        }
+        return false;
+    default:
+        return false;
     }
 }
 
 ExpressionResult execute_function_call(Function *func, Expression **args,
                                        Context *cxt) {
-    Context new_context = {.len = func->arglen};
+    if (!--budget_countdown)
+        check_execution_budget();
+    check_call_depth();
 
-    new_context.variable = calloc(func->arglen, sizeof(struct _context));
-    if (!new_context.variable) {
-        fprintf(stderr, "Error Encounter while interpreting (Memory Error)");
-        exit(1);
-    }
+    /* Frames live on the C stack, so unwinding on errors does not leak */
+    struct _context variables[func->arglen];
+    Context new_context = {.len = func->arglen, .variable = variables};
 
     for (size_t i = 0; i < new_context.len; i++) {
-        new_context.variable[i] =
-            (struct _context){.var_name = func->args[i].name,
-                              .var_value = evaluate_expression(args[i], cxt)};
+        /* memo keys need every argument */
+        if ((func->args[i].lazy) && (!memoizing) &&
+            (delays_evaluation(args[i], cxt)))
+            new_context.variable[i] =
+                (struct _context){.var_name = func->args[i].name,
+                                  .thunk = args[i],
+                                  .thunk_context = cxt};
+        else
+            new_context.variable[i] = (struct _context){
+                .var_name = func->args[i].name,
+                .var_value = evaluate_expression(args[i], cxt)};
     }
 
-    ExpressionResult result =
-        evaluate_expression(func->expression, &new_context);
-    free(new_context.variable);
+    ExpressionResult result;
+    if ((func->reduction) && (evaluate_reduction(func, &new_context, &result)))
+        return result;
+    if ((memoizing) && (func->arglen <= MEMO_MAX_ARGS))
+        return execute_memoized(func, &new_context);
 
+    push_shadow_frame(func);
+    result = evaluate_expression(func->expression, &new_context);
+    pop_shadow_frame();
     return result;
 }
+
+/* Lane-parallel evaluation, for running main over many inputs at once.
+ *
+ * Every value is a vector of BATCH_LANES integers, and booleans are masks of
+ * all ones or all zeros, so arithmetic and comparisons are single vector
+ * operations (AVX2 when built with -mavx2). Lanes take both branches of a
+ * condition, a short circuiting operator or a recursive call under a mask
+ * of the lanes still active in it; values computed in masked off lanes are
+ * never used. */
+
+#define BATCH_LANES 16
+
+typedef int32_t Lanes
+    __attribute__((vector_size(BATCH_LANES * sizeof(int32_t))));
+
+struct _lane_context {
+    const char *var_name;
+    Lanes var_value;
+};
+
+typedef struct {
+    size_t len;
+    struct _lane_context *variable;
+} LaneContext;
+
+/* Vectors are passed by pointer, their by value ABI depends on the target */
+
+static inline void broadcast_lanes(int value, Lanes *result) {
+    *result = (Lanes){0} + value;
+}
+
+static inline bool any_lane(const Lanes *mask) {
+    int32_t any = 0;
+    for (size_t i = 0; i < BATCH_LANES; i++) {
+        any |= (*mask)[i];
+    }
+    return any != 0;
+}
+
+static inline size_t active_lanes(const Lanes *mask) {
+    size_t active = 0;
+    for (size_t i = 0; i < BATCH_LANES; i++) {
+        active += (*mask)[i] != 0;
+    }
+    return active;
+}
+
+static void evaluate_lanes(Expression *exp, LaneContext *cxt,
+                           const Lanes *mask, Lanes *result);
+
+static void evaluate_global_lanes(const char *name, Lanes *result) {
+    AST *tree = ast_table_get_ptr(ast, name);
+    errno = 0;
+    if ((!tree) || (tree->type != AST_VARIABLE))
+        runtime_error(EVALUATION_ERROR, "Error Encounter while interpreting");
+
+    Expression variable = {.type = VARIABLE_EXPRESSION,
+                           .value.variable = name};
+    ExpressionResult value = evaluate_expression(&variable, NULL);
+    broadcast_lanes(tree->value.var->type == BOOL ? -value.boolean
+                                                  : value.integer,
+                    result);
+}
+
+/* Runs func on arguments already in variables, whose names it sets */
+static void call_function_lanes(Function *func,
+                                struct _lane_context *variables,
+                                const Lanes *mask, Lanes *result) {
+    if (!--budget_countdown)
+        check_execution_budget();
+    check_call_depth();
+
+    for (size_t i = 0; i < func->arglen; i++) {
+        variables[i].var_name = func->args[i].name;
+    }
+    LaneContext new_context = {.len = func->arglen, .variable = variables};
+    push_shadow_frame(func);
+    evaluate_lanes(func->expression, &new_context, mask, result);
+    pop_shadow_frame();
+}
+
+static inline bool same_function_call(Expression *a, Expression *b) {
+    return (a->type == FUNCTION_CALL_EXPRESSION) &&
+           (b->type == FUNCTION_CALL_EXPRESSION) &&
+           (!strcmp(a->value.function_call.funcname,
+                    b->value.function_call.funcname));
+}
+
+/* Both branches call the same function, like the two recursive cases of a
+ * loop. Each lane's arguments come from its own branch, and all lanes make
+ * one call together; calling from each branch apart would split the lanes
+ * further at every level of the recursion. */
+static void merged_call_lanes(Expression *yes, Expression *no,
+                              LaneContext *cxt, const Lanes *condition,
+                              const Lanes *yes_mask, const Lanes *no_mask,
+                              const Lanes *mask, Lanes *result) {
+    Function *func =
+        ast_table_get(ast, yes->value.function_call.funcname).value.func;
+    struct _lane_context variables[func->arglen];
+    for (size_t i = 0; i < func->arglen; i++) {
+        Lanes yes_arg, no_arg;
+        evaluate_lanes(yes->value.function_call.args[i], cxt, yes_mask,
+                       &yes_arg);
+        evaluate_lanes(no->value.function_call.args[i], cxt, no_mask,
+                       &no_arg);
+        variables[i].var_value =
+            (yes_arg & *condition) | (no_arg & ~*condition);
+    }
+    call_function_lanes(func, variables, mask, result);
+}
+
+static void evaluate_lanes(Expression *exp, LaneContext *cxt,
+                           const Lanes *mask, Lanes *result) {
+    /* once for every input evaluating it */
+    if (counting_hits)
+        count_hits(exp, active_lanes(mask));
+
+    Lanes fst, snd;
+#define OPERANDS                                                               \
+    evaluate_lanes(exp->value.binary.fst, cxt, mask, &fst);                    \
+    evaluate_lanes(exp->value.binary.snd, cxt, mask, &snd)
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+        broadcast_lanes(exp->value.integer, result);
+        return;
+    case BOOLEAN_EXPRESSION:
+        broadcast_lanes(-exp->value.boolean, result);
+        return;
+    case VARIABLE_EXPRESSION:
+        for (size_t i = 0; i < cxt->len; i++) {
+            if (!strcmp(cxt->variable[i].var_name, exp->value.variable)) {
+                *result = cxt->variable[i].var_value;
+                return;
+            }
+        }
+        evaluate_global_lanes(exp->value.variable, result);
+        return;
+    case PLUS_EXPRESSION:
+        OPERANDS;
+        *result = fst + snd;
+        return;
+    case MINUS_EXPRESSION:
+        evaluate_lanes(exp->value.unary.fst, cxt, mask, &fst);
+        *result = -fst;
+        return;
+    case MULTIPLY_EXPRESSION:
+        OPERANDS;
+        *result = fst * snd;
+        return;
+    case DIVIDE_EXPRESSION:
+    case MODULO_EXPRESSION:
+        /* no vector division, and only active lanes may fail */
+        OPERANDS;
+        *result = (Lanes){0};
+        for (size_t i = 0; i < BATCH_LANES; i++) {
+            if (!(*mask)[i])
+                continue;
+            check_division(fst[i], snd[i]);
+            (*result)[i] = exp->type == DIVIDE_EXPRESSION ? fst[i] / snd[i]
+                                                          : fst[i] % snd[i];
+        }
+        return;
+    case AND_EXPRESSION:
+    case OR_EXPRESSION: {
+        /* the second operand only runs in the lanes the first did not
+         * decide */
+        evaluate_lanes(exp->value.binary.fst, cxt, mask, &fst);
+        Lanes rest = *mask & (exp->type == AND_EXPRESSION ? fst : ~fst);
+        *result = fst;
+        if (!any_lane(&rest))
+            return;
+        evaluate_lanes(exp->value.binary.snd, cxt, &rest, &snd);
+        *result = exp->type == AND_EXPRESSION ? fst & snd : fst | snd;
+        return;
+    }
+    case NOT_EXPRESSION:
+        evaluate_lanes(exp->value.unary.fst, cxt, mask, &fst);
+        *result = ~fst;
+        return;
+    case EQUALS_EXPRESSION:
+        OPERANDS;
+        *result = fst == snd;
+        return;
+    case NOT_EQUALS_EXPRESSION:
+        OPERANDS;
+        *result = fst != snd;
+        return;
+    case GREATER_EXPRESSION:
+        OPERANDS;
+        *result = fst > snd;
+        return;
+    case GREATER_EQUALS_EXPRESSION:
+        OPERANDS;
+        *result = fst >= snd;
+        return;
+    case LESSER_EXPRESSION:
+        OPERANDS;
+        *result = fst < snd;
+        return;
+    case LESSER_EQUALS_EXPRESSION:
+        OPERANDS;
+        *result = fst <= snd;
+        return;
+    case IF_EXPRESSION: {
+        Lanes condition;
+        evaluate_lanes(exp->value.if_statement.condition, cxt, mask,
+                       &condition);
+        Lanes yes_mask = *mask & condition;
+        Lanes no_mask = *mask & ~condition;
+        if (any_lane(&yes_mask) && any_lane(&no_mask) &&
+            same_function_call(exp->value.if_statement.yes,
+                               exp->value.if_statement.no)) {
+            merged_call_lanes(exp->value.if_statement.yes,
+                              exp->value.if_statement.no, cxt, &condition,
+                              &yes_mask, &no_mask, mask, result);
+            return;
+        }
+        fst = snd = (Lanes){0};
+        if (any_lane(&yes_mask))
+            evaluate_lanes(exp->value.if_statement.yes, cxt, &yes_mask, &fst);
+        if (any_lane(&no_mask))
+            evaluate_lanes(exp->value.if_statement.no, cxt, &no_mask, &snd);
+        *result = (fst & condition) | (snd & ~condition);
+        return;
+    }
+    case FUNCTION_CALL_EXPRESSION: {
+        Function *f =
+            ast_table_get(ast, exp->value.function_call.funcname).value.func;
+        struct _lane_context variables[f->arglen];
+        for (size_t i = 0; i < f->arglen; i++) {
+            evaluate_lanes(exp->value.function_call.args[i], cxt, mask,
+                           &variables[i].var_value);
+        }
+        call_function_lanes(f, variables, mask, result);
+        return;
+    }
+    default:
+        runtime_error(EVALUATION_ERROR, "Error Encounter while interpreting");
+    }
+#undef OPERANDS
+}
+
+/* Like guarded_evaluate, with one budget for all the lanes */
+static bool guarded_evaluate_lanes(Expression *exp, LaneContext *cxt,
+                                   const Lanes *mask, Lanes *result) {
+    jmp_buf handler;
+    jmp_buf *previous_handler = runtime_error_handler;
+    size_t shadow_depth = shadow_stack.depth;
+
+    if (setjmp(handler)) {
+        runtime_error_handler = previous_handler;
+        shadow_stack.depth = shadow_depth;
+        return false;
+    }
+
+    runtime_error_handler = &handler;
+    if (!previous_handler)
+        start_execution_budget();
+
+    evaluate_lanes(exp, cxt, mask, result);
+    runtime_error_handler = previous_handler;
+    return true;
+}
+
+bool interpret_batch(const int *inputs, size_t count, int *outputs,
+                     bool *failed) {
+    if (!trace_initialize_globals())
+        return false;
+    Function *main_func = find_main_function();
+    if (!main_func)
+        return false;
+    if ((use_closure_engine) && (!compile_closures()))
+        return false;
+
+    double run_start = trace_begin();
+    if ((memoizing) || (use_closure_engine)) {
+        /* calls are looked up, or compiled, one input at a time */
+        for (size_t i = 0; i < count; i++) {
+            failed[i] = !interpret_function("main", inputs + i, 1, outputs + i);
+        }
+        trace_end("phase", "run batch", run_start);
+        return true;
+    }
+
+    for (size_t start = 0; start < count; start += BATCH_LANES) {
+        size_t len = count - start < BATCH_LANES ? count - start : BATCH_LANES;
+        struct _lane_context input = {.var_name = main_func->args[0].name};
+        Lanes mask = {0};
+        for (size_t i = 0; i < len; i++) {
+            input.var_value[i] = inputs[start + i];
+            mask[i] = -1;
+        }
+        LaneContext cxt = {.len = 1, .variable = &input};
+
+        Lanes result;
+        push_shadow_frame(main_func);
+        bool evaluated = guarded_evaluate_lanes(main_func->expression, &cxt,
+                                                &mask, &result);
+        pop_shadow_frame();
+        if (evaluated) {
+            for (size_t i = 0; i < len; i++) {
+                outputs[start + i] = result[i];
+                failed[start + i] = false;
+            }
+            continue;
+        }
+
+        /* One lane failed, the others still get their result */
+        for (size_t i = start; i < start + len; i++) {
+            failed[i] = !interpret_function("main", inputs + i, 1, outputs + i);
+        }
+    }
+    trace_end("phase", "run batch", run_start);
+    return true;
+}
+
+/* Closure Engine
+ *
+ * The verified program compiled once into a tree of closures, each calling
+ * the evaluator specialized for its operation and the shape of its
+ * operands, like adding a constant to an argument. Arguments are resolved
+ * to slots, globals to their values and calls to the compiled callee, so
+ * evaluating does no lookups. Values are ints, booleans being 0 or 1. */
+
+typedef struct _Closure Closure;
+typedef int (*ClosureEvaluator)(const Closure *closure, const int *slots);
+
+typedef struct {
+    Function *func;
+    Closure *body;
+} CompiledFunction;
+
+struct _Closure {
+    ClosureEvaluator evaluate;
+    int value; /* a constant or slot, the first operand of a shape */
+    int other; /* the second operand of a shape */
+    Closure *fst;
+    Closure *snd;
+    Closure *third;
+    CompiledFunction *callee;
+    Closure **args;
+};
+
+static inline void clean_compiled(CompiledFunction *compiled) {}
+
+DS_TABLE_DEC(compiled, CompiledFunction *);
+DS_TABLE_DEF(compiled, CompiledFunction *, clean_compiled);
+
+bool use_closure_engine = false;
+
+/* The program compiled last, owning its closures through closure_arena */
+static _Thread_local ast_table_t *compiled_ast;
+static _Thread_local compiled_table_t *compiled_functions;
+static _Thread_local Arena *closure_arena;
+
+#define EVALUATE(closure, slots) (closure)->evaluate(closure, slots)
+
+static int closure_constant(const Closure *c, const int *slots) {
+    return c->value;
+}
+
+static int closure_slot(const Closure *c, const int *slots) {
+    return slots[c->value];
+}
+
+static int closure_undefined(const Closure *c, const int *slots) {
+    runtime_error(EVALUATION_ERROR, "Error Encounter while interpreting");
+    return 0;
+}
+
+static int closure_negate(const Closure *c, const int *slots) {
+    return -EVALUATE(c->fst, slots);
+}
+
+static int closure_not(const Closure *c, const int *slots) {
+    return !EVALUATE(c->fst, slots);
+}
+
+static int closure_and(const Closure *c, const int *slots) {
+    return EVALUATE(c->fst, slots) && EVALUATE(c->snd, slots);
+}
+
+static int closure_or(const Closure *c, const int *slots) {
+    return EVALUATE(c->fst, slots) || EVALUATE(c->snd, slots);
+}
+
+static int closure_if(const Closure *c, const int *slots) {
+    return EVALUATE(c->fst, slots) ? EVALUATE(c->snd, slots)
+                                   : EVALUATE(c->third, slots);
+}
+
+/* An operator on any operands, on an argument and a constant, and on two
+ * arguments */
+#define CLOSURE_OPERATOR(name, op)                                             \
+    static int closure_##name(const Closure *c, const int *slots) {            \
+        return EVALUATE(c->fst, slots) op EVALUATE(c->snd, slots);             \
+    }                                                                          \
+    static int closure_##name##_slot_constant(const Closure *c,                \
+                                              const int *slots) {              \
+        return slots[c->value] op c->other;                                    \
+    }                                                                          \
+    static int closure_##name##_slot_slot(const Closure *c,                    \
+                                          const int *slots) {                  \
+        return slots[c->value] op slots[c->other];                             \
+    }
+
+CLOSURE_OPERATOR(plus, +)
+CLOSURE_OPERATOR(multiply, *)
+CLOSURE_OPERATOR(equals, ==)
+CLOSURE_OPERATOR(not_equals, !=)
+CLOSURE_OPERATOR(greater, >)
+CLOSURE_OPERATOR(greater_equals, >=)
+CLOSURE_OPERATOR(lesser, <)
+CLOSURE_OPERATOR(lesser_equals, <=)
+#undef CLOSURE_OPERATOR
+
+static inline int divide(ExpressionType type, int fst, int snd) {
+    check_division(fst, snd);
+    return type == DIVIDE_EXPRESSION ? fst / snd : fst % snd;
+}
+
+/* The operation is kept in other */
+static int closure_divide(const Closure *c, const int *slots) {
+    int fst = EVALUATE(c->fst, slots);
+    return divide(c->other, fst, EVALUATE(c->snd, slots));
+}
+
+/* Only compiled for a constant other than 0 and -1, which can not fail */
+static int closure_divide_slot_constant(const Closure *c, const int *slots) {
+    return slots[c->value] / c->other;
+}
+
+static int closure_modulo_slot_constant(const Closure *c, const int *slots) {
+    return slots[c->value] % c->other;
+}
+
+static int closure_call(const Closure *c, const int *slots) {
+    if (!--budget_countdown)
+        check_execution_budget();
+    check_call_depth();
+
+    int args[c->value ? c->value : 1];
+    for (int i = 0; i < c->value; i++) {
+        args[i] = EVALUATE(c->args[i], slots);
+    }
+    push_shadow_frame(c->callee->func);
+    int result = EVALUATE(c->callee->body, args);
+    pop_shadow_frame();
+    return result;
+}
+
+typedef struct {
+    ClosureEvaluator any;
+    ClosureEvaluator slot_constant;
+    ClosureEvaluator slot_slot;
+    bool commutative;
+} OperatorEvaluators;
+
+static const OperatorEvaluators operator_evaluators[] = {
+#define OPERATOR(type, name, commutative)                                      \
+    [type] = {closure_##name, closure_##name##_slot_constant,                  \
+              closure_##name##_slot_slot, commutative}
+    OPERATOR(PLUS_EXPRESSION, plus, true),
+    OPERATOR(MULTIPLY_EXPRESSION, multiply, true),
+    OPERATOR(EQUALS_EXPRESSION, equals, true),
+    OPERATOR(NOT_EQUALS_EXPRESSION, not_equals, true),
+    OPERATOR(GREATER_EXPRESSION, greater, false),
+    OPERATOR(GREATER_EQUALS_EXPRESSION, greater_equals, false),
+    OPERATOR(LESSER_EXPRESSION, lesser, false),
+    OPERATOR(LESSER_EQUALS_EXPRESSION, lesser_equals, false),
+#undef OPERATOR
+};
+
+static Closure *make_closure(ClosureEvaluator evaluate) {
+    Closure *closure = arena_alloc(closure_arena, sizeof(Closure));
+    if (closure)
+        *closure = (Closure){.evaluate = evaluate};
+    return closure;
+}
+
+static inline bool is_slot(const Closure *c) {
+    return c->evaluate == closure_slot;
+}
+
+static inline bool is_constant_closure(const Closure *c) {
+    return c->evaluate == closure_constant;
+}
+
+static Closure *compile_closure(Expression *exp, Function *scope);
+
+/* Picks the evaluator for the shape of the operands of a binary operation */
+static Closure *compile_operator(Expression *exp, Function *scope) {
+    Closure *fst = compile_closure(exp->value.binary.fst, scope);
+    Closure *snd = compile_closure(exp->value.binary.snd, scope);
+    Closure *closure = make_closure(NULL);
+    if ((!fst) || (!snd) || (!closure))
+        return NULL;
+    *closure = (Closure){.fst = fst, .snd = snd};
+
+    ExpressionType type = exp->type;
+    switch (type) {
+    case AND_EXPRESSION:
+        closure->evaluate = closure_and;
+        return closure;
+    case OR_EXPRESSION:
+        closure->evaluate = closure_or;
+        return closure;
+    case DIVIDE_EXPRESSION:
+    case MODULO_EXPRESSION:
+        closure->other = type;
+        closure->evaluate = closure_divide;
+        if ((is_slot(fst)) && (is_constant_closure(snd)) && (snd->value) &&
+            (snd->value != -1)) {
+            closure->value = fst->value;
+            closure->other = snd->value;
+            closure->evaluate = type == DIVIDE_EXPRESSION
+                                    ? closure_divide_slot_constant
+                                    : closure_modulo_slot_constant;
+        }
+        return closure;
+    default:
+        break;
+    }
+
+    if ((is_constant_closure(fst)) && (is_slot(snd))) {
+        Closure *swapped = fst;
+        fst = snd;
+        snd = swapped;
+        type = operator_evaluators[type].commutative
+                   ? type
+                   : swapped_comparison(type);
+    }
+    const OperatorEvaluators *evaluators = operator_evaluators + type;
+    closure->evaluate = evaluators->any;
+    if ((is_slot(fst)) && (is_constant_closure(snd)))
+        closure->evaluate = evaluators->slot_constant;
+    else if ((is_slot(fst)) && (is_slot(snd)))
+        closure->evaluate = evaluators->slot_slot;
+    else
+        return closure;
+    closure->value = fst->value;
+    closure->other = snd->value;
+    return closure;
+}
+
+static Closure *compile_closure(Expression *exp, Function *scope) {
+    Closure *closure;
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        if ((closure = make_closure(closure_constant)))
+            closure->value = exp->type == INTEGER_EXPRESSION
+                                 ? exp->value.integer
+                                 : exp->value.boolean;
+        return closure;
+    case VARIABLE_EXPRESSION: {
+        for (size_t i = 0; (scope) && (i < scope->arglen); i++) {
+            if (strcmp(scope->args[i].name, exp->value.variable))
+                continue;
+            if ((closure = make_closure(closure_slot)))
+                closure->value = i;
+            return closure;
+        }
+        /* globals are evaluated before the program is compiled */
+        int *integer = integer_table_get_ptr(globalIntegers,
+                                             exp->value.variable);
+        errno = 0;
+        bool *boolean = boolean_table_get_ptr(globalBooleans,
+                                              exp->value.variable);
+        errno = 0;
+        if ((!integer) && (!boolean))
+            return make_closure(closure_undefined);
+        if ((closure = make_closure(closure_constant)))
+            closure->value = integer ? *integer : *boolean;
+        return closure;
+    }
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        closure = make_closure(exp->type == MINUS_EXPRESSION ? closure_negate
+                                                             : closure_not);
+        if ((!closure) ||
+            (!(closure->fst = compile_closure(exp->value.unary.fst, scope))))
+            return NULL;
+        return closure;
+    case IF_EXPRESSION:
+        closure = make_closure(closure_if);
+        if ((!closure) ||
+            (!(closure->fst = compile_closure(
+                   exp->value.if_statement.condition, scope))) ||
+            (!(closure->snd =
+                   compile_closure(exp->value.if_statement.yes, scope))) ||
+            (!(closure->third =
+                   compile_closure(exp->value.if_statement.no, scope))))
+            return NULL;
+        return closure;
+    case FUNCTION_CALL_EXPRESSION: {
+        CompiledFunction **callee = compiled_table_get_ptr(
+            compiled_functions, exp->value.function_call.funcname);
+        errno = 0;
+        if (!callee)
+            return make_closure(closure_undefined);
+        size_t arglen = exp->value.function_call.arglen;
+        closure = make_closure(closure_call);
+        if (!closure)
+            return NULL;
+        closure->callee = *callee;
+        closure->value = arglen;
+        closure->args = arena_alloc(closure_arena, sizeof(Closure *) * arglen);
+        if (!closure->args)
+            return NULL;
+        for (size_t i = 0; i < arglen; i++) {
+            closure->args[i] =
+                compile_closure(exp->value.function_call.args[i], scope);
+            if (!closure->args[i])
+                return NULL;
+        }
+        return closure;
+    }
+    case UNDEFINED:
+        return make_closure(closure_undefined);
+    default:
+        return compile_operator(exp, scope);
+    }
+}
+
+/* Compiles every verified function of ast, after its globals are */
+static bool compile_closures() {
+    double start = trace_begin();
+    if (compiled_functions)
+        compiled_table_clear(compiled_functions);
+    arena_release(closure_arena);
+    compiled_ast = NULL;
+    closure_arena = arena_new();
+    compiled_functions = compiled_table_new(ast_table_size(ast) + 1);
+    if ((!closure_arena) || (!compiled_functions))
+        goto error;
+
+    /* every callee has to be there before any body is compiled */
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if ((tree->type != AST_FUNCTION) || (!tree->semantically_correct) ||
+            (!tree->value.func->expression))
+            continue;
+        CompiledFunction *compiled =
+            arena_alloc(closure_arena, sizeof(CompiledFunction));
+        if ((!compiled) ||
+            (!compiled_table_insert(compiled_functions,
+                                    tree->value.func->funcname, compiled)))
+            goto error;
+        *compiled = (CompiledFunction){.func = tree->value.func};
+    }
+
+    CompiledFunction **compiled;
+    compiled_table_iter(compiled_functions);
+    while (NULL !=
+           (compiled = compiled_table_iter_next(compiled_functions, &key))) {
+        (*compiled)->body =
+            compile_closure((*compiled)->func->expression, (*compiled)->func);
+        if (!(*compiled)->body)
+            goto error;
+    }
+
+    compiled_ast = ast;
+    trace_end("phase", "compile closures", start);
+    return true;
+
+error:
+    errno = 0;
+    snprintf(runtime_error_msg, ERROR_MSG_LEN, "Memory Error");
+    trace_end("phase", "compile closures", start);
+    return false;
+}
+
+/* Like guarded_evaluate, for a compiled function */
+static bool guarded_evaluate_closure(CompiledFunction *compiled,
+                                     const int *slots, int *result) {
+    jmp_buf handler;
+    jmp_buf *previous_handler = runtime_error_handler;
+    size_t shadow_depth = shadow_stack.depth;
+
+    if (setjmp(handler)) {
+        runtime_error_handler = previous_handler;
+        shadow_stack.depth = shadow_depth;
+        return false;
+    }
+
+    runtime_error_handler = &handler;
+    if (!previous_handler)
+        start_execution_budget();
+
+    push_shadow_frame(compiled->func);
+    *result = EVALUATE(compiled->body, slots);
+    pop_shadow_frame();
+    runtime_error_handler = previous_handler;
+    return true;
+}
+
+/* interpret_function on the closure engine, for a function of ast */
+static bool interpret_closures(Function *func, const int *inputs,
+                               int *output) {
+    if ((compiled_ast != ast) && (!compile_closures()))
+        return false;
+    CompiledFunction **compiled =
+        compiled_table_get_ptr(compiled_functions, func->funcname);
+    errno = 0;
+    if (!compiled) {
+        snprintf(runtime_error_msg, ERROR_MSG_LEN,
+                 "Could not find '%s' function", func->funcname);
+        return false;
+    }
+
+    /* Arguments are stored in reverse order of their declaration */
+    size_t len = func->arglen;
+    int slots[len ? len : 1];
+    for (size_t i = 0; i < len; i++) {
+        slots[len - 1 - i] =
+            func->args[len - 1 - i].type == INT ? inputs[i] : inputs[i] != 0;
+    }
+    return guarded_evaluate_closure(*compiled, slots, output);
+}
+
+#undef EVALUATE
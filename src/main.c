@@ -2,62 +2,335 @@
 #include <stdio.h>
 #include <string.h>
 
-void *yy_scan_string(const char *);
+#define ERROR_MSG_LEN 500
 
-char *STDOUT_REDIRECT_STRING;
-char *STDERR_REDIRECT_STRING;
+int interactive_interpretation(const char *snapshot_path);
+int file_interpretation(const char *file_name, int input);
+int batch_interpretation(const char *file_name, const char *inputs_name);
+int check_interpretation(const char **files, size_t count);
 
-IMPLEMENT_HASH_FUNCTION;
-DS_TABLE_DEF(ast, AST, clear_ast);
+static bool only_reachable = false;
+static bool optimize = false;
+static bool lazy_arguments = false;
+static bool parallel_reductions = false;
+static bool fuse = false;
+static const char **imports;
+static size_t import_count = 0;
+static const char *module_cache;
 
-ast_table_t *ast;
-const char *filename;
+static void report_memory_stats() { print_memory_stats(stderr); }
 
-bool cli_interpretation_mode = false;
-int interactive_interpretation();
-int file_interpretation(const char *file_name, int input);
+static void write_profile() { stop_profiler(); }
+
+static void write_trace() { finish_trace(); }
+
+static const char *hotspots_path;
+
+static void write_hotspot_listing() {
+    write_hotspots(filename, hotspots_path);
+}
 
 int main(int argc, char *argv[]) {
     STDOUT_REDIRECT_STRING = NULL;
     STDERR_REDIRECT_STRING = NULL;
 
     if (argc == 1) {
-        return interactive_interpretation();
+        return interactive_interpretation(NULL);
+    }
+
+    const char *socket_path = NULL;
+    size_t workers = 4;
+    size_t cache_size = 64;
+    ExecutionBudget budget = {0};
+    const char *batch_inputs = NULL;
+    const char *profile_path = NULL;
+    const char *trace_path = NULL;
+    const char *memo_path = NULL;
+    const char *snapshot_path = NULL;
+    size_t memo_megabytes = 64;
+    unsigned profile_rate = 997;
+    bool check = false;
+    bool watch = false;
+    const char *positional[argc];
+    int positional_count = 0;
+    const char *import_paths[argc];
+    imports = import_paths;
+
+    for (int i = 1; i < argc; i++) {
+        if ((!strcmp(argv[i], "--serve")) && (i + 1 < argc)) {
+            socket_path = argv[++i];
+        } else if ((!strcmp(argv[i], "--workers")) && (i + 1 < argc)) {
+            workers = strtoul(argv[++i], NULL, 10);
+        } else if ((!strcmp(argv[i], "--cache-size")) && (i + 1 < argc)) {
+            cache_size = strtoul(argv[++i], NULL, 10);
+        } else if ((!strcmp(argv[i], "--max-calls")) && (i + 1 < argc)) {
+            budget.max_calls = strtoul(argv[++i], NULL, 10);
+        } else if ((!strcmp(argv[i], "--timeout-ms")) && (i + 1 < argc)) {
+            budget.max_seconds = strtoul(argv[++i], NULL, 10) / 1000.0;
+        } else if ((!strcmp(argv[i], "--max-depth")) && (i + 1 < argc)) {
+            budget.max_depth = strtoul(argv[++i], NULL, 10);
+        } else if ((!strcmp(argv[i], "--threads")) && (i + 1 < argc)) {
+            set_thread_count(strtoul(argv[++i], NULL, 10));
+        } else if ((!strcmp(argv[i], "--batch")) && (i + 1 < argc)) {
+            batch_inputs = argv[++i];
+        } else if ((!strcmp(argv[i], "--hotspots")) && (i + 1 < argc)) {
+            hotspots_path = argv[++i];
+        } else if ((!strcmp(argv[i], "--memo-cache")) && (i + 1 < argc)) {
+            memo_path = argv[++i];
+        } else if ((!strcmp(argv[i], "--memo-cache-mb")) && (i + 1 < argc)) {
+            memo_megabytes = strtoul(argv[++i], NULL, 10);
+        } else if ((!strcmp(argv[i], "--trace")) && (i + 1 < argc)) {
+            trace_path = argv[++i];
+        } else if ((!strcmp(argv[i], "--profile")) && (i + 1 < argc)) {
+            profile_path = argv[++i];
+        } else if ((!strcmp(argv[i], "--profile-rate")) && (i + 1 < argc)) {
+            profile_rate = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--mem-stats")) {
+            /* before anything is allocated */
+            enable_memory_tracking();
+            atexit(report_memory_stats);
+        } else if (!strcmp(argv[i], "--fast-lexer")) {
+            use_fast_lexer = true;
+        } else if (!strcmp(argv[i], "--optimize")) {
+            optimize = true;
+        } else if (!strcmp(argv[i], "--lazy-args")) {
+            lazy_arguments = true;
+        } else if (!strcmp(argv[i], "--parallel-reduce")) {
+            parallel_reductions = true;
+        } else if (!strcmp(argv[i], "--fuse")) {
+            fuse = true;
+        } else if ((!strcmp(argv[i], "--engine")) && (i + 1 < argc)) {
+            const char *engine = argv[++i];
+            if ((strcmp(engine, "tree")) && (strcmp(engine, "closure"))) {
+                fprintf(stderr, "Unknown engine \"%s\"\n", engine);
+                return 1;
+            }
+            use_closure_engine = !strcmp(engine, "closure");
+        } else if ((!strcmp(argv[i], "--import")) && (i + 1 < argc)) {
+            imports[import_count++] = argv[++i];
+        } else if ((!strcmp(argv[i], "--module-cache")) && (i + 1 < argc)) {
+            module_cache = argv[++i];
+        } else if ((!strcmp(argv[i], "--restore")) && (i + 1 < argc)) {
+            snapshot_path = argv[++i];
+        } else if (!strcmp(argv[i], "--check")) {
+            check = true;
+        } else if (!strcmp(argv[i], "--watch")) {
+            watch = true;
+        } else if (!strcmp(argv[i], "--only-reachable")) {
+            only_reachable = true;
+        } else if (!strcmp(argv[i], "--lazy-parse")) {
+            /* bodies are parsed as they are verified, so only the ones
+             * reachable from main are ever parsed */
+            use_fast_lexer = true;
+            defer_function_bodies = true;
+            only_reachable = true;
+        } else if (!strncmp(argv[i], "--", 2)) {
+            fprintf(stderr, "Unknown argument \"%s\"\n", argv[i]);
+            return 1;
+        } else {
+            positional[positional_count++] = argv[i];
+        }
+    }
+    if ((!check) && (positional_count > 2)) {
+        fprintf(stderr, "Unknown argument \"%s\"\n", positional[2]);
+        return 1;
+    }
+
+    set_execution_budget(budget);
+
+    if ((use_closure_engine) && ((hotspots_path) || (memo_path) ||
+                                 (lazy_arguments) || (parallel_reductions))) {
+        /* each of them hooks into the evaluation of the syntax tree */
+        fprintf(stderr, "The closure engine can not be used with --hotspots, "
+                        "--memo-cache, --lazy-args or --parallel-reduce\n");
+        return 1;
+    }
+
+    if ((fuse) && ((use_closure_engine) || (batch_inputs) || (hotspots_path))) {
+        /* the node kinds it writes are only known to evaluate_expression */
+        fprintf(stderr, "Superinstructions are only evaluated by the tree "
+                        "engine, without --batch or --hotspots\n");
+        return 1;
+    }
+
+    if ((import_count) &&
+        ((socket_path) || (check) || (watch) || (!positional_count) ||
+         (hotspots_path) || (defer_function_bodies))) {
+        /* hot spots are listed for the lines of a single file, and what is
+         * imported is found from the bodies of the program */
+        fprintf(stderr, "Modules are only imported by a program file run "
+                        "without --serve, --check, --watch, --hotspots or "
+                        "--lazy-parse\n");
+        return 1;
+    }
+    if ((module_cache) && (!import_count)) {
+        fprintf(stderr, "The module cache is only used with --import\n");
+        return 1;
+    }
+
+    if (socket_path) {
+        if (positional_count) {
+            fprintf(stderr, "Server mode does not take a file or input\n");
+            return 1;
+        }
+        if ((profile_path) || (hotspots_path)) {
+            /* samples and counts come from a single evaluating thread */
+            fprintf(stderr, "Server mode can not be profiled\n");
+            return 1;
+        }
+        if (memo_path) {
+            fprintf(stderr, "Server mode does not use the memo cache\n");
+            return 1;
+        }
+        if (parallel_reductions) {
+            /* requests are spread over the workers already */
+            fprintf(stderr, "Server mode does not use --parallel-reduce\n");
+            return 1;
+        }
+        if (use_closure_engine) {
+            fprintf(stderr, "Server mode uses the tree engine\n");
+            return 1;
+        }
+        return server_interpretation(socket_path, workers ? workers : 1,
+                                     cache_size ? cache_size : 1, optimize,
+                                     lazy_arguments, fuse);
+    }
+
+    if (profile_path) {
+        if (!start_profiler(profile_path, profile_rate))
+            return 1;
+        atexit(write_profile);
+    }
+    if (trace_path) {
+        start_trace(trace_path);
+        atexit(write_trace);
+    }
+
+    if (watch) {
+        if ((check) || (batch_inputs) || (snapshot_path) ||
+            (positional_count != 2)) {
+            fprintf(stderr, "Watch mode takes a file and an input\n");
+            return 1;
+        }
+        if ((hotspots_path) || (optimize) || (lazy_arguments) ||
+            (parallel_reductions) || (fuse) || (only_reachable) ||
+            (use_closure_engine)) {
+            /* what they keep about the whole program would go stale when
+             * only part of it is reloaded */
+            fprintf(stderr,
+                    "Watch mode can not be used with --hotspots, --optimize, "
+                    "--lazy-args, --parallel-reduce, --fuse, --only-reachable, "
+                    "--lazy-parse or the closure engine\n");
+            return 1;
+        }
+        if ((memo_path) && (!open_memo_cache(memo_path, memo_megabytes << 20)))
+            return 1;
+        /* definitions are split, and parsed, with the fast lexer */
+        use_fast_lexer = true;
+        return watch_interpretation(positional[0], atoi(positional[1]));
+    }
+
+    if (check) {
+        if ((batch_inputs) || (!positional_count)) {
+            fprintf(stderr, "Check mode takes one or more files\n");
+            return 1;
+        }
+        /* flex keeps its state in globals, the fast lexer does not */
+        use_fast_lexer = true;
+        return check_interpretation(positional, positional_count);
+    }
+
+    if (positional_count == 0) {
+        if (hotspots_path) {
+            fprintf(stderr, "Hot spots are listed for a program file\n");
+            return 1;
+        }
+        if (memo_path) {
+            /* results are keyed by the source of the program file */
+            fprintf(stderr, "The memo cache needs a program file\n");
+            return 1;
+        }
+        if ((optimize) || (lazy_arguments) || (parallel_reductions) ||
+            (fuse)) {
+            /* what is found about a definition would outlive it */
+            fprintf(stderr, "Optimization needs a program file\n");
+            return 1;
+        }
+        if (use_closure_engine) {
+            /* definitions change between inputs */
+            fprintf(stderr, "The closure engine needs a program file\n");
+            return 1;
+        }
+        return interactive_interpretation(snapshot_path);
+    }
+
+    if (snapshot_path) {
+        fprintf(stderr, "A snapshot is restored into the REPL\n");
+        return 1;
+    }
+
+    if ((memo_path) && (!open_memo_cache(memo_path, memo_megabytes << 20)))
+        return 1;
+
+    if (hotspots_path) {
+        /* filename is set once the program is loaded */
+        counting_hits = true;
+        atexit(write_hotspot_listing);
+    }
+
+    if (batch_inputs) {
+        if (positional_count != 1) {
+            fprintf(stderr, "Batch mode takes a file and no input\n");
+            return 1;
+        }
+        return batch_interpretation(positional[0], batch_inputs);
     }
 
-    if (argc != 3) {
+    if (positional_count != 2) {
         fprintf(stderr, "File and input required to execute the program\n");
         return 1;
     }
 
-    return file_interpretation(argv[1], atoi(argv[2]));
+    return file_interpretation(positional[0], atoi(positional[1]));
 }
 
-int interactive_interpretation() {
+int interactive_interpretation(const char *snapshot_path) {
     cli_interpretation_mode = true;
-    ast = ast_table_new(100);
-    globalBooleans = boolean_table_new(100);
-    globalIntegers = integer_table_new(100);
-    char new_input_prompt[] = ">>> ";
+    if ((snapshot_path) && (!restore_snapshot(snapshot_path)))
+        return 1;
+    static char new_input_prompt[] = ">>> ";
     char continue_input_prompt[] = "     ";
+    start_repl_evaluator(new_input_prompt);
 
     // STDOUT_REDIRECT_STRING = calloc(STDOUT_STRING_LENGTH, 1);
     // STDERR_REDIRECT_STRING = calloc(STDERR_STRING_LENGTH, 1);
 
     static char string[500];
 
-    char *prompt = new_input_prompt;
     int input_length = 0;
 
+    /* later prompts for a new input follow the evaluation of the last one */
+    printf("%s", new_input_prompt);
     while (true) {
-        printf("%s", prompt);
+        fflush(stdout);
         if (!fgets(string + input_length, 500, stdin)) {
+            wait_repl_inputs();
             fprintf(stderr, "Error while getting input\n");
             return 1;
         }
+        /* a CRLF line ending reads like a LF one */
+        size_t length = strlen(string);
+        if ((length >= 2) && (!strcmp(string + length - 2, "\r\n")))
+            strcpy(string + length - 2, "\n");
         if ((!strcmp("exit\n", string)) || (!strcmp("exit;\n", string))) {
+            wait_repl_inputs();
             return 0;
         }
+        if ((!input_length) && (string[0] == ':')) {
+            /* commands take a single line */
+            evaluate_repl_input(string);
+            continue;
+        }
 
         input_length = 0;
         bool get_more_input = false;
@@ -74,15 +347,12 @@ int interactive_interpretation() {
         }
 
         if (get_more_input) {
-            prompt = continue_input_prompt;
+            printf("%s", continue_input_prompt);
             continue;
-        } else {
-            prompt = new_input_prompt;
-            input_length = 0;
         }
+        input_length = 0;
 
-        yy_scan_string(string);
-        yyparse();
+        evaluate_repl_input(string);
 
         // if (STDOUT_REDIRECT_STRING[0]) {
         //     fprintf(stdout, ":: %s", STDOUT_REDIRECT_STRING);
@@ -95,33 +365,79 @@ int interactive_interpretation() {
     }
 }
 
-int file_interpretation(const char *file_name, int input) {
+/* Parses and verifies a program file into ast, printing any error */
+static bool load_program(const char *file_name) {
     filename = file_name;
 
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+    Source source;
+    double start = trace_begin();
+    if (!load_source(filename, &source)) {
         fprintf(stderr, "Could not open file \"%s\"\n", filename);
-        return 0;
+        return false;
     }
+    trace_end("phase", "load", start);
 
     /* Initialization of Variables and Functions Table */
     ast = ast_table_new(100);
+    uint64_t modules_hash = 0;
+    if ((import_count) &&
+        (!import_modules(imports, import_count, module_cache, &modules_hash))) {
+        unload_source(&source);
+        return false;
+    }
+    filename = file_name;
+    if (memoizing)
+        set_memo_program(content_hash(source.data, source.length) ^
+                         modules_hash);
 
-    /* Parsing */
-    yyin = file;
-    if (yyparse()) {
-        fclose(file);
+    /* Parsing, in place on the mapped file. Names are interned while
+     * parsing, and deferred bodies are parsed during semantic analysis, so
+     * the source is not needed afterwards. Lexing happens as the parser
+     * asks for tokens, so its time is part of parsing. */
+    start = trace_begin();
+    int parsed = parse_buffer(source.data, source.length);
+    trace_end("phase", "parse", start);
+    if (parsed) {
+        unload_source(&source);
         fprintf(stderr, "%s\n", syntax_error_msg);
-        return 1;
+        return false;
+    }
+    if (!import_references()) {
+        unload_source(&source);
+        return false;
     }
-
-    fclose(file);
 
     /* Sematic Analysis */
-    if (!verify_semantics()) {
+    start = trace_begin();
+    bool verified = only_reachable ? verify_reachable_semantics("main")
+                                   : verify_semantics();
+    trace_end("phase", "verify", start);
+    unload_source(&source);
+    if ((!verified) && (syntax_error_msg[0])) {
+        /* in a deferred function body */
+        fprintf(stderr, "%s\n", syntax_error_msg);
+        return false;
+    } else if (!verified) {
         fprintf(stderr, "Semantic Error: %s\n", semantic_error_msg);
-        return 1;
+        return false;
     }
+    if (!import_bodies())
+        return false;
+
+    if (optimize)
+        optimize_program();
+    if (lazy_arguments)
+        analyze_strictness();
+    if (parallel_reductions)
+        find_reductions();
+    if (fuse)
+        fuse_program();
+    return true;
+}
+
+int file_interpretation(const char *file_name, int input) {
+    if (!load_program(file_name))
+        return 1;
 
     /* Interpreting */
     int output;
@@ -134,3 +450,140 @@ int file_interpretation(const char *file_name, int input) {
 
     return 0;
 }
+
+/* Runs main over whitespace separated inputs, "-" reading them from stdin,
+ * and prints one output per line */
+int batch_interpretation(const char *file_name, const char *inputs_name) {
+    FILE *in = strcmp(inputs_name, "-") ? fopen(inputs_name, "r") : stdin;
+    if (!in) {
+        fprintf(stderr, "Could not open file \"%s\"\n", inputs_name);
+        return 1;
+    }
+
+    int *inputs = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int input;
+    while (fscanf(in, "%d", &input) == 1) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            inputs = tracked_realloc(MEMORY_INTERPRETER, inputs,
+                                     capacity * sizeof(int));
+            if (!inputs) {
+                fprintf(stderr, "Memory Error\n");
+                return 1;
+            }
+        }
+        inputs[count++] = input;
+    }
+    bool read_all = feof(in);
+    if (in != stdin)
+        fclose(in);
+    if (!read_all) {
+        fprintf(stderr, "Invalid input in \"%s\"\n", inputs_name);
+        tracked_free(inputs);
+        return 1;
+    }
+
+    if (!load_program(file_name)) {
+        tracked_free(inputs);
+        return 1;
+    }
+
+    int *outputs = tracked_malloc(MEMORY_INTERPRETER, count * sizeof(int) + 1);
+    bool *failed = tracked_malloc(MEMORY_INTERPRETER, count + 1);
+    if ((!outputs) || (!failed)) {
+        fprintf(stderr, "Memory Error\n");
+        return 1;
+    }
+    if (!interpret_batch(inputs, count, outputs, failed)) {
+        fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+        return 1;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!failed[i]) {
+            printf("%d\n", outputs[i]);
+            continue;
+        }
+        /* rerun alone for its error message */
+        interpret_function("main", inputs + i, 1, outputs + i);
+        printf("ERROR Runtime Error: %s\n", runtime_error_msg);
+        status = 1;
+    }
+
+    tracked_free(inputs);
+    tracked_free(outputs);
+    tracked_free(failed);
+    return status;
+}
+
+/* Parsing and verification of one file of check mode, on a thread of the
+ * pool; every piece of parser and checker state it touches is thread local */
+typedef struct {
+    const char **files;
+    char **reports;
+} Check;
+
+static void check_file(size_t index, void *data) {
+    Check *check = data;
+    char report[ERROR_MSG_LEN + 32];
+    filename = check->files[index];
+
+    Source source;
+    if (!load_source(filename, &source)) {
+        snprintf(report, sizeof(report), "Could not open file");
+    } else {
+        ast = ast_table_new(100);
+        intern_pool = intern_pool_new();
+        syntax_error_msg[0] = 0;
+        bool parsed = !parse_buffer(source.data, source.length);
+        bool verified = parsed && verify_semantics();
+        /* a syntax error may be in a deferred function body */
+        if ((!parsed) || ((!verified) && (syntax_error_msg[0])))
+            snprintf(report, sizeof(report), "%s", syntax_error_msg);
+        else if (!verified)
+            snprintf(report, sizeof(report), "Semantic Error: %s",
+                     semantic_error_msg);
+        else
+            snprintf(report, sizeof(report), "OK");
+        ast_table_clear(ast);
+        ast = NULL;
+        intern_pool_free(intern_pool);
+        intern_pool = NULL;
+        unload_source(&source);
+    }
+
+    size_t length = strlen(report) + 1;
+    check->reports[index] = tracked_malloc(MEMORY_INTERPRETER, length);
+    if (check->reports[index])
+        memcpy(check->reports[index], report, length);
+}
+
+/* Parses and verifies every file without running it, in parallel, and
+ * prints a line per file in the order they were given */
+int check_interpretation(const char **files, size_t count) {
+    char **reports = tracked_calloc(MEMORY_INTERPRETER, count, sizeof(char *));
+    if (!reports) {
+        fprintf(stderr, "Memory Error\n");
+        return 1;
+    }
+
+    double start = trace_begin();
+    Check check = {.files = files, .reports = reports};
+    parallel_for(count, check_file, &check);
+    trace_end("phase", "check", start);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *report = reports[i] ? reports[i] : "Memory Error";
+        printf("%s: %s\n", files[i], report);
+        failed += strcmp(report, "OK") != 0;
+        tracked_free(reports[i]);
+    }
+    tracked_free(reports);
+
+    fprintf(stderr, "Checked %zu files, %zu with errors\n", count, failed);
+    return failed ? 1 : 0;
+}
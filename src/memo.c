@@ -0,0 +1,249 @@
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+bool memoizing = false;
+
+#ifdef _WIN32
+
+bool open_memo_cache(const char *path, size_t max_bytes) {
+    fprintf(stderr, "The memo cache is not supported on Windows\n");
+    return false;
+}
+
+void set_memo_program(uint64_t program_hash) {}
+
+bool memo_lookup(Function *func, const int *args, int *result) {
+    return false;
+}
+
+void memo_store(Function *func, const int *args, int result) {}
+
+void close_memo_cache() {}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MEMO_MAGIC 0x314f4d454d4b /* "KMEMO1" */
+/* Slots an entry may be placed in, starting from its hash */
+#define MEMO_PROBE 8
+
+/*
+ * File layout: a header, then a fixed number of slots, so the file never
+ * grows past the size it was created with. Entries are written in place,
+ * their checksum last; an entry whose checksum does not match, because a
+ * process died while writing it or two wrote it at once, is taken as an
+ * empty slot. A full probe window overwrites one of its entries.
+ */
+typedef struct {
+    uint64_t magic;
+    uint64_t slot_count;
+    uint64_t reserved[6];
+} MemoHeader;
+
+typedef struct {
+    uint64_t key; /* hash of everything below */
+    uint64_t program;
+    uint64_t function;
+    int32_t args[MEMO_MAX_ARGS];
+    int32_t arglen;
+    int32_t result;
+    uint64_t checksum;
+} MemoEntry;
+
+static MemoHeader *memo_header;
+static MemoEntry *memo_slots;
+static size_t memo_slot_count;
+static size_t memo_mapping_length;
+static uint64_t memo_program;
+
+/* One bit for every key that may be in the file, so that most calls that
+ * were never stored are told apart without touching the mapping */
+static uint8_t *memo_filter;
+static size_t memo_filter_bits;
+
+static inline uint64_t mix_hash(uint64_t hash, uint64_t value) {
+    hash ^= value;
+    hash *= 0x100000001b3;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t entry_key(uint64_t program, uint64_t function,
+                          const int *args, size_t arglen) {
+    uint64_t hash = mix_hash(0xcbf29ce484222325, program);
+    hash = mix_hash(hash, function);
+    for (size_t i = 0; i < arglen; i++) {
+        hash = mix_hash(hash, (uint32_t)args[i]);
+    }
+    /* 0 marks an empty slot */
+    return hash ? hash : 1;
+}
+
+static uint64_t entry_checksum(const MemoEntry *entry) {
+    return content_hash((const char *)entry, offsetof(MemoEntry, checksum));
+}
+
+static inline bool entry_valid(const MemoEntry *entry) {
+    return (entry->key) && (entry_checksum(entry) == entry->checksum);
+}
+
+static inline void mark_filter(uint64_t key) {
+    memo_filter[key % memo_filter_bits / 8] |= 1 << (key % 8);
+}
+
+static inline bool in_filter(uint64_t key) {
+    return memo_filter[key % memo_filter_bits / 8] & (1 << (key % 8));
+}
+
+/* Opens path as the memo cache, creating it, or recreating it when it is
+ * not one, with room for max_bytes of entries */
+bool open_memo_cache(const char *path, size_t max_bytes) {
+    /* a file is only laid out when it is new or empty, so that a path
+     * naming some other file never truncates it */
+    bool existing = true;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0)
+        existing = false;
+    else if (errno == EEXIST)
+        fd = open(path, O_RDWR);
+    struct stat info;
+    if ((fd < 0) || (fstat(fd, &info))) {
+        fprintf(stderr, "Could not open memo cache \"%s\"\n", path);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    MemoHeader header = {0};
+    if ((existing) && (info.st_size == 0)) {
+        existing = false;
+    } else if ((existing) &&
+               (((size_t)info.st_size < sizeof(MemoHeader)) ||
+                (pread(fd, &header, sizeof(header), 0) != sizeof(header)) ||
+                (header.magic != MEMO_MAGIC) ||
+                ((size_t)info.st_size !=
+                 sizeof(MemoHeader) + header.slot_count * sizeof(MemoEntry)))) {
+        fprintf(stderr, "\"%s\" is not a memo cache\n", path);
+        close(fd);
+        return false;
+    }
+
+    size_t slot_count = existing ? header.slot_count
+                                 : max_bytes / sizeof(MemoEntry);
+    if (slot_count < MEMO_PROBE)
+        slot_count = MEMO_PROBE;
+    size_t length = sizeof(MemoHeader) + slot_count * sizeof(MemoEntry);
+    if ((!existing) && (ftruncate(fd, length))) {
+        fprintf(stderr, "Could not create memo cache \"%s\"\n", path);
+        close(fd);
+        return false;
+    }
+
+    void *mapping =
+        mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Could not map memo cache \"%s\"\n", path);
+        return false;
+    }
+
+    memo_filter_bits = slot_count * 8;
+    memo_filter = tracked_calloc(MEMORY_INTERPRETER, slot_count, 1);
+    if (!memo_filter) {
+        munmap(mapping, length);
+        fprintf(stderr, "Memory Error\n");
+        return false;
+    }
+
+    memo_header = mapping;
+    memo_slots = (MemoEntry *)(memo_header + 1);
+    memo_slot_count = slot_count;
+    memo_mapping_length = length;
+    if (!existing) {
+        memo_header->slot_count = slot_count;
+        atomic_thread_fence(memory_order_release);
+        memo_header->magic = MEMO_MAGIC;
+    }
+
+    for (size_t i = 0; i < slot_count; i++) {
+        if (entry_valid(memo_slots + i))
+            mark_filter(memo_slots[i].key);
+    }
+    memoizing = true;
+    return true;
+}
+
+/* Entries are only found again by the same program source */
+void set_memo_program(uint64_t program_hash) { memo_program = program_hash; }
+
+static uint64_t function_hash(Function *func) {
+    return content_hash(func->funcname, strlen(func->funcname));
+}
+
+bool memo_lookup(Function *func, const int *args, int *result) {
+    uint64_t function = function_hash(func);
+    uint64_t key = entry_key(memo_program, function, args, func->arglen);
+    if (!in_filter(key))
+        return false;
+
+    for (size_t i = 0; i < MEMO_PROBE; i++) {
+        MemoEntry *entry = memo_slots + (key + i) % memo_slot_count;
+        if ((entry->key != key) || (!entry_valid(entry)))
+            continue;
+        if ((entry->program != memo_program) ||
+            (entry->function != function) ||
+            (entry->arglen != (int32_t)func->arglen) ||
+            (memcmp(entry->args, args, func->arglen * sizeof(int))))
+            continue;
+        *result = entry->result;
+        return true;
+    }
+    return false;
+}
+
+void memo_store(Function *func, const int *args, int result) {
+    MemoEntry entry = {.program = memo_program,
+                       .function = function_hash(func),
+                       .arglen = func->arglen,
+                       .result = result};
+    memcpy(entry.args, args, func->arglen * sizeof(int));
+    entry.key = entry_key(memo_program, entry.function, args, func->arglen);
+    entry.checksum = entry_checksum(&entry);
+
+    /* an empty or broken slot, or else one picked by the key */
+    size_t start = entry.key % memo_slot_count;
+    size_t slot = (start + (entry.key >> 32) % MEMO_PROBE) % memo_slot_count;
+    for (size_t i = 0; i < MEMO_PROBE; i++) {
+        MemoEntry *candidate = memo_slots + (start + i) % memo_slot_count;
+        if (!entry_valid(candidate)) {
+            slot = (start + i) % memo_slot_count;
+            break;
+        }
+    }
+
+    /* the checksum goes last, so a partial entry never looks valid */
+    MemoEntry *target = memo_slots + slot;
+    target->checksum = 0;
+    atomic_thread_fence(memory_order_release);
+    memcpy(target, &entry, offsetof(MemoEntry, checksum));
+    atomic_thread_fence(memory_order_release);
+    target->checksum = entry.checksum;
+    mark_filter(entry.key);
+}
+
+void close_memo_cache() {
+    if (!memoizing)
+        return;
+    memoizing = false;
+    munmap(memo_header, memo_mapping_length);
+    tracked_free(memo_filter);
+    memo_filter = NULL;
+}
+
+#endif
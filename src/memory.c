@@ -0,0 +1,282 @@
+#include "common.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* Put before every block while tracking, so that free knows its size */
+typedef union {
+    struct {
+        size_t size;
+        MemoryTag tag;
+    } block;
+    max_align_t align;
+} BlockHeader;
+
+typedef struct {
+    atomic_size_t live;
+    atomic_size_t peak;
+    atomic_size_t allocations;
+} MemoryCounters;
+
+static const char *memory_tag_names[MEMORY_TAG_COUNT] = {
+    [MEMORY_LEXER] = "lexer",
+    [MEMORY_AST] = "ast",
+    [MEMORY_TABLES] = "tables",
+    [MEMORY_INTERPRETER] = "interpreter",
+};
+
+static MemoryCounters counters[MEMORY_TAG_COUNT];
+static MemoryCounters total_counters;
+static bool tracking = false;
+
+/* Blocks allocated before this would be freed with the wrong layout, so it
+ * has to be called before anything is allocated */
+void enable_memory_tracking() { tracking = true; }
+
+static void add_bytes(MemoryCounters *counter, size_t bytes) {
+    size_t live = atomic_fetch_add_explicit(&counter->live, bytes,
+                                            memory_order_relaxed) +
+                  bytes;
+    size_t peak = atomic_load_explicit(&counter->peak, memory_order_relaxed);
+    while ((live > peak) &&
+           (!atomic_compare_exchange_weak_explicit(&counter->peak, &peak, live,
+                                                   memory_order_relaxed,
+                                                   memory_order_relaxed)))
+        ;
+}
+
+static void remove_bytes(MemoryCounters *counter, size_t bytes) {
+    atomic_fetch_sub_explicit(&counter->live, bytes, memory_order_relaxed);
+}
+
+static void count_allocation(MemoryTag tag, size_t bytes) {
+    add_bytes(counters + tag, bytes);
+    add_bytes(&total_counters, bytes);
+    atomic_fetch_add_explicit(&counters[tag].allocations, 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&total_counters.allocations, 1,
+                              memory_order_relaxed);
+}
+
+static void count_release(MemoryTag tag, size_t bytes) {
+    remove_bytes(counters + tag, bytes);
+    remove_bytes(&total_counters, bytes);
+}
+
+/* For memory that does not come from malloc, like mapped sources */
+void account_memory(MemoryTag tag, ptrdiff_t bytes) {
+    if (!tracking)
+        return;
+    if (bytes >= 0)
+        count_allocation(tag, bytes);
+    else
+        count_release(tag, -bytes);
+}
+
+void *tracked_malloc(MemoryTag tag, size_t size) {
+    if (!tracking)
+        return malloc(size);
+
+    BlockHeader *header = malloc(sizeof(BlockHeader) + size);
+    if (!header)
+        return NULL;
+    header->block.size = size;
+    header->block.tag = tag;
+    count_allocation(tag, size);
+    return header + 1;
+}
+
+void *tracked_calloc(MemoryTag tag, size_t count, size_t size) {
+    if (!tracking)
+        return calloc(count, size);
+
+    if ((size) && (count > (SIZE_MAX - sizeof(BlockHeader)) / size))
+        return NULL;
+    BlockHeader *header = calloc(1, sizeof(BlockHeader) + count * size);
+    if (!header)
+        return NULL;
+    header->block.size = count * size;
+    header->block.tag = tag;
+    count_allocation(tag, count * size);
+    return header + 1;
+}
+
+void *tracked_realloc(MemoryTag tag, void *ptr, size_t size) {
+    if (!tracking)
+        return realloc(ptr, size);
+    if (!ptr)
+        return tracked_malloc(tag, size);
+
+    BlockHeader *header = (BlockHeader *)ptr - 1;
+    size_t old_size = header->block.size;
+    MemoryTag old_tag = header->block.tag;
+    header = realloc(header, sizeof(BlockHeader) + size);
+    if (!header)
+        return NULL;
+
+    count_release(old_tag, old_size);
+    add_bytes(counters + tag, size);
+    add_bytes(&total_counters, size);
+    header->block.size = size;
+    header->block.tag = tag;
+    return header + 1;
+}
+
+void tracked_free(void *ptr) {
+    if ((!tracking) || (!ptr)) {
+        free(ptr);
+        return;
+    }
+
+    BlockHeader *header = (BlockHeader *)ptr - 1;
+    count_release(header->block.tag, header->block.size);
+    free(header);
+}
+
+static void print_memory_counters(FILE *out, const char *name,
+                                  MemoryCounters *counter) {
+    fprintf(out, "%-12s %14zu %14zu %12zu\n", name,
+            atomic_load(&counter->live), atomic_load(&counter->peak),
+            atomic_load(&counter->allocations));
+}
+
+void print_memory_stats(FILE *out) {
+    fprintf(out, "%-12s %14s %14s %12s\n", "memory", "live bytes",
+            "peak bytes", "allocations");
+    for (MemoryTag tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+        print_memory_counters(out, memory_tag_names[tag], counters + tag);
+    }
+    print_memory_counters(out, "total", &total_counters);
+}
+
+/* Arenas */
+
+#define ARENA_MIN_CHUNK 128
+#define ARENA_MAX_CHUNK 65536
+/* Nodes hold nothing wider than pointers */
+#define ARENA_ALIGNMENT sizeof(void *)
+
+typedef struct _ArenaChunk ArenaChunk;
+
+struct _ArenaChunk {
+    ArenaChunk *previous;
+    size_t size;
+    size_t used;
+    void *data[];
+};
+
+struct _Arena {
+    ArenaChunk *chunk;
+    void *last; /* the last allocation, which can grow in place */
+    size_t used;
+    size_t first_chunk;
+    atomic_size_t references;
+};
+
+_Thread_local Arena *node_arena;
+
+/* Consecutive definitions tend to have similar sizes, so a new node arena
+ * starts with a chunk as large as the previous definition needed */
+static _Thread_local size_t node_arena_chunk = ARENA_MIN_CHUNK;
+
+static inline size_t align_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static Arena *arena_with_chunk(size_t first_chunk) {
+    Arena *arena = tracked_calloc(MEMORY_AST, 1, sizeof(Arena));
+    if (!arena)
+        return NULL;
+    arena->first_chunk = first_chunk;
+    atomic_init(&arena->references, 1);
+    return arena;
+}
+
+Arena *arena_new() { return arena_with_chunk(ARENA_MIN_CHUNK); }
+
+void arena_retain(Arena *arena) {
+    atomic_fetch_add_explicit(&arena->references, 1, memory_order_relaxed);
+}
+
+void arena_release(Arena *arena) {
+    if ((!arena) || (atomic_fetch_sub_explicit(&arena->references, 1,
+                                               memory_order_acq_rel) != 1))
+        return;
+
+    ArenaChunk *chunk = arena->chunk;
+    while (chunk) {
+        ArenaChunk *previous = chunk->previous;
+        tracked_free(chunk);
+        chunk = previous;
+    }
+    tracked_free(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_size(size);
+    ArenaChunk *chunk = arena->chunk;
+    if ((!chunk) || (chunk->size - chunk->used < size)) {
+        size_t chunk_size = chunk ? chunk->size * 2 : arena->first_chunk;
+        if (chunk_size > ARENA_MAX_CHUNK)
+            chunk_size = ARENA_MAX_CHUNK;
+        if (chunk_size < size)
+            chunk_size = size;
+
+        ArenaChunk *next =
+            tracked_malloc(MEMORY_AST, sizeof(ArenaChunk) + chunk_size);
+        if (!next)
+            return NULL;
+        *next = (ArenaChunk){.previous = chunk, .size = chunk_size};
+        arena->chunk = chunk = next;
+    }
+
+    arena->last = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+    arena->used += size;
+    return arena->last;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t size) {
+    ArenaChunk *chunk = arena->chunk;
+    if ((ptr) && (ptr == arena->last)) {
+        size_t offset = (char *)ptr - (char *)chunk->data;
+        if (offset + align_size(size) <= chunk->size) {
+            arena->used += offset + align_size(size) - chunk->used;
+            chunk->used = offset + align_size(size);
+            return ptr;
+        }
+    }
+
+    void *moved = arena_alloc(arena, size);
+    if ((moved) && (ptr))
+        memcpy(moved, ptr, old_size < size ? old_size : size);
+    return moved;
+}
+
+/* Nodes go to node_arena, which is created on first use */
+void *node_alloc(size_t size) {
+    if ((!node_arena) && (!(node_arena = arena_with_chunk(node_arena_chunk))))
+        return NULL;
+    return arena_alloc(node_arena, size);
+}
+
+void *node_realloc(void *ptr, size_t old_size, size_t size) {
+    if ((!node_arena) && (!(node_arena = arena_with_chunk(node_arena_chunk))))
+        return NULL;
+    return arena_realloc(node_arena, ptr, old_size, size);
+}
+
+/* Hands the nodes parsed so far over to the definition they belong to */
+Arena *take_node_arena() {
+    Arena *arena = node_arena;
+    node_arena = NULL;
+    if (arena) {
+        size_t used = align_size(arena->used);
+        node_arena_chunk = used < ARENA_MIN_CHUNK   ? ARENA_MIN_CHUNK
+                           : used > ARENA_MAX_CHUNK ? ARENA_MAX_CHUNK
+                                                    : used;
+    }
+    return arena;
+}
+
+/* Frees nodes that no definition took, like those of REPL expressions */
+void discard_node_arena() { arena_release(take_node_arena()); }
@@ -0,0 +1,646 @@
+#include "common.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#define make_directory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_directory(path) mkdir(path, 0777)
+#endif
+
+#define MODULE_MAGIC 0x33444f4d4b /* "KMOD3" */
+#define PATH_LEN 4096
+/* Of a signature, before its declaration: its length and checksum, then the
+ * offset, length and checksum of its body */
+#define SIGNATURE_HEADER (5 * sizeof(uint64_t))
+
+/*
+ * Artifact layout: a header, a hash table of the names of the module, a
+ * signature for every definition, then their bodies. A slot of the table
+ * holds the offset of a signature plus one, or 0 when it is empty, and is
+ * found by linear probing from the word_hash of the name. A signature is
+ * the name and types of a definition, with where its body is; a body is the
+ * names of the arguments and the expression. Nothing is read from an
+ * artifact but its header until the program refers to one of its
+ * definitions, and then only its signature until the program is verified,
+ * so importing a module costs what the program uses of it.
+ *
+ * An artifact is named after the source of its module and the signatures
+ * of the modules imported before it, which is all its verification depended
+ * on, so editing only the bodies of a module does not recompile the ones
+ * importing it.
+ */
+typedef struct {
+    uint64_t magic;
+    uint64_t key;
+    uint64_t signature_hash; /* of the names and types of the definitions */
+    uint64_t definition_count;
+    uint64_t slot_count; /* a power of two */
+    uint64_t signatures_length;
+    uint64_t bodies_length;
+} ModuleHeader;
+
+/* An imported module, whose artifact stays loaded until exit */
+typedef struct {
+    const char *path;
+    char artifact_path[PATH_LEN]; /* empty without a module cache */
+    const char *slots;
+    uint64_t slot_count;
+    const char *signatures;
+    uint64_t signatures_length;
+    const char *bodies;
+    uint64_t bodies_length;
+} Module;
+
+static _Thread_local Module *modules;
+static _Thread_local size_t module_count;
+
+/* Names referred to, to be imported unless they are defined already */
+typedef struct {
+    const char **names;
+    size_t len;
+    size_t capacity;
+} Names;
+
+static inline uint64_t combine_hash(uint64_t hash, uint64_t value) {
+    hash = (hash ^ value) * 0x9e3779b97f4a7c15;
+    return hash ^ (hash >> 32);
+}
+
+static inline const char *tree_name(AST *tree) {
+    return tree->type == AST_FUNCTION ? tree->value.func->funcname
+                                      : tree->value.var->name;
+}
+
+static inline Expression *tree_body(AST *tree) {
+    return tree->type == AST_FUNCTION ? tree->value.func->expression
+                                      : tree->value.var->expression;
+}
+
+static int compare_definition_index(const void *a, const void *b) {
+    size_t x = (*(AST **)a)->definition_index;
+    size_t y = (*(AST **)b)->definition_index;
+    return (x > y) - (x < y);
+}
+
+static void put_declaration(Writer *writer, AST *tree) {
+    put_byte(writer, tree->type);
+    put_string(writer, tree_name(tree));
+    if (tree->type == AST_FUNCTION) {
+        Function *func = tree->value.func;
+        put_byte(writer, func->return_type);
+        put_size(writer, func->arglen);
+        for (size_t i = 0; i < func->arglen; i++) {
+            put_byte(writer, func->args[i].type);
+        }
+    } else {
+        put_byte(writer, tree->value.var->type);
+    }
+}
+
+static void put_body(Writer *writer, AST *tree) {
+    if (tree->type == AST_FUNCTION) {
+        Function *func = tree->value.func;
+        for (size_t i = 0; i < func->arglen; i++) {
+            put_string(writer, func->args[i].name);
+        }
+    }
+    put_expression(writer, tree_body(tree));
+}
+
+/* Writes the artifact of the verified trees of a module to writer */
+static void put_artifact(Writer *writer, uint64_t key, AST **trees,
+                         size_t count) {
+    ModuleHeader header = {
+        .magic = MODULE_MAGIC, .key = key, .definition_count = count};
+    header.slot_count = 2;
+    while (header.slot_count < 2 * count)
+        header.slot_count *= 2;
+    uint64_t mask = header.slot_count - 1;
+    uint64_t *slots =
+        tracked_calloc(MEMORY_INTERPRETER, header.slot_count, sizeof(uint64_t));
+    writer->failed = !slots;
+    /* the slots are filled in once every signature is written */
+    put_bytes(writer, &header, sizeof(header));
+    for (uint64_t i = 0; i < header.slot_count; i++) {
+        put_size(writer, 0);
+    }
+
+    /* appended to the signatures once they are all written */
+    Writer bodies = {0};
+    size_t signatures = writer->length;
+    for (size_t i = 0; (!writer->failed) && (i < count); i++) {
+        size_t body = bodies.length;
+        put_body(&bodies, trees[i]);
+        if (bodies.failed) {
+            writer->failed = true;
+            break;
+        }
+
+        size_t offset = writer->length;
+        put_size(writer, 0);
+        put_size(writer, 0);
+        put_size(writer, body);
+        put_size(writer, bodies.length - body);
+        put_size(writer, word_hash(bodies.data + body, bodies.length - body));
+        size_t declaration = writer->length;
+        put_declaration(writer, trees[i]);
+        if (writer->failed)
+            break;
+        header.signature_hash = combine_hash(
+            header.signature_hash, word_hash(writer->data + declaration,
+                                             writer->length - declaration));
+
+        /* the checksum covers where the body is too */
+        const char *checked = writer->data + offset + 2 * sizeof(uint64_t);
+        uint64_t signature[2] = {writer->data + writer->length - checked};
+        signature[1] = word_hash(checked, signature[0]);
+        memcpy(writer->data + offset, signature, sizeof(signature));
+
+        const char *name = tree_name(trees[i]);
+        uint64_t slot = word_hash(name, strlen(name)) & mask;
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = offset - signatures + 1;
+    }
+
+    header.signatures_length = writer->length - signatures;
+    header.bodies_length = bodies.length;
+    if (!writer->failed)
+        put_bytes(writer, bodies.data, bodies.length);
+    if (!writer->failed) {
+        memcpy(writer->data, &header, sizeof(header));
+        memcpy(writer->data + sizeof(header), slots,
+               header.slot_count * sizeof(uint64_t));
+    }
+    tracked_free(bodies.data);
+    tracked_free(slots);
+}
+
+static void save_artifact(const char *artifact_path, Writer *writer) {
+    /* written aside and renamed, so that runs importing the module at the
+     * same time never read half an artifact */
+    char temporary_path[PATH_LEN + 32];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp",
+             artifact_path, (int)getpid());
+    FILE *file = fopen(temporary_path, "wb");
+    bool written = (file) && (fwrite(writer->data, 1, writer->length, file) ==
+                              writer->length);
+    if ((file) && (fclose(file)))
+        written = false;
+    if ((written) && (rename(temporary_path, artifact_path))) {
+        remove(temporary_path);
+        written = false;
+    }
+    if (!written)
+        fprintf(stderr, "Could not write module artifact \"%s\"\n",
+                artifact_path);
+}
+
+/* Adds the artifact in data to the imported modules when it is the one of
+ * key, setting signature_hash */
+static bool add_module(const char *data, size_t length, uint64_t key,
+                       const char *path, const char *artifact_path,
+                       uint64_t *signature_hash) {
+    ModuleHeader header;
+    Reader reader = {.cursor = data, .end = data + length};
+    take_bytes(&reader, &header, sizeof(header));
+    uint64_t available = reader.end - reader.cursor;
+    if ((reader.failed) || (header.magic != MODULE_MAGIC) ||
+        (header.key != key) || (header.slot_count < 2) ||
+        (header.slot_count & (header.slot_count - 1)) ||
+        (header.slot_count > available / sizeof(uint64_t)))
+        return false;
+    available -= header.slot_count * sizeof(uint64_t);
+    if ((header.signatures_length > available) ||
+        (header.bodies_length != available - header.signatures_length))
+        return false;
+
+    Module *grown = tracked_realloc(MEMORY_INTERPRETER, modules,
+                                    (module_count + 1) * sizeof(Module));
+    if (!grown)
+        return false;
+    modules = grown;
+    Module *module = modules + module_count++;
+    const char *signatures =
+        reader.cursor + header.slot_count * sizeof(uint64_t);
+    *module = (Module){.path = path,
+                       .slots = reader.cursor,
+                       .slot_count = header.slot_count,
+                       .signatures = signatures,
+                       .signatures_length = header.signatures_length,
+                       .bodies = signatures + header.signatures_length,
+                       .bodies_length = header.bodies_length};
+    snprintf(module->artifact_path, PATH_LEN, "%s",
+             artifact_path ? artifact_path : "");
+    *signature_hash = header.signature_hash;
+    return true;
+}
+
+/* The signature of the definition of name in module, or NULL */
+static const char *find_signature(Module *module, const char *name) {
+    size_t length = strlen(name);
+    uint64_t mask = module->slot_count - 1;
+    uint64_t slot = word_hash(name, length) & mask;
+    for (uint64_t i = 0; i < module->slot_count; i++) {
+        uint64_t offset;
+        memcpy(&offset, module->slots + slot * sizeof(uint64_t),
+               sizeof(offset));
+        if (!offset--)
+            return NULL;
+
+        /* the name follows the signature header and the definition type */
+        const char *start = module->signatures + offset + SIGNATURE_HEADER + 1;
+        uint64_t name_length;
+        if ((offset > module->signatures_length) ||
+            (module->signatures_length - offset <
+             SIGNATURE_HEADER + 1 + sizeof(name_length) + length))
+            return NULL;
+        memcpy(&name_length, start, sizeof(name_length));
+        if ((name_length == length) &&
+            (!memcmp(start + sizeof(name_length), name, length)))
+            return module->signatures + offset;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+static bool push_name(Names *names, const char *name) {
+    if (names->len == names->capacity) {
+        size_t capacity = names->capacity ? names->capacity * 2 : 64;
+        const char **grown = tracked_realloc(
+            MEMORY_INTERPRETER, names->names, capacity * sizeof(const char *));
+        if (!grown)
+            return false;
+        names->names = grown;
+        names->capacity = capacity;
+    }
+    names->names[names->len++] = name;
+    return true;
+}
+
+/* Pushes the globals exp refers to, the arguments of scope aside */
+static bool push_references(Expression *exp, Function *scope, Names *names) {
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return true;
+    case VARIABLE_EXPRESSION:
+        for (size_t i = 0; (scope) && (i < scope->arglen); i++) {
+            if (!strcmp(scope->args[i].name, exp->value.variable))
+                return true;
+        }
+        return push_name(names, exp->value.variable);
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        return push_references(exp->value.unary.fst, scope, names);
+    case IF_EXPRESSION:
+        return push_references(exp->value.if_statement.condition, scope,
+                               names) &&
+               push_references(exp->value.if_statement.yes, scope, names) &&
+               push_references(exp->value.if_statement.no, scope, names);
+    case FUNCTION_CALL_EXPRESSION:
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            if (!push_references(exp->value.function_call.args[i], scope,
+                                 names))
+                return false;
+        }
+        return push_name(names, exp->value.function_call.funcname);
+    default:
+        return push_references(exp->value.binary.fst, scope, names) &&
+               push_references(exp->value.binary.snd, scope, names);
+    }
+}
+
+static inline bool push_tree_references(AST *tree, Names *names) {
+    return push_references(tree_body(tree),
+                           tree->type == AST_FUNCTION ? tree->value.func
+                                                      : NULL,
+                           names);
+}
+
+/* Reads a declaration into a verified tree without a body, as it was when
+ * its module was compiled */
+static bool take_declaration(Reader *reader, AST *tree) {
+    tree->type = take_byte(reader);
+    if ((tree->type != AST_FUNCTION) && (tree->type != AST_VARIABLE))
+        reader->failed = true;
+    const char *name = take_string(reader);
+
+    if ((!reader->failed) && (tree->type == AST_FUNCTION)) {
+        Type return_type = take_type(reader);
+        uint64_t arglen = take_size(reader);
+        if ((uint64_t)(reader->end - reader->cursor) < arglen)
+            reader->failed = true;
+        Function *func =
+            take_node(reader, sizeof(Function) + sizeof(Argument) * arglen);
+        if (!func)
+            return false;
+        *func = (Function){
+            .funcname = name, .return_type = return_type, .arglen = arglen};
+        for (size_t i = 0; i < arglen; i++) {
+            func->args[i] = (Argument){.type = take_type(reader)};
+        }
+        tree->value.func = func;
+        return !reader->failed;
+    } else if (!reader->failed) {
+        Variable *var = take_node(reader, sizeof(Variable));
+        if (!var)
+            return false;
+        *var = (Variable){.name = name, .type = take_type(reader)};
+        tree->value.var = var;
+        return !reader->failed;
+    }
+    return false;
+}
+
+/* Reads the body of tree, that take_declaration read */
+static bool take_body(Reader *reader, AST *tree) {
+    Expression *exp;
+    if (tree->type == AST_FUNCTION) {
+        Function *func = tree->value.func;
+        for (size_t i = 0; i < func->arglen; i++) {
+            func->args[i].name = take_string(reader);
+        }
+        exp = func->expression = take_expression(reader);
+    } else {
+        exp = tree->value.var->expression = take_expression(reader);
+    }
+    return (!reader->failed) && (exp);
+}
+
+static bool damaged(Module *module) {
+    /* so that the next run compiles the module again */
+    if (module->artifact_path[0])
+        remove(module->artifact_path);
+    fprintf(stderr, "The artifact of \"%s\" is damaged\n", module->path);
+    return false;
+}
+
+static const char *find_import(const char *name, Module **module) {
+    for (size_t i = 0; i < module_count; i++) {
+        const char *signature = find_signature(modules + i, name);
+        if (signature) {
+            *module = modules + i;
+            return signature;
+        }
+    }
+    return NULL;
+}
+
+/* Loads the body of tree, whose signature is the one given, and pushes the
+ * names it refers to */
+static bool import_body(Module *module, const char *signature, AST *tree,
+                        Names *names) {
+    uint64_t header[5];
+    memcpy(header, signature, sizeof(header));
+    uint64_t offset = header[2], length = header[3];
+    Reader reader = {.cursor = module->bodies + offset,
+                     .end = module->bodies + offset + length,
+                     .arena = tree->arena,
+                     .failed = (offset > module->bodies_length) ||
+                               (length > module->bodies_length - offset)};
+    if ((reader.failed) ||
+        (word_hash(module->bodies + offset, length) != header[4]) ||
+        (!take_body(&reader, tree)))
+        return damaged(module);
+
+    size_t pushed = names->len;
+    if (!push_tree_references(tree, names)) {
+        fprintf(stderr, "Memory Error\n");
+        return false;
+    }
+    /* a verified body only refers to names there are */
+    for (size_t i = pushed; i < names->len; i++) {
+        Module *found;
+        bool defined = ast_table_get_ptr(ast, names->names[i]) != NULL;
+        errno = 0;
+        if ((!defined) && (!find_import(names->names[i], &found)))
+            return damaged(module);
+    }
+    return true;
+}
+
+/* Adds the declaration in signature to ast, as a verified tree without a
+ * body, or with it and the names it refers to pushed when names is given */
+static bool import_signature(Module *module, const char *signature,
+                             Names *names) {
+    uint64_t header[2];
+    memcpy(header, signature, sizeof(header));
+    const char *checked = signature + 2 * sizeof(uint64_t);
+    uint64_t available =
+        module->signatures_length - (checked - module->signatures);
+
+    AST tree = {.semantically_correct = true, .arena = arena_new()};
+    Reader reader = {.cursor = signature + SIGNATURE_HEADER,
+                     .end = checked + header[0],
+                     .arena = tree.arena,
+                     .failed = (!tree.arena) || (header[0] > available) ||
+                               (header[0] < SIGNATURE_HEADER -
+                                                2 * sizeof(uint64_t)) ||
+                               (word_hash(checked, header[0]) != header[1])};
+    if (!take_declaration(&reader, &tree)) {
+        arena_release(tree.arena);
+        return damaged(module);
+    }
+    if ((names) && (!import_body(module, signature, &tree, names))) {
+        arena_release(tree.arena);
+        return false;
+    }
+
+    if (!ast_table_insert(ast, tree_name(&tree), tree)) {
+        errno = 0;
+        fprintf(stderr, "Memory Error\n");
+        return false;
+    }
+    return true;
+}
+
+bool import_references() {
+    if (!module_count)
+        return true;
+
+    double start = trace_begin();
+    Names names = {0};
+    bool imported = true;
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while ((imported) && (NULL != (tree = ast_table_iter_next(ast, &key)))) {
+        if ((tree->semantically_correct) || (tree->type == AST_EXPRESSION))
+            continue;
+        Module *module;
+        if (find_import(key, &module)) {
+            fprintf(stderr, "ERROR: Redefinition of %s, imported from %s, in "
+                            "%s\n",
+                    key, module->path, filename);
+            imported = false;
+        } else if (!push_tree_references(tree, &names)) {
+            fprintf(stderr, "Memory Error\n");
+            imported = false;
+        }
+    }
+
+    /* ast is not inserted into while it is iterated. Verification only
+     * needs the types of what the program refers to, not what they refer
+     * to in turn. */
+    while ((imported) && (names.len)) {
+        const char *name = names.names[--names.len];
+        bool defined = ast_table_get_ptr(ast, name) != NULL;
+        errno = 0;
+        Module *module;
+        const char *signature = defined ? NULL : find_import(name, &module);
+        if (signature)
+            imported = import_signature(module, signature, NULL);
+    }
+    tracked_free(names.names);
+    trace_end("phase", "import references", start);
+    return imported;
+}
+
+bool import_bodies() {
+    if (!module_count)
+        return true;
+
+    double start = trace_begin();
+    Names names = {0};
+    bool imported = true;
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while ((imported) && (NULL != (tree = ast_table_iter_next(ast, &key)))) {
+        if ((tree->type != AST_EXPRESSION) && (!tree_body(tree)) &&
+            (!push_name(&names, key))) {
+            fprintf(stderr, "Memory Error\n");
+            imported = false;
+        }
+    }
+
+    /* the definitions the bodies refer to come with theirs */
+    while ((imported) && (names.len)) {
+        const char *name = names.names[--names.len];
+        tree = ast_table_get_ptr(ast, name);
+        errno = 0;
+        Module *module;
+        const char *signature =
+            (tree) && (tree_body(tree)) ? NULL : find_import(name, &module);
+        if ((signature) && (tree))
+            imported = import_body(module, signature, tree, &names);
+        else if (signature)
+            imported = import_signature(module, signature, &names);
+    }
+    tracked_free(names.names);
+    trace_end("phase", "import bodies", start);
+    return imported;
+}
+
+/* Parses and verifies the module in source against the ones before it,
+ * then imports it like an artifact, which is saved to artifact_path when
+ * given, so that a run goes on the same whether it compiled the module */
+static bool compile_module(const char *path, Source *source,
+                           const char *artifact_path, uint64_t key,
+                           uint64_t *signature_hash) {
+    filename = path;
+    if (parse_buffer(source->data, source->length)) {
+        fprintf(stderr, "%s\n", syntax_error_msg);
+        return false;
+    }
+    if (!import_references())
+        return false;
+
+    /* the definitions of earlier modules are verified already. trees points
+     * into ast, which nothing inserts into before put_artifact. */
+    size_t count = 0;
+    AST **trees = tracked_malloc(MEMORY_INTERPRETER,
+                                 ast_table_size(ast) * sizeof(AST *) + 1);
+    if (!trees) {
+        fprintf(stderr, "Memory Error\n");
+        return false;
+    }
+    char *name;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &name))) {
+        if (!tree->semantically_correct)
+            trees[count++] = tree;
+    }
+
+    if (!verify_semantics()) {
+        tracked_free(trees);
+        if (syntax_error_msg[0])
+            fprintf(stderr, "%s\n", syntax_error_msg);
+        else
+            fprintf(stderr, "Semantic Error: %s\n", semantic_error_msg);
+        return false;
+    }
+
+    Writer artifact = {0};
+    qsort(trees, count, sizeof(AST *), compare_definition_index);
+    put_artifact(&artifact, key, trees, count);
+    tracked_free(trees);
+    if ((!artifact.failed) && (artifact_path))
+        save_artifact(artifact_path, &artifact);
+
+    /* only what the program refers to is imported again */
+    ast_table_clear(ast);
+    ast = ast_table_new(100);
+    if ((artifact.failed) || (!ast) ||
+        (!add_module(artifact.data, artifact.length, key, path,
+                     artifact_path, signature_hash))) {
+        tracked_free(artifact.data);
+        fprintf(stderr, "Memory Error\n");
+        return false;
+    }
+    return true;
+}
+
+bool import_modules(const char **paths, size_t count, const char *cache_dir,
+                    uint64_t *program_hash) {
+    if (cache_dir)
+        make_directory(cache_dir);
+
+    /* of the signatures imported so far */
+    uint64_t imports_hash = MODULE_MAGIC;
+    *program_hash = MODULE_MAGIC;
+    for (size_t i = 0; i < count; i++) {
+        double start = trace_begin();
+        Source source;
+        if (!load_source(paths[i], &source)) {
+            fprintf(stderr, "Could not open file \"%s\"\n", paths[i]);
+            return false;
+        }
+        uint64_t source_hash = word_hash(source.data, source.length);
+        *program_hash = combine_hash(*program_hash, source_hash);
+
+        uint64_t key = combine_hash(imports_hash, source_hash);
+        uint64_t signature_hash;
+        char artifact_path[PATH_LEN];
+        if (cache_dir)
+            snprintf(artifact_path, PATH_LEN, "%s/%016llx.kmod", cache_dir,
+                     (unsigned long long)key);
+
+        Source artifact;
+        bool cached = (cache_dir) && (load_source(artifact_path, &artifact));
+        bool imported = (cached) &&
+                        (add_module(artifact.data, artifact.length, key,
+                                    paths[i], artifact_path, &signature_hash));
+        if ((cached) && (!imported))
+            unload_source(&artifact);
+        if (!imported)
+            imported = compile_module(paths[i], &source,
+                                      cache_dir ? artifact_path : NULL, key,
+                                      &signature_hash);
+        unload_source(&source);
+        trace_end("import", paths[i], start);
+        if (!imported)
+            return false;
+        imports_hash = combine_hash(imports_hash, signature_hash);
+    }
+    return true;
+}
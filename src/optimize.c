@@ -0,0 +1,427 @@
+#include "common.h"
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+/* Clones made of one function, and of the whole program, after which calls
+ * are left as they are */
+#define MAX_FUNCTION_SPECIALIZATIONS 8
+#define MAX_SPECIALIZATIONS 256
+
+#define SPECIALIZATION_NAME_LEN 256
+
+size_t hash_function(const char *str);
+
+typedef enum {
+    GLOBAL_FOLDING,
+    GLOBAL_CONSTANT,
+    GLOBAL_VARYING,
+} GlobalState;
+
+static inline void clean_global_state(GlobalState state) {}
+
+DS_TABLE_DEC(global_state, GlobalState);
+DS_TABLE_DEF(global_state, GlobalState, clean_global_state);
+
+static inline void clean_count(size_t count) {}
+
+DS_TABLE_DEC(specialized, size_t);
+DS_TABLE_DEF(specialized, size_t, clean_count);
+
+typedef struct {
+    global_state_table_t *globals;
+    specialized_table_t *specializations; /* clones made of each function */
+    size_t specialization_count;
+    size_t definition_count;
+} Optimizer;
+
+static void fold_expression(Expression *exp, Optimizer *opt,
+                            Function *scope);
+
+static inline bool is_constant(Expression *exp) {
+    return (exp->type == INTEGER_EXPRESSION) ||
+           (exp->type == BOOLEAN_EXPRESSION);
+}
+
+static inline void set_integer(Expression *exp, int value) {
+    exp->type = INTEGER_EXPRESSION;
+    exp->value.integer = value;
+}
+
+static inline void set_boolean(Expression *exp, bool value) {
+    exp->type = BOOLEAN_EXPRESSION;
+    exp->value.boolean = value;
+}
+
+/* Replaces exp by one of its operands, keeping its own position */
+static inline void replace_expression(Expression *exp, Expression *with) {
+    Expression position = *exp;
+    *exp = *with;
+    exp->line = position.line;
+    exp->column = position.column;
+    exp->end_line = position.end_line;
+    exp->end_column = position.end_column;
+}
+
+static bool is_argument(Function *func, const char *name) {
+    for (size_t i = 0; (func) && (i < func->arglen); i++) {
+        if (!strcmp(func->args[i].name, name))
+            return true;
+    }
+    return false;
+}
+
+/* Folds a valdef, returning its value when it is a constant */
+static Expression *global_constant(const char *name, Optimizer *opt) {
+    AST *tree = ast_table_get_ptr(ast, name);
+    errno = 0;
+    if ((!tree) || (tree->type != AST_VARIABLE) ||
+        (!tree->semantically_correct))
+        return NULL;
+    Variable *var = tree->value.var;
+
+    GlobalState *state = global_state_table_get_ptr(opt->globals, name);
+    errno = 0;
+    if (!state) {
+        /* marked first, so that a cycle is not folded forever */
+        if (!global_state_table_insert(opt->globals, name, GLOBAL_FOLDING))
+            return NULL;
+        fold_expression(var->expression, opt, NULL);
+        state = global_state_table_get_ptr(opt->globals, name);
+        *state =
+            is_constant(var->expression) ? GLOBAL_CONSTANT : GLOBAL_VARYING;
+    }
+    return *state == GLOBAL_CONSTANT ? var->expression : NULL;
+}
+
+static Expression *copy_expression(Expression *exp, Arena *arena,
+                                   Function *func, Expression **constants);
+
+/* Copies a call, or an operand, into arena */
+static bool copy_operand(Expression **operand, Arena *arena, Function *func,
+                         Expression **constants) {
+    return (*operand = copy_expression(*operand, arena, func, constants));
+}
+
+/* Copies exp into arena, with the arguments of func that constants has a
+ * value for replaced by it */
+static Expression *copy_expression(Expression *exp, Arena *arena,
+                                   Function *func, Expression **constants) {
+    Expression *copy = arena_alloc(arena, sizeof(Expression));
+    if (!copy)
+        return NULL;
+    *copy = *exp;
+
+    switch (exp->type) {
+    case VARIABLE_EXPRESSION:
+        for (size_t i = 0; i < func->arglen; i++) {
+            if ((constants[i]) &&
+                (!strcmp(func->args[i].name, exp->value.variable))) {
+                copy->type = constants[i]->type;
+                copy->value = constants[i]->value;
+            }
+        }
+        return copy;
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        return copy_operand(&copy->value.unary.fst, arena, func, constants)
+                   ? copy
+                   : NULL;
+    case IF_EXPRESSION:
+        return (copy_operand(&copy->value.if_statement.condition, arena, func,
+                             constants)) &&
+                       (copy_operand(&copy->value.if_statement.yes, arena,
+                                     func, constants)) &&
+                       (copy_operand(&copy->value.if_statement.no, arena,
+                                     func, constants))
+                   ? copy
+                   : NULL;
+    case FUNCTION_CALL_EXPRESSION: {
+        size_t arglen = exp->value.function_call.arglen;
+        copy->value.function_call.args =
+            arena_alloc(arena, sizeof(Expression *) * arglen);
+        if (!copy->value.function_call.args)
+            return NULL;
+        for (size_t i = 0; i < arglen; i++) {
+            Expression **arg = copy->value.function_call.args + i;
+            *arg = exp->value.function_call.args[i];
+            if (!copy_operand(arg, arena, func, constants))
+                return NULL;
+        }
+        return copy;
+    }
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return copy;
+    default:
+        return (copy_operand(&copy->value.binary.fst, arena, func,
+                             constants)) &&
+                       (copy_operand(&copy->value.binary.snd, arena, func,
+                                     constants))
+                   ? copy
+                   : NULL;
+    }
+}
+
+/* Names a specialization after the arguments it was made for, in the order
+ * they are declared, "_" standing for the ones it still takes */
+static const char *specialization_name(Function *func, Expression **args) {
+    char name[SPECIALIZATION_NAME_LEN];
+    int length = snprintf(name, sizeof(name), "%s(", func->funcname);
+    for (size_t i = func->arglen; (i--) && (length < (int)sizeof(name));) {
+        const char *separator = i ? "," : ")";
+        if (!is_constant(args[i]))
+            length += snprintf(name + length, sizeof(name) - length, "_%s",
+                               separator);
+        else if (args[i]->type == BOOLEAN_EXPRESSION)
+            length += snprintf(name + length, sizeof(name) - length, "%s%s",
+                               args[i]->value.boolean ? "true" : "false",
+                               separator);
+        else
+            length += snprintf(name + length, sizeof(name) - length, "%d%s",
+                               args[i]->value.integer, separator);
+    }
+    if (length >= (int)sizeof(name))
+        return NULL;
+    return intern_string(name, length);
+}
+
+/* Makes func without the arguments args has a constant for, and adds it to
+ * the program under name */
+static Function *specialize_function(Function *func, Expression **args,
+                                     const char *name, Optimizer *opt) {
+    size_t *count = specialized_table_get_ptr(opt->specializations,
+                                              func->funcname);
+    errno = 0;
+    if ((opt->specialization_count >= MAX_SPECIALIZATIONS) ||
+        ((count) && (*count >= MAX_FUNCTION_SPECIALIZATIONS)))
+        return NULL;
+
+    Arena *arena = arena_new();
+    if (!arena)
+        return NULL;
+    Function *clone = arena_alloc(arena, sizeof(Function) +
+                                             sizeof(Argument) * func->arglen);
+    Expression *constants[func->arglen];
+    if (!clone)
+        goto error;
+    *clone = (Function){.funcname = name, .return_type = func->return_type};
+    for (size_t i = 0; i < func->arglen; i++) {
+        constants[i] = is_constant(args[i]) ? args[i] : NULL;
+        if (!constants[i])
+            clone->args[clone->arglen++] = func->args[i];
+    }
+    clone->expression =
+        copy_expression(func->expression, arena, func, constants);
+    if (!clone->expression)
+        goto error;
+
+    AST tree = {.type = AST_FUNCTION,
+                .semantically_correct = true,
+                .definition_index = opt->definition_count++,
+                .arena = arena,
+                .value.func = clone};
+    if (!ast_table_insert(ast, name, tree))
+        goto error;
+    if (count)
+        (*count)++;
+    else
+        specialized_table_insert(opt->specializations, func->funcname, 1);
+    errno = 0;
+    opt->specialization_count++;
+
+    /* after it is added, so that its recursive calls find it */
+    fold_expression(clone->expression, opt, clone);
+    return clone;
+
+error:
+    errno = 0;
+    arena_release(arena);
+    return NULL;
+}
+
+/* Points a call passing constants at a specialization for them */
+static void specialize_call(Expression *exp, Optimizer *opt) {
+    Expression **args = exp->value.function_call.args;
+    size_t arglen = exp->value.function_call.arglen;
+    size_t constant_count = 0;
+    for (size_t i = 0; i < arglen; i++) {
+        constant_count += is_constant(args[i]);
+    }
+    if (!constant_count)
+        return;
+
+    AST *tree = ast_table_get_ptr(ast, exp->value.function_call.funcname);
+    errno = 0;
+    if ((!tree) || (tree->type != AST_FUNCTION) ||
+        (!tree->semantically_correct) || (!tree->value.func->expression))
+        return;
+    Function *func = tree->value.func;
+
+    const char *name = specialization_name(func, args);
+    if (!name)
+        return;
+    tree = ast_table_get_ptr(ast, name);
+    errno = 0;
+    if ((!tree) && (!specialize_function(func, args, name, opt)))
+        return;
+
+    /* the arguments left keep their order */
+    size_t kept = 0;
+    for (size_t i = 0; i < arglen; i++) {
+        if (!is_constant(args[i]))
+            args[kept++] = args[i];
+    }
+    exp->value.function_call.funcname = name;
+    exp->value.function_call.arglen = kept;
+}
+
+/* Folds exp, of the function scope or of a global if NULL, in place. Only
+ * operations that can not raise a runtime error are folded, and operands
+ * are only dropped when their evaluation would have been skipped anyway, so
+ * errors and non termination are kept. */
+static void fold_expression(Expression *exp, Optimizer *opt,
+                            Function *scope) {
+    Expression *fst = exp->value.binary.fst;
+    Expression *snd = exp->value.binary.snd;
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return;
+    case VARIABLE_EXPRESSION: {
+        if (is_argument(scope, exp->value.variable))
+            return;
+        Expression *value = global_constant(exp->value.variable, opt);
+        if (value) {
+            exp->type = value->type;
+            exp->value = value->value;
+        }
+        return;
+    }
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        fold_expression(exp->value.unary.fst, opt, scope);
+        fst = exp->value.unary.fst;
+        if (fst->type == INTEGER_EXPRESSION)
+            set_integer(exp, (int)(0u - (unsigned)fst->value.integer));
+        else if (fst->type == BOOLEAN_EXPRESSION)
+            set_boolean(exp, !fst->value.boolean);
+        return;
+    case AND_EXPRESSION:
+    case OR_EXPRESSION:
+        fold_expression(fst, opt, scope);
+        fold_expression(snd, opt, scope);
+        if (fst->type != BOOLEAN_EXPRESSION)
+            return;
+        if (fst->value.boolean == (exp->type == AND_EXPRESSION))
+            replace_expression(exp, snd);
+        else
+            set_boolean(exp, fst->value.boolean);
+        return;
+    case IF_EXPRESSION: {
+        Expression *condition = exp->value.if_statement.condition;
+        fold_expression(condition, opt, scope);
+        fold_expression(exp->value.if_statement.yes, opt, scope);
+        fold_expression(exp->value.if_statement.no, opt, scope);
+        if (condition->type == BOOLEAN_EXPRESSION)
+            replace_expression(exp, condition->value.boolean
+                                        ? exp->value.if_statement.yes
+                                        : exp->value.if_statement.no);
+        return;
+    }
+    case FUNCTION_CALL_EXPRESSION:
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            fold_expression(exp->value.function_call.args[i], opt, scope);
+        }
+        specialize_call(exp, opt);
+        return;
+    default:
+        break;
+    }
+
+    fold_expression(fst, opt, scope);
+    fold_expression(snd, opt, scope);
+    if ((fst->type != INTEGER_EXPRESSION) || (snd->type != INTEGER_EXPRESSION))
+        return;
+    /* wrapping around like the evaluator does on the targets it runs on */
+    unsigned a = fst->value.integer;
+    unsigned b = snd->value.integer;
+    int x = fst->value.integer;
+    int y = snd->value.integer;
+    switch (exp->type) {
+    case PLUS_EXPRESSION:
+        set_integer(exp, (int)(a + b));
+        return;
+    case MULTIPLY_EXPRESSION:
+        set_integer(exp, (int)(a * b));
+        return;
+    case DIVIDE_EXPRESSION:
+    case MODULO_EXPRESSION:
+        if ((y == 0) || ((x == INT_MIN) && (y == -1)))
+            return;
+        set_integer(exp, exp->type == DIVIDE_EXPRESSION ? x / y : x % y);
+        return;
+    case EQUALS_EXPRESSION:
+        set_boolean(exp, x == y);
+        return;
+    case NOT_EQUALS_EXPRESSION:
+        set_boolean(exp, x != y);
+        return;
+    case GREATER_EXPRESSION:
+        set_boolean(exp, x > y);
+        return;
+    case GREATER_EQUALS_EXPRESSION:
+        set_boolean(exp, x >= y);
+        return;
+    case LESSER_EXPRESSION:
+        set_boolean(exp, x < y);
+        return;
+    case LESSER_EQUALS_EXPRESSION:
+        set_boolean(exp, x <= y);
+        return;
+    default:
+        return;
+    }
+}
+
+/* Folds constants in every verified definition, and specializes functions
+ * for the constant arguments they are called with. Specializations are
+ * added to ast as functions of their own, named like "power(_,2)". */
+void optimize_program() {
+    double start = trace_begin();
+    Optimizer opt = {.globals = global_state_table_new(64),
+                     .specializations = specialized_table_new(64),
+                     .definition_count = ast_table_size(ast)};
+    size_t size = ast_table_size(ast);
+    AST *trees = tracked_malloc(MEMORY_INTERPRETER, size * sizeof(AST) + 1);
+    if ((!opt.globals) || (!opt.specializations) || (!trees))
+        goto done;
+
+    /* inserting specializations moves the entries, so the definitions are
+     * gathered first */
+    size_t len = 0;
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if ((tree->semantically_correct) &&
+            ((tree->type == AST_VARIABLE) || (tree->value.func->expression)))
+            trees[len++] = *tree;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if (trees[i].type == AST_VARIABLE)
+            global_constant(trees[i].value.var->name, &opt);
+        else
+            fold_expression(trees[i].value.func->expression, &opt,
+                            trees[i].value.func);
+    }
+
+done:
+    tracked_free(trees);
+    if (opt.globals)
+        global_state_table_clear(opt.globals);
+    if (opt.specializations)
+        specialized_table_clear(opt.specializations);
+    trace_end("phase", "optimize", start);
+}
@@ -0,0 +1,129 @@
+#include "common.h"
+
+#ifdef _WIN32
+
+void set_thread_count(size_t threads) {}
+
+void parallel_for(size_t count, ParallelTask task, void *data) {
+    for (size_t i = 0; i < count; i++) {
+        task(i, data);
+    }
+}
+
+#else
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* Indices a thread takes at a time */
+#define PARALLEL_CHUNK 32
+
+/* Workers are started on first use and live as long as the process */
+static size_t thread_count;
+static size_t worker_count;
+static bool workers_started;
+
+static struct {
+    ParallelTask task;
+    void *data;
+    size_t count;
+    atomic_size_t next;
+} job;
+static size_t job_generation;
+static size_t busy_workers;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+/* One job at a time, for when several threads call parallel_for */
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Nested calls run sequentially instead of waiting on the busy pool */
+static _Thread_local bool in_parallel_for;
+
+static void run_job() {
+    size_t i;
+    while ((i = atomic_fetch_add(&job.next, PARALLEL_CHUNK)) < job.count) {
+        size_t end = i + PARALLEL_CHUNK < job.count ? i + PARALLEL_CHUNK
+                                                    : job.count;
+        for (; i < end; i++) {
+            job.task(i, job.data);
+        }
+    }
+}
+
+static void *pool_worker(void *arg) {
+    in_parallel_for = true;
+    size_t seen_generation = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    while (true) {
+        while (job_generation == seen_generation)
+            pthread_cond_wait(&job_ready, &pool_lock);
+        seen_generation = job_generation;
+        pthread_mutex_unlock(&pool_lock);
+
+        run_job();
+
+        pthread_mutex_lock(&pool_lock);
+        if (--busy_workers == 0)
+            pthread_cond_signal(&job_done);
+    }
+    return NULL;
+}
+
+static void start_workers() {
+    workers_started = true;
+    if (!thread_count) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = online > 0 ? online : 1;
+    }
+
+    for (; worker_count + 1 < thread_count; worker_count++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, NULL))
+            break;
+        pthread_detach(thread);
+    }
+}
+
+/* 0 uses every online processor. Only has an effect before the first
+ * parallel_for. */
+void set_thread_count(size_t threads) { thread_count = threads; }
+
+void parallel_for(size_t count, ParallelTask task, void *data) {
+    if ((in_parallel_for) || (count <= PARALLEL_CHUNK)) {
+        for (size_t i = 0; i < count; i++) {
+            task(i, data);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&job_lock);
+    if (!workers_started)
+        start_workers();
+
+    pthread_mutex_lock(&pool_lock);
+    job.task = task;
+    job.data = data;
+    job.count = count;
+    atomic_store(&job.next, 0);
+    busy_workers = worker_count;
+    job_generation++;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&pool_lock);
+
+    in_parallel_for = true;
+    run_job();
+    in_parallel_for = false;
+
+    pthread_mutex_lock(&pool_lock);
+    while (busy_workers)
+        pthread_cond_wait(&job_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&job_lock);
+}
+
+#endif
@@ -3,12 +3,61 @@
     #include "cli_interpreter.h"
 
     #define ERROR_MSG_LEN 500
-    char syntax_error_msg[ERROR_MSG_LEN];
+
+    /* The default of 10000 runs out at a few thousand nested brackets. This
+     * allows about 100000 levels, deeper would overflow the C stack in the
+     * recursive verifier and evaluator anyway. */
+    #define YYMAXDEPTH 300000
+    #define YYMALLOC(size) tracked_malloc(MEMORY_AST, size)
+    #define YYFREE tracked_free
+    _Thread_local char syntax_error_msg[ERROR_MSG_LEN];
+
+    void *yy_scan_buffer(char *, size_t);
+    void yy_delete_buffer(void *);
+
+    bool use_fast_lexer = false;
+    bool defer_function_bodies = false;
+
+    /* Result of parsing a deferred function body */
+    static _Thread_local Expression *parsed_expression;
+
+    /* Definitions parsed so far, to number them in source order */
+    static _Thread_local size_t definition_count;
 %}
 
+%code requires {
+    #include "common.h"
+}
+
+%code provides {
+    /* Where flex scans token values into, yylex copies them to the parser */
+    extern YYSTYPE yylval;
+    int yylex(YYSTYPE *value, YYLTYPE *location);
+    void yyerror(YYLTYPE *location, char const *str);
+}
+
+%code {
+    static void redefinition_error(YYLTYPE *location, const char *name);
+
+    /* Records where an expression starts, for hot spot listings */
+    static inline Expression *locate(Expression *exp, YYLTYPE location) {
+        exp->line = location.first_line;
+        exp->column = location.first_column;
+        exp->end_line = location.last_line;
+        exp->end_column = location.last_column;
+        return exp;
+    }
+}
+
+%locations
+/* Parser state lives on the stack of yyparse, so that every thread can
+ * parse a program of its own */
+%define api.pure full
+
 %union {
     int integer;
-    char *identifier;
+    SourceView view;
+    DeferredExpression deferred;
     struct _Expression *expression;
     struct _Variable *variable;
     struct _Function *function;
@@ -45,7 +94,9 @@
 %token LESSER_EQUALS
 %token RETURN
 %token <integer> INTEGER
-%token <identifier> IDENTIFIER
+%token <view> IDENTIFIER
+%token <deferred> DEFERRED_BODY
+%token PARSE_EXPRESSION
 
 %type <function> function_definition;
 %type <function> function_definition_arguments;
@@ -62,72 +113,151 @@
 %precedence MINUS
 %precedence NOT
 
+%start program
+
 %%
+program: input
+       | PARSE_EXPRESSION expression STATEMENT_END { parsed_expression = $2; };
+
 input: %empty
      | input expression STATEMENT_END {
             if (cli_interpretation_mode) {
                 cli_interpret((AST){.type = AST_EXPRESSION, .value.exp = $2});
+                discard_node_arena();
             }
             else {
-                yyerror("Standalone expression are not allowed\n");
+                yyerror(&yylloc, "Standalone expression are not allowed\n");
                 // ???: Don't exit here
                 return 1;
             }
         }
      | input value_definition { 
+            AST tree = {.type = AST_VARIABLE, .definition_index = definition_count++, .arena = take_node_arena(), .value.var = $2};
             if (cli_interpretation_mode) {
-                cli_interpret((AST){.type = AST_VARIABLE, .value.var = $2});
+                cli_interpret(tree);
             }
-            else {
-                assert(ast_table_insert(ast, ($2)->name, (AST){.type = AST_VARIABLE, .value.var = $2}));
+            else if (!ast_table_insert(ast, ($2)->name, tree)) {
+                redefinition_error(&yylloc, ($2)->name);
+                arena_release(tree.arena);
+                YYABORT;
             }
         }
      | input function_definition { 
+            AST tree = {.type = AST_FUNCTION, .definition_index = definition_count++, .arena = take_node_arena(), .value.func = $2};
             if (cli_interpretation_mode) {
-                cli_interpret((AST){.type = AST_FUNCTION, .value.func = $2});
-            } else {
-                assert(ast_table_insert(ast, ($2)->funcname, (AST){.type = AST_FUNCTION, .value.func = $2})); 
+                cli_interpret(tree);
+            } else if (!ast_table_insert(ast, ($2)->funcname, tree)) {
+                redefinition_error(&yylloc, ($2)->funcname);
+                arena_release(tree.arena);
+                YYABORT;
             }
         };
 
-function_definition: KW_FUNCDEF IDENTIFIER OPEN_BRACKETS function_definition_arguments CLOSE_BRACKETS RETURN KW_BOOL ASSIGN expression STATEMENT_END { $$ = set_function_return_value(set_function_name($4, $2), BOOL, $9); }
-                   | KW_FUNCDEF IDENTIFIER OPEN_BRACKETS function_definition_arguments CLOSE_BRACKETS RETURN KW_INT ASSIGN expression STATEMENT_END { $$ = set_function_return_value(set_function_name($4, $2), INT, $9);};
-
-function_definition_arguments: IDENTIFIER TYPE_OF KW_BOOL { $$ = add_function_argument(make_function(), $1, BOOL); }
-                             | IDENTIFIER TYPE_OF KW_INT { $$ = add_function_argument(make_function(), $1, INT); }
-                             | IDENTIFIER TYPE_OF KW_BOOL COMMA function_definition_arguments { $$ = add_function_argument($5, $1, BOOL); }
-                             | IDENTIFIER TYPE_OF KW_INT COMMA function_definition_arguments { $$ = add_function_argument($5, $1, INT); }
-
-value_definition: KW_VALDEF IDENTIFIER TYPE_OF KW_BOOL ASSIGN expression STATEMENT_END { $$ = make_variable($2, BOOL, $6); }
-                | KW_VALDEF IDENTIFIER TYPE_OF KW_INT ASSIGN expression STATEMENT_END { $$ = make_variable($2, INT, $6); };
-
-expression: IDENTIFIER { $$ = make_variable_expression($1); }
-          | INTEGER { $$ = make_integer_expression($1); }
-          | KW_TRUE { $$ = make_boolean_expression(true); }
-          | KW_FALSE { $$ = make_boolean_expression(false); }
-          | expression AND expression { $$ = make_binary_expression($1, $3, AND_EXPRESSION); }
-          | expression OR expression { $$ = make_binary_expression($1, $3, OR_EXPRESSION); }
-          | NOT expression { $$ = make_unary_expression($2, NOT_EXPRESSION); }
-          | expression PLUS expression { $$ = make_binary_expression($1, $3, PLUS_EXPRESSION); }
-          | expression MULTIPLY expression { $$ = make_binary_expression($1, $3, MULTIPLY_EXPRESSION); }
-          | expression DIVIDE expression { $$ = make_binary_expression($1, $3, DIVIDE_EXPRESSION); }
-          | expression MODULO expression { $$ = make_binary_expression($1, $3, MODULO_EXPRESSION); }
-          | MINUS expression { $$ = make_unary_expression($2, MINUS_EXPRESSION); }
-          | expression EQUALS expression { $$ = make_binary_expression($1, $3, EQUALS_EXPRESSION); }
-          | expression NOT_EQUALS expression { $$ = make_binary_expression($1, $3, NOT_EQUALS_EXPRESSION); }
-          | expression GREATER expression { $$ = make_binary_expression($1, $3, GREATER_EXPRESSION); }
-          | expression GREATER_EQUALS expression { $$ = make_binary_expression($1, $3, GREATER_EQUALS_EXPRESSION); }
-          | expression LESSER expression { $$ = make_binary_expression($1, $3, LESSER_EXPRESSION); }
-          | expression LESSER_EQUALS expression { $$ = make_binary_expression($1, $3, LESSER_EQUALS_EXPRESSION); }
-          | KW_IF expression KW_THEN expression KW_ELSE expression { $$ = make_if_expression($2, $4, $6); }
-          | IDENTIFIER OPEN_BRACKETS function_call_arguments CLOSE_BRACKETS { $$ = set_function_call_name_expression($3, $1); }
+function_definition: KW_FUNCDEF IDENTIFIER OPEN_BRACKETS function_definition_arguments CLOSE_BRACKETS RETURN KW_BOOL ASSIGN expression STATEMENT_END { $$ = set_function_return_value(set_function_name($4, intern_view($2)), BOOL, $9); }
+                   | KW_FUNCDEF IDENTIFIER OPEN_BRACKETS function_definition_arguments CLOSE_BRACKETS RETURN KW_INT ASSIGN expression STATEMENT_END { $$ = set_function_return_value(set_function_name($4, intern_view($2)), INT, $9);}
+                   | KW_FUNCDEF IDENTIFIER OPEN_BRACKETS function_definition_arguments CLOSE_BRACKETS RETURN KW_BOOL ASSIGN DEFERRED_BODY STATEMENT_END { $$ = set_function_deferred_body(set_function_return_value(set_function_name($4, intern_view($2)), BOOL, NULL), $9); }
+                   | KW_FUNCDEF IDENTIFIER OPEN_BRACKETS function_definition_arguments CLOSE_BRACKETS RETURN KW_INT ASSIGN DEFERRED_BODY STATEMENT_END { $$ = set_function_deferred_body(set_function_return_value(set_function_name($4, intern_view($2)), INT, NULL), $9); };
+
+function_definition_arguments: IDENTIFIER TYPE_OF KW_BOOL { $$ = add_function_argument(make_function(), intern_view($1), BOOL); }
+                             | IDENTIFIER TYPE_OF KW_INT { $$ = add_function_argument(make_function(), intern_view($1), INT); }
+                             | IDENTIFIER TYPE_OF KW_BOOL COMMA function_definition_arguments { $$ = add_function_argument($5, intern_view($1), BOOL); }
+                             | IDENTIFIER TYPE_OF KW_INT COMMA function_definition_arguments { $$ = add_function_argument($5, intern_view($1), INT); }
+
+value_definition: KW_VALDEF IDENTIFIER TYPE_OF KW_BOOL ASSIGN expression STATEMENT_END { $$ = make_variable(intern_view($2), BOOL, $6); }
+                | KW_VALDEF IDENTIFIER TYPE_OF KW_INT ASSIGN expression STATEMENT_END { $$ = make_variable(intern_view($2), INT, $6); };
+
+expression: IDENTIFIER { $$ = locate(make_variable_expression(intern_view($1)), @$); }
+          | INTEGER { $$ = locate(make_integer_expression($1), @$); }
+          | KW_TRUE { $$ = locate(make_boolean_expression(true), @$); }
+          | KW_FALSE { $$ = locate(make_boolean_expression(false), @$); }
+          | expression AND expression { $$ = locate(make_binary_expression($1, $3, AND_EXPRESSION), @$); }
+          | expression OR expression { $$ = locate(make_binary_expression($1, $3, OR_EXPRESSION), @$); }
+          | NOT expression { $$ = locate(make_unary_expression($2, NOT_EXPRESSION), @$); }
+          | expression PLUS expression { $$ = locate(make_binary_expression($1, $3, PLUS_EXPRESSION), @$); }
+          | expression MULTIPLY expression { $$ = locate(make_binary_expression($1, $3, MULTIPLY_EXPRESSION), @$); }
+          | expression DIVIDE expression { $$ = locate(make_binary_expression($1, $3, DIVIDE_EXPRESSION), @$); }
+          | expression MODULO expression { $$ = locate(make_binary_expression($1, $3, MODULO_EXPRESSION), @$); }
+          | MINUS expression { $$ = locate(make_unary_expression($2, MINUS_EXPRESSION), @$); }
+          | expression EQUALS expression { $$ = locate(make_binary_expression($1, $3, EQUALS_EXPRESSION), @$); }
+          | expression NOT_EQUALS expression { $$ = locate(make_binary_expression($1, $3, NOT_EQUALS_EXPRESSION), @$); }
+          | expression GREATER expression { $$ = locate(make_binary_expression($1, $3, GREATER_EXPRESSION), @$); }
+          | expression GREATER_EQUALS expression { $$ = locate(make_binary_expression($1, $3, GREATER_EQUALS_EXPRESSION), @$); }
+          | expression LESSER expression { $$ = locate(make_binary_expression($1, $3, LESSER_EXPRESSION), @$); }
+          | expression LESSER_EQUALS expression { $$ = locate(make_binary_expression($1, $3, LESSER_EQUALS_EXPRESSION), @$); }
+          | KW_IF expression KW_THEN expression KW_ELSE expression { $$ = locate(make_if_expression($2, $4, $6), @$); }
+          | IDENTIFIER OPEN_BRACKETS function_call_arguments CLOSE_BRACKETS { $$ = locate(set_function_call_name_expression($3, intern_view($1)), @$); }
           | OPEN_BRACKETS expression CLOSE_BRACKETS { $$ = $2; };
 
 function_call_arguments: expression { $$ = add_function_call_argument_expression(make_function_call_expression(), $1); }
                        | expression COMMA function_call_arguments { $$ = add_function_call_argument_expression($3, $1); };
 %%
 
-void yyerror(char const *str) {
-    snprintf(syntax_error_msg, ERROR_MSG_LEN,
-              "ERROR: %s in %s:%d:%d", str, filename, yylineno, column);
+void yyerror(YYLTYPE *location, char const *str) {
+    snprintf(syntax_error_msg, ERROR_MSG_LEN, "ERROR: %s in %s:%d:%d", str,
+             filename, location->first_line, location->first_column);
+}
+
+static void redefinition_error(YYLTYPE *location, const char *name) {
+    /* leaves yyerror room for the position */
+    char msg[ERROR_MSG_LEN / 2];
+    snprintf(msg, sizeof(msg), "Redefinition of %s", name);
+    errno = 0;
+    yyerror(location, msg);
+}
+
+int parse_buffer(char *data, size_t length) {
+    if (use_fast_lexer)
+        return parse_buffer_at(data, length, 1, 1, 0);
+
+    definition_count = 0;
+    yylineno = 1;
+    void *buffer = yy_scan_buffer(data, length + 2);
+    int result = yyparse();
+    yy_delete_buffer(buffer);
+    /* nodes of a definition the error interrupted */
+    discard_node_arena();
+    return result;
+}
+
+size_t next_definition_index() { return definition_count; }
+
+void set_next_definition_index(size_t index) { definition_count = index; }
+
+int parse_buffer_at(const char *data, size_t length, int line, int column,
+                    size_t first_index) {
+    definition_count = first_index;
+    FastLexer lexer;
+    fast_lexer_init(&lexer, data, length, line, column);
+    lexer.defer_function_bodies = defer_function_bodies;
+    fast_lexer = &lexer;
+    int result = yyparse();
+    fast_lexer = NULL;
+    discard_node_arena();
+    return result;
+}
+
+/* Parses the body of a function whose parsing was deferred into the arena of
+ * its definition; the source it was read from must still be loaded */
+bool parse_function_body(Function *func, Arena *arena) {
+    DeferredExpression body = func->deferred_body;
+    FastLexer lexer;
+    /* with the STATEMENT_END after it, so errors point where a full parse
+     * would have */
+    fast_lexer_init(&lexer, body.start, body.length + 1, body.line,
+                    body.column);
+    lexer.pending_token = PARSE_EXPRESSION;
+
+    FastLexer *outer = fast_lexer;
+    Arena *outer_arena = node_arena;
+    fast_lexer = &lexer;
+    node_arena = arena;
+    parsed_expression = NULL;
+    int result = yyparse();
+    fast_lexer = outer;
+    node_arena = outer_arena;
+
+    if (result || !parsed_expression)
+        return false;
+    func->expression = parsed_expression;
+    return true;
 }
@@ -0,0 +1,212 @@
+#include "common.h"
+
+_Thread_local ShadowStack shadow_stack;
+bool profiling = false;
+
+#ifdef _WIN32
+
+bool start_profiler(const char *path, unsigned rate) {
+    fprintf(stderr, "Profiling is not supported on Windows\n");
+    return false;
+}
+
+void flush_profile_samples() {}
+
+bool stop_profiler() { return true; }
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* Slots of the sample ring, each a frame or the header of a sample */
+#define PROFILE_RING_SIZE (1 << 18)
+#define TRUNCATED_FRAME "[deeper]"
+
+size_t hash_function(const char *str);
+
+/* The table key is stack, which the entry owns */
+typedef struct {
+    char *stack;
+    size_t count;
+} FoldedStack;
+
+static inline void clean_folded_stack(FoldedStack entry) {
+    tracked_free(entry.stack);
+}
+
+DS_TABLE_DEC(folded, FoldedStack);
+DS_TABLE_DEF(folded, FoldedStack, clean_folded_stack);
+
+/* The signal handler appends samples to the ring, which is drained outside
+ * of it. Samples are a header slot, holding the number of frames and
+ * whether the stack was deeper, followed by the names of the frames,
+ * outermost first. Names are interned, so they outlive the definitions a
+ * REPL or watch reload frees before the ring is drained. Only the thread
+ * evaluating KariLang code writes to it. */
+static uintptr_t ring[PROFILE_RING_SIZE];
+static atomic_size_t ring_head;
+static atomic_size_t ring_tail;
+static atomic_size_t dropped_samples;
+
+static const char *profile_path;
+static folded_table_t *folded_stacks;
+static char *folded;
+static size_t folded_capacity;
+
+static void take_sample(int signal) {
+    size_t depth = shadow_stack.depth;
+    if (!depth)
+        return;
+    atomic_signal_fence(memory_order_acquire);
+
+    size_t frames =
+        depth < SHADOW_STACK_CAPACITY ? depth : SHADOW_STACK_CAPACITY;
+    size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+    if (head - tail + frames + 1 > PROFILE_RING_SIZE) {
+        atomic_fetch_add_explicit(&dropped_samples, 1, memory_order_relaxed);
+        return;
+    }
+
+    ring[head++ % PROFILE_RING_SIZE] =
+        frames << 1 | (depth > SHADOW_STACK_CAPACITY);
+    for (size_t i = 0; i < frames; i++) {
+        ring[head++ % PROFILE_RING_SIZE] =
+            (uintptr_t)shadow_stack.frames[i]->funcname;
+    }
+    atomic_store_explicit(&ring_head, head, memory_order_release);
+}
+
+static bool append_folded(size_t *length, const char *name) {
+    size_t name_length = strlen(name);
+    if (*length + name_length + 2 > folded_capacity) {
+        size_t capacity = (*length + name_length + 2) * 2;
+        char *grown = tracked_realloc(MEMORY_INTERPRETER, folded, capacity);
+        if (!grown)
+            return false;
+        folded = grown;
+        folded_capacity = capacity;
+    }
+    if (*length)
+        folded[(*length)++] = ';';
+    memcpy(folded + *length, name, name_length + 1);
+    *length += name_length;
+    return true;
+}
+
+static void count_folded_stack() {
+    FoldedStack *entry = folded_table_get_ptr(folded_stacks, folded);
+    errno = 0;
+    if (entry) {
+        entry->count++;
+        return;
+    }
+
+    char *stack = tracked_malloc(MEMORY_INTERPRETER, strlen(folded) + 1);
+    if (!stack)
+        return;
+    strcpy(stack, folded);
+    if (!folded_table_insert(folded_stacks, stack,
+                             (FoldedStack){.stack = stack, .count = 1}))
+        tracked_free(stack);
+}
+
+/* Folds the samples taken so far into folded_stacks. Called between
+ * function calls, so the ring rarely fills up. */
+void flush_profile_samples() {
+    if (!profiling)
+        return;
+
+    size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    while (tail != head) {
+        uintptr_t header = ring[tail++ % PROFILE_RING_SIZE];
+        size_t length = 0;
+        bool folded_all = true;
+        for (size_t i = 0; i < header >> 1; i++) {
+            const char *name = (const char *)ring[tail++ % PROFILE_RING_SIZE];
+            folded_all = folded_all && append_folded(&length, name);
+        }
+        if ((header & 1) && (folded_all))
+            folded_all = append_folded(&length, TRUNCATED_FRAME);
+        if (folded_all)
+            count_folded_stack();
+    }
+    atomic_store_explicit(&ring_tail, tail, memory_order_release);
+}
+
+bool start_profiler(const char *path, unsigned rate) {
+    folded_stacks = folded_table_new(256);
+    if (!folded_stacks) {
+        fprintf(stderr, "Memory Error\n");
+        return false;
+    }
+    profile_path = path;
+
+    struct sigaction action = {.sa_handler = take_sample,
+                               .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL)) {
+        perror("sigaction");
+        return false;
+    }
+
+    long interval = 1000000 / (rate ? rate : 1);
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = interval / 1000000,
+                        .tv_usec = interval % 1000000},
+        .it_value = {.tv_sec = interval / 1000000,
+                     .tv_usec = interval % 1000000},
+    };
+    if (!interval)
+        timer.it_interval.tv_usec = timer.it_value.tv_usec = 1;
+    if (setitimer(ITIMER_PROF, &timer, NULL)) {
+        perror("setitimer");
+        return false;
+    }
+    profiling = true;
+    return true;
+}
+
+/* Stops sampling and writes one "caller;callee count" line per stack */
+bool stop_profiler() {
+    if (!profiling)
+        return true;
+
+    struct itimerval stopped = {0};
+    setitimer(ITIMER_PROF, &stopped, NULL);
+    flush_profile_samples();
+    profiling = false;
+
+    FILE *out = fopen(profile_path, "w");
+    if (!out) {
+        fprintf(stderr, "Could not open file \"%s\"\n", profile_path);
+        return false;
+    }
+
+    char *key;
+    FoldedStack *entry;
+    size_t samples = 0;
+    folded_table_iter(folded_stacks);
+    while (NULL != (entry = folded_table_iter_next(folded_stacks, &key))) {
+        fprintf(out, "%s %zu\n", entry->stack, entry->count);
+        samples += entry->count;
+    }
+    fclose(out);
+
+    size_t dropped = atomic_load(&dropped_samples);
+    if (dropped)
+        fprintf(stderr, "Profiler dropped %zu of %zu samples\n", dropped,
+                samples + dropped);
+
+    folded_table_clear(folded_stacks);
+    tracked_free(folded);
+    folded = NULL;
+    folded_capacity = 0;
+    return true;
+}
+
+#endif
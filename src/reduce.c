@@ -0,0 +1,206 @@
+#include "common.h"
+#include <string.h>
+
+static bool uses_variable(Expression *exp, const char *name) {
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return false;
+    case VARIABLE_EXPRESSION:
+        return !strcmp(exp->value.variable, name);
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        return uses_variable(exp->value.unary.fst, name);
+    case IF_EXPRESSION:
+        return uses_variable(exp->value.if_statement.condition, name) ||
+               uses_variable(exp->value.if_statement.yes, name) ||
+               uses_variable(exp->value.if_statement.no, name);
+    case FUNCTION_CALL_EXPRESSION:
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            if (uses_variable(exp->value.function_call.args[i], name))
+                return true;
+        }
+        return false;
+    default:
+        return uses_variable(exp->value.binary.fst, name) ||
+               uses_variable(exp->value.binary.snd, name);
+    }
+}
+
+/* Whether evaluating exp may raise an error or not end */
+static bool may_fail(Expression *exp) {
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+    case VARIABLE_EXPRESSION:
+        return false;
+    case FUNCTION_CALL_EXPRESSION:
+    case DIVIDE_EXPRESSION:
+    case MODULO_EXPRESSION:
+        return true;
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        return may_fail(exp->value.unary.fst);
+    case IF_EXPRESSION:
+        return may_fail(exp->value.if_statement.condition) ||
+               may_fail(exp->value.if_statement.yes) ||
+               may_fail(exp->value.if_statement.no);
+    default:
+        return may_fail(exp->value.binary.fst) ||
+               may_fail(exp->value.binary.snd);
+    }
+}
+
+static inline bool is_variable(Expression *exp, const char *name) {
+    return (exp->type == VARIABLE_EXPRESSION) &&
+           (!strcmp(exp->value.variable, name));
+}
+
+static inline bool is_associative(ExpressionType op, Type type) {
+    return type == INT ? (op == PLUS_EXPRESSION) || (op == MULTIPLY_EXPRESSION)
+                       : (op == AND_EXPRESSION) || (op == OR_EXPRESSION);
+}
+
+/* The comparison true where type is false */
+static ExpressionType negated_comparison(ExpressionType type) {
+    switch (type) {
+    case EQUALS_EXPRESSION:
+        return NOT_EQUALS_EXPRESSION;
+    case NOT_EQUALS_EXPRESSION:
+        return EQUALS_EXPRESSION;
+    case GREATER_EXPRESSION:
+        return LESSER_EQUALS_EXPRESSION;
+    case GREATER_EQUALS_EXPRESSION:
+        return LESSER_EXPRESSION;
+    case LESSER_EXPRESSION:
+        return GREATER_EQUALS_EXPRESSION;
+    default:
+        return GREATER_EXPRESSION;
+    }
+}
+
+static inline bool is_recursive_call(Expression *exp, Function *func) {
+    return (exp->type == FUNCTION_CALL_EXPRESSION) &&
+           (!strcmp(exp->value.function_call.funcname, func->funcname));
+}
+
+/* Finds the counter, an argument compared in condition that call changes,
+ * the other side of the comparison being the limit */
+static bool match_condition(Function *func, Expression *condition,
+                            Expression *call, Reduction *reduction) {
+    if (!is_comparison(condition->type))
+        return false;
+    Expression *fst = condition->value.binary.fst;
+    Expression *snd = condition->value.binary.snd;
+    for (size_t i = 0; i < func->arglen; i++) {
+        if ((func->args[i].type != INT) ||
+            (is_variable(call->value.function_call.args[i],
+                         func->args[i].name)))
+            continue;
+        if (is_variable(fst, func->args[i].name)) {
+            reduction->counter = i;
+            reduction->limit = snd;
+            reduction->comparison = condition->type;
+            return true;
+        }
+        if (is_variable(snd, func->args[i].name)) {
+            reduction->counter = i;
+            reduction->limit = fst;
+            reduction->comparison = swapped_comparison(condition->type);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Splits arg, passed for the argument name, into name op other */
+static Expression *other_operand(Expression *arg, const char *name) {
+    if (is_variable(arg->value.binary.fst, name))
+        return arg->value.binary.snd;
+    if (is_variable(arg->value.binary.snd, name))
+        return arg->value.binary.fst;
+    return NULL;
+}
+
+/* Fills reduction if func has its shape */
+static bool match_reduction(Function *func, Reduction *reduction) {
+    Expression *body = func->expression;
+    if (body->type != IF_EXPRESSION)
+        return false;
+
+    Expression *call = body->value.if_statement.no;
+    reduction->base = body->value.if_statement.yes;
+    bool negated = false;
+    if (!is_recursive_call(call, func)) {
+        call = body->value.if_statement.yes;
+        reduction->base = body->value.if_statement.no;
+        negated = true;
+    }
+    if ((!is_recursive_call(call, func)) ||
+        (!match_condition(func, body->value.if_statement.condition, call,
+                          reduction)))
+        return false;
+    if (negated)
+        reduction->comparison = negated_comparison(reduction->comparison);
+
+    const char *counter = func->args[reduction->counter].name;
+    bool accumulator_found = false;
+    for (size_t i = 0; i < func->arglen; i++) {
+        Expression *arg = call->value.function_call.args[i];
+        const char *name = func->args[i].name;
+        if ((i != reduction->counter) && (is_variable(arg, name)))
+            continue;
+
+        if (i == reduction->counter) {
+            if ((arg->type != PLUS_EXPRESSION) ||
+                (!(reduction->step = other_operand(arg, name))))
+                return false;
+        } else if ((!accumulator_found) &&
+                   (is_associative(arg->type, func->args[i].type)) &&
+                   (reduction->operand = other_operand(arg, name))) {
+            /* chunks evaluate every operand, while acc && operand skips
+             * them once acc is false */
+            if ((func->args[i].type == BOOL) &&
+                (arg->value.binary.fst != reduction->operand) &&
+                (may_fail(reduction->operand)))
+                return false;
+            accumulator_found = true;
+            reduction->accumulator = i;
+            reduction->op = arg->type;
+        } else {
+            return false;
+        }
+    }
+    if (!accumulator_found)
+        return false;
+
+    /* the operand is all that changes between calls besides the counter */
+    const char *accumulator = func->args[reduction->accumulator].name;
+    return (!uses_variable(reduction->operand, accumulator)) &&
+           (!uses_variable(reduction->step, counter)) &&
+           (!uses_variable(reduction->step, accumulator)) &&
+           (!uses_variable(reduction->limit, counter)) &&
+           (!uses_variable(reduction->limit, accumulator));
+}
+
+/* Runs on a verified program */
+void find_reductions() {
+    double start = trace_begin();
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if ((tree->type != AST_FUNCTION) || (!tree->semantically_correct) ||
+            (!tree->value.func->expression))
+            continue;
+
+        Reduction reduction;
+        if (!match_reduction(tree->value.func, &reduction))
+            continue;
+        tree->value.func->reduction = arena_alloc(tree->arena,
+                                                  sizeof(Reduction));
+        if (tree->value.func->reduction)
+            *tree->value.func->reduction = reduction;
+    }
+    trace_end("phase", "find reductions", start);
+}
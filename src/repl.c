@@ -0,0 +1,195 @@
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+void *yy_scan_string(const char *);
+void yy_delete_buffer(void *);
+
+/* Runs a line starting with ':' */
+static void run_command(const char *input) {
+    char path[512];
+    if (sscanf(input, ":save %511[^\n]", path) == 1) {
+        /* up to the trailing blanks */
+        size_t length = strlen(path);
+        while ((length) && ((path[length - 1] == ' ') ||
+                            (path[length - 1] == '\t') ||
+                            (path[length - 1] == '\r')))
+            path[--length] = 0;
+        if (save_snapshot(path))
+            printf("Saved %zu definitions to \"%s\"\n", ast_table_size(ast),
+                   path);
+        return;
+    }
+    fprintf(stderr, "Unknown command \"%.*s\"\n",
+            (int)strcspn(input, "\n"), input);
+}
+
+static const char *repl_prompt = "";
+
+/* Parses an input, which evaluates its expressions and adds its
+ * definitions, then prompts for the next one */
+static void evaluate_input(const char *input) {
+    if (input[0] == ':') {
+        run_command(input);
+    } else {
+        filename = "<input>";
+        void *buffer = yy_scan_string(input);
+        if (yyparse())
+            fprintf(stderr, "%s\n", syntax_error_msg);
+        yy_delete_buffer(buffer);
+        discard_node_arena();
+    }
+    printf("%s", repl_prompt);
+    fflush(stdout);
+}
+
+/* Unless a snapshot was restored into them */
+static void create_repl_tables() {
+    if (ast)
+        return;
+    ast = ast_table_new(100);
+    globalBooleans = boolean_table_new(100);
+    globalIntegers = integer_table_new(100);
+}
+
+#ifdef _WIN32
+
+void start_repl_evaluator(const char *prompt) {
+    repl_prompt = prompt;
+    create_repl_tables();
+}
+
+void evaluate_repl_input(const char *input) { evaluate_input(input); }
+
+void wait_repl_inputs() {}
+
+#else
+
+#include <pthread.h>
+#include <signal.h>
+
+/* Evaluation recurses on every call, so the evaluator gets a deeper stack
+ * than threads do by default */
+#define REPL_STACK_SIZE (64 << 20)
+
+typedef struct _ReplInput {
+    struct _ReplInput *next;
+    char text[];
+} ReplInput;
+
+/* Inputs waiting for the evaluator, oldest first. The definitions live in
+ * the thread local tables of the evaluator, so it is the only thread that
+ * parses. */
+static ReplInput *first_input;
+static ReplInput *last_input;
+static size_t pending_inputs;
+static bool evaluator_started;
+
+static pthread_mutex_t repl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t input_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t inputs_done = PTHREAD_COND_INITIALIZER;
+
+typedef struct {
+    ast_table_t *ast;
+    integer_table_t *globalIntegers;
+    boolean_table_t *globalBooleans;
+    size_t next_definition_index;
+} ReplTables;
+
+static void *repl_evaluator(void *arg) {
+    ReplTables *tables = arg;
+    ast = tables->ast;
+    globalIntegers = tables->globalIntegers;
+    globalBooleans = tables->globalBooleans;
+    set_next_definition_index(tables->next_definition_index);
+
+    pthread_mutex_lock(&repl_lock);
+    while (true) {
+        while (!first_input)
+            pthread_cond_wait(&input_ready, &repl_lock);
+        ReplInput *input = first_input;
+        first_input = input->next;
+        if (!first_input)
+            last_input = NULL;
+        /* what interrupted the inputs before ends here; from now on, a
+         * Ctrl-C cancels this one, its parsing included */
+        clear_interruption();
+        pthread_mutex_unlock(&repl_lock);
+
+        evaluate_input(input->text);
+        tracked_free(input);
+
+        pthread_mutex_lock(&repl_lock);
+        if (--pending_inputs == 0)
+            pthread_cond_broadcast(&inputs_done);
+    }
+    return NULL;
+}
+
+/* Cancels the input being evaluated, the evaluator clears the interruption
+ * as it takes the next one */
+static void interrupt_repl_evaluation(int signal) { interrupt_execution(); }
+
+/* Inputs are evaluated where they are read when no thread can be started */
+void start_repl_evaluator(const char *prompt) {
+    repl_prompt = prompt;
+    /* the tables are made here and handed over to the evaluator */
+    create_repl_tables();
+    static ReplTables tables;
+    tables = (ReplTables){.ast = ast,
+                          .globalIntegers = globalIntegers,
+                          .globalBooleans = globalBooleans,
+                          .next_definition_index = next_definition_index()};
+
+    pthread_attr_t attributes;
+    pthread_t thread;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, REPL_STACK_SIZE);
+    evaluator_started =
+        !pthread_create(&thread, &attributes, repl_evaluator, &tables);
+    pthread_attr_destroy(&attributes);
+    if (!evaluator_started)
+        return;
+    pthread_detach(thread);
+
+    /* reading input goes on after the handler returns */
+    struct sigaction action = {.sa_handler = interrupt_repl_evaluation,
+                               .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+}
+
+void evaluate_repl_input(const char *input) {
+    if (!evaluator_started) {
+        evaluate_input(input);
+        return;
+    }
+    size_t length = strlen(input);
+    ReplInput *queued =
+        tracked_malloc(MEMORY_LEXER, sizeof(ReplInput) + length + 1);
+    if (!queued) {
+        fprintf(stderr, "Memory Error\n");
+        return;
+    }
+    memcpy(queued->text, input, length + 1);
+    queued->next = NULL;
+
+    pthread_mutex_lock(&repl_lock);
+    if (last_input)
+        last_input->next = queued;
+    else
+        first_input = queued;
+    last_input = queued;
+    pending_inputs++;
+    pthread_cond_signal(&input_ready);
+    pthread_mutex_unlock(&repl_lock);
+}
+
+void wait_repl_inputs() {
+    pthread_mutex_lock(&repl_lock);
+    while (pending_inputs)
+        pthread_cond_wait(&inputs_done, &repl_lock);
+    pthread_mutex_unlock(&repl_lock);
+}
+
+#endif
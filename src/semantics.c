@@ -1,4 +1,6 @@
 #include "common.h"
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -17,31 +19,267 @@ bool verify_function_call_arguments(Function *func, Expression **args,
 bool verify_expression_type(Expression *exp, Type type, Context *cxt);
 bool verify_ast_semantics(AST *tree);
 
-char semantic_error_msg[ERROR_MSG_LEN] = {0};
+_Thread_local char semantic_error_msg[ERROR_MSG_LEN] = {0};
+
+size_t hash_function(const char *str);
+
+DS_TABLE_DEC(reachable, bool);
+DS_TABLE_DEF(reachable, bool, clean_boolean);
+
+/* Definitions found reachable, whose own references are still to be visited */
+typedef struct {
+    size_t len;
+    size_t capacity;
+    AST **trees;
+} Worklist;
+
+/* Definitions verified in parallel, in source order */
+typedef struct {
+    ast_table_t *ast;
+    AST **trees;
+    char **errors;
+    atomic_size_t first_error; /* lowest index that failed so far */
+} Verification;
+
+static char *copy_error_msg(const char *msg) {
+    size_t len = strlen(msg) + 1;
+    char *copy = tracked_malloc(MEMORY_INTERPRETER, len);
+    if (copy)
+        memcpy(copy, msg, len);
+    return copy;
+}
+
+static void verify_definition(size_t index, void *data) {
+    Verification *verification = data;
+    /* An earlier definition failed, so this error would not be reported */
+    if (index > atomic_load(&verification->first_error))
+        return;
+
+    ast = verification->ast;
+    if (verify_ast_semantics(verification->trees[index]))
+        return;
+
+    verification->errors[index] = copy_error_msg(semantic_error_msg);
+    size_t first_error = atomic_load(&verification->first_error);
+    while ((index < first_error) &&
+           (!atomic_compare_exchange_weak(&verification->first_error,
+                                          &first_error, index)))
+        ;
+}
+
+static int compare_definition_index(const void *a, const void *b) {
+    size_t fst = (*(AST *const *)a)->definition_index;
+    size_t snd = (*(AST *const *)b)->definition_index;
+    return (fst > snd) - (fst < snd);
+}
 
 // TODO: improve error message with line number
 
+/* Verifies every definition in parallel, reporting the first error in
+ * source order */
 bool verify_semantics() {
+    size_t len = 0;
+    size_t size = ast_table_size(ast);
+    AST **trees = tracked_malloc(MEMORY_INTERPRETER, size * sizeof(AST *) + 1);
+    char **errors =
+        tracked_calloc(MEMORY_INTERPRETER, size + 1, sizeof(char *));
+    if ((!trees) || (!errors)) {
+        tracked_free(trees);
+        tracked_free(errors);
+        snprintf(semantic_error_msg, ERROR_MSG_LEN, "Memory Error");
+        return false;
+    }
+
     char *key;
     AST *tree;
     ast_table_iter(ast);
-
     while (NULL != (tree = ast_table_iter_next(ast, &key))) {
-        if (tree->semantically_correct)
-            continue;
-        if (!verify_ast_semantics(tree))
+        if (!tree->semantically_correct)
+            trees[len++] = tree;
+    }
+    qsort(trees, len, sizeof(AST *), compare_definition_index);
+
+    /* The parser is not reentrant, so deferred bodies are parsed first */
+    size_t count = len;
+    double start = trace_begin();
+    for (size_t i = 0; i < len; i++) {
+        Function *func = trees[i]->value.func;
+        if ((trees[i]->type == AST_FUNCTION) && (!func->expression) &&
+            (!parse_function_body(func, trees[i]->arena))) {
+            errors[i] = copy_error_msg(syntax_error_msg);
+            count = i;
+            break;
+        }
+    }
+    trace_end("phase", "parse deferred bodies", start);
+
+    Verification verification = {
+        .ast = ast, .trees = trees, .errors = errors, .first_error = count};
+    parallel_for(count, verify_definition, &verification);
+
+    size_t first_error = atomic_load(&verification.first_error);
+    if (first_error < len)
+        snprintf(semantic_error_msg, ERROR_MSG_LEN, "%s",
+                 errors[first_error] ? errors[first_error] : "Memory Error");
+
+    for (size_t i = 0; i < len; i++) {
+        tracked_free(errors[i]);
+    }
+    tracked_free(errors);
+    tracked_free(trees);
+    return first_error == len;
+}
+
+static bool reach(const char *name, reachable_table_t *reached,
+                  Worklist *worklist) {
+    if (reachable_table_get_ptr(reached, name))
+        return true;
+    errno = 0;
+
+    AST *tree = ast_table_get_ptr(ast, name);
+    errno = 0;
+    if (!tree)
+        return true; /* reported by the verification of the referrer */
+
+    if (worklist->len == worklist->capacity) {
+        size_t capacity = worklist->capacity ? worklist->capacity * 2 : 64;
+        AST **trees = tracked_realloc(MEMORY_INTERPRETER, worklist->trees,
+                                      capacity * sizeof(AST *));
+        if (!trees) {
+            snprintf(semantic_error_msg, ERROR_MSG_LEN, "Memory Error");
             return false;
+        }
+        worklist->trees = trees;
+        worklist->capacity = capacity;
     }
 
-    return true;
+    worklist->trees[worklist->len++] = tree;
+    return reachable_table_insert(reached, name, true);
 }
 
+static bool reach_references(Expression *exp, reachable_table_t *reached,
+                             Worklist *worklist) {
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return true;
+    case VARIABLE_EXPRESSION:
+        /* arguments are not in ast, so only globals get reached */
+        return reach(exp->value.variable, reached, worklist);
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        return reach_references(exp->value.unary.fst, reached, worklist);
+    case IF_EXPRESSION:
+        return reach_references(exp->value.if_statement.condition, reached,
+                                worklist) &&
+               reach_references(exp->value.if_statement.yes, reached,
+                                worklist) &&
+               reach_references(exp->value.if_statement.no, reached,
+                                worklist);
+    case FUNCTION_CALL_EXPRESSION:
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            if (!reach_references(exp->value.function_call.args[i], reached,
+                                  worklist))
+                return false;
+        }
+        return reach(exp->value.function_call.funcname, reached, worklist);
+    default:
+        return reach_references(exp->value.binary.fst, reached, worklist) &&
+               reach_references(exp->value.binary.snd, reached, worklist);
+    }
+}
+
+bool verify_reachable_semantics(const char *entry) {
+    AST *entry_tree = ast_table_get_ptr(ast, entry);
+    errno = 0;
+    if (!entry_tree) {
+        snprintf(semantic_error_msg, ERROR_MSG_LEN,
+                 "Could not find '%s' function", entry);
+        return false;
+    }
+
+    bool result = false;
+    Worklist worklist = {0};
+    reachable_table_t *reached = reachable_table_new(ast_table_size(ast) + 1);
+    if ((!reached) || (!reach(entry, reached, &worklist)))
+        goto cleanup;
+
+    while (worklist.len) {
+        AST *tree = worklist.trees[--worklist.len];
+        if (!verify_ast_semantics(tree))
+            goto cleanup;
+
+        Expression *exp = tree->type == AST_FUNCTION
+                              ? tree->value.func->expression
+                              : tree->value.var->expression;
+        /* an imported declaration, whose body comes with what it refers to */
+        if ((exp) && (!reach_references(exp, reached, &worklist)))
+            goto cleanup;
+    }
+
+    /* Drop everything that was not reached, so it is neither kept nor
+     * evaluated at runtime */
+    size_t unreachable_len = 0;
+    const char **unreachable = tracked_malloc(
+        MEMORY_INTERPRETER, ast_table_size(ast) * sizeof(const char *) + 1);
+    if (!unreachable) {
+        snprintf(semantic_error_msg, ERROR_MSG_LEN, "Memory Error");
+        goto cleanup;
+    }
+
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if (!reachable_table_get_ptr(reached, key))
+            unreachable[unreachable_len++] = key;
+    }
+    for (size_t i = 0; i < unreachable_len; i++) {
+        ast_table_delete(ast, unreachable[i]);
+    }
+    errno = 0;
+    tracked_free(unreachable);
+    result = true;
+
+cleanup:
+    tracked_free(worklist.trees);
+    if (reached)
+        reachable_table_clear(reached);
+    return result;
+}
+
+static const char *definition_name(AST *tree) {
+    switch (tree->type) {
+    case AST_FUNCTION:
+        return tree->value.func->funcname;
+    case AST_VARIABLE:
+        return tree->value.var->name;
+    default:
+        return "expression";
+    }
+}
+
+static bool verify_tree(AST *tree);
+
 bool verify_ast_semantics(AST *tree) {
     if (tree->semantically_correct)
         return true;
 
+    double start = trace_begin();
+    bool verified = verify_tree(tree);
+    trace_end("verify", definition_name(tree), start);
+    return verified;
+}
+
+static bool verify_tree(AST *tree) {
     switch (tree->type) {
     case AST_FUNCTION:
+        if ((!tree->value.func->expression) &&
+            (!parse_function_body(tree->value.func, tree->arena))) {
+            snprintf(semantic_error_msg, ERROR_MSG_LEN, "%s",
+                     syntax_error_msg);
+            return false;
+        }
         if (!verify_function_semantics(tree->value.func)) {
             return false;
         }
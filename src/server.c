@@ -0,0 +1,568 @@
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+int server_interpretation(const char *socket_path, size_t workers,
+                          size_t cache_size, bool optimize, bool lazy_args,
+                          bool fuse) {
+    fprintf(stderr, "Server mode is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define ERROR_MSG_LEN 500
+#define RESPONSE_LEN (ERROR_MSG_LEN + 100)
+#define MAX_FUNCTION_INPUTS 64
+#define MAX_SOURCE_LENGTH (64 << 20)
+/* Without --max-depth, deeper calls fail rather than overflow the stack of
+ * a worker and end every other request with it */
+#define WORKER_STACK_SIZE (256 << 20)
+#define DEFAULT_MAX_DEPTH 100000
+/* Of the threads reading connections, which only wait on their client */
+#define CONNECTION_STACK_SIZE (256 << 10)
+
+/*
+ * Protocol: one request per line, one response line per request.
+ *
+ *   LOAD <length>\n<source>                  -> OK <hash>
+ *   CALL <hash> <function> [inputs...]\n     -> OK <value> | MISSING <hash>
+ *   RUN <length> <function> [inputs...]\n<source> -> OK <value>
+ *
+ * Any failure is reported as "ERROR <message>". Inputs are integers or
+ * true/false. A connection can send any number of requests.
+ *
+ * Every connection has a thread reading its requests, which hands them to
+ * the workers one at a time, so that idle clients do not hold a worker.
+ */
+
+size_t hash_function(const char *str);
+
+/* A verified program with its globals evaluated, ready to serve calls */
+typedef struct _Program Program;
+
+struct _Program {
+    char hash[33];
+    char *source; /* to tell programs apart whose hashes collide */
+    size_t length;
+    bool uncached; /* as another program is cached under its hash */
+    ast_table_t *ast;
+    integer_table_t *globalIntegers;
+    boolean_table_t *globalBooleans;
+    InternPool *names; /* of the program, freed with it */
+    size_t references; /* one for the cache, one for each call in flight */
+    Program *newer;
+    Program *older;
+};
+
+static inline void clean_program(Program *program) {}
+
+DS_TABLE_DEC(program, Program *);
+DS_TABLE_DEF(program, Program *, clean_program);
+
+static program_table_t *programs;
+static Program *newest_program;
+static Program *oldest_program;
+static size_t max_cached_programs;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool optimize_programs;
+static bool lazy_arguments;
+static bool fuse_programs;
+
+/* A request read from a connection, waiting for a worker */
+typedef struct _Request {
+    struct _Request *next;
+    char **words;
+    size_t word_count;
+    char *source; /* of a LOAD or RUN */
+    size_t length;
+    char response[RESPONSE_LEN];
+    bool done;
+} Request;
+
+static Request *first_request;
+static Request *last_request;
+static pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t request_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t request_done = PTHREAD_COND_INITIALIZER;
+
+static void free_program(Program *program) {
+    ast_table_clear(program->ast);
+    integer_table_clear(program->globalIntegers);
+    boolean_table_clear(program->globalBooleans);
+    intern_pool_free(program->names);
+    tracked_free(program->source);
+    tracked_free(program);
+}
+
+static void unlink_program(Program *program) {
+    if (program->newer)
+        program->newer->older = program->older;
+    else
+        newest_program = program->older;
+    if (program->older)
+        program->older->newer = program->newer;
+    else
+        oldest_program = program->newer;
+    program->newer = program->older = NULL;
+}
+
+static void push_newest_program(Program *program) {
+    program->older = newest_program;
+    program->newer = NULL;
+    if (newest_program)
+        newest_program->newer = program;
+    newest_program = program;
+    if (!oldest_program)
+        oldest_program = program;
+}
+
+/* The cached program under hash, with a reference taken, or NULL. Must
+ * hold cache_lock. */
+static Program *take_cached_program(const char *hash) {
+    Program **entry = program_table_get_ptr(programs, hash);
+    errno = 0;
+    Program *program = entry ? *entry : NULL;
+    if (program) {
+        unlink_program(program);
+        push_newest_program(program);
+        program->references++;
+    }
+    return program;
+}
+
+static Program *acquire_program(const char *hash) {
+    pthread_mutex_lock(&cache_lock);
+    Program *program = take_cached_program(hash);
+    pthread_mutex_unlock(&cache_lock);
+    return program;
+}
+
+static void release_program(Program *program) {
+    pthread_mutex_lock(&cache_lock);
+    bool unused = --program->references == 0;
+    pthread_mutex_unlock(&cache_lock);
+    if (unused)
+        free_program(program);
+}
+
+static inline bool same_source(Program *program, const char *source,
+                               size_t len) {
+    return (program->length == len) && (!memcmp(program->source, source, len));
+}
+
+/* Caches program, or returns the program of the same source that another
+ * worker cached while it compiled. A program colliding with a cached one is
+ * returned uncached. */
+static Program *cache_program(Program *program) {
+    pthread_mutex_lock(&cache_lock);
+    Program *cached = take_cached_program(program->hash);
+    if ((cached) && (same_source(cached, program->source, program->length))) {
+        pthread_mutex_unlock(&cache_lock);
+        free_program(program);
+        return cached;
+    }
+    if (cached) {
+        cached->references--;
+        program->uncached = true;
+        program->references = 1;
+        pthread_mutex_unlock(&cache_lock);
+        return program;
+    }
+
+    program->references = 2; /* the cache and the caller */
+    program_table_insert(programs, program->hash, program);
+    push_newest_program(program);
+
+    while (program_table_size(programs) > max_cached_programs) {
+        Program *evicted = oldest_program;
+        unlink_program(evicted);
+        program_table_delete(programs, evicted->hash);
+        if (--evicted->references == 0)
+            free_program(evicted);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return program;
+}
+
+/* source must be followed by two NUL bytes, it is scanned in place */
+static Program *compile_program(char *source, size_t len, char *error) {
+    char hash[33];
+    snprintf(hash, sizeof(hash), "%016" PRIx64 "%016" PRIx64,
+             content_hash(source, len), word_hash(source, len));
+
+    Program *program = acquire_program(hash);
+    if ((program) && (same_source(program, source, len)))
+        return program;
+    if (program)
+        release_program(program);
+
+    /* the fast lexer keeps its state on the stack of the worker, so
+     * programs compile in parallel */
+    filename = "<request>";
+    ast = ast_table_new(100);
+    globalIntegers = NULL;
+    globalBooleans = NULL;
+    intern_pool = intern_pool_new();
+    char *copy = tracked_malloc(MEMORY_INTERPRETER, len + 1);
+    if ((!ast) || (!intern_pool) || (!copy)) {
+        snprintf(error, ERROR_MSG_LEN, "Memory Error");
+        goto error;
+    }
+    memcpy(copy, source, len);
+
+    if (parse_buffer_at(source, len, 1, 1, 0)) {
+        snprintf(error, ERROR_MSG_LEN, "%s", syntax_error_msg);
+        goto error;
+    }
+    if (!verify_semantics()) {
+        snprintf(error, ERROR_MSG_LEN, "Semantic Error: %s",
+                 semantic_error_msg);
+        goto error;
+    }
+    if (optimize_programs)
+        optimize_program();
+    if (lazy_arguments)
+        analyze_strictness();
+    if (fuse_programs)
+        fuse_program();
+    if (!initialize_globals()) {
+        snprintf(error, ERROR_MSG_LEN, "Runtime Error: %s", runtime_error_msg);
+        goto error;
+    }
+
+    program = tracked_calloc(MEMORY_INTERPRETER, 1, sizeof(Program));
+    if (!program) {
+        snprintf(error, ERROR_MSG_LEN, "Memory Error");
+        goto error;
+    }
+    memcpy(program->hash, hash, sizeof(hash));
+    program->source = copy;
+    program->length = len;
+    program->ast = ast;
+    program->globalIntegers = globalIntegers;
+    program->globalBooleans = globalBooleans;
+    program->names = intern_pool;
+    intern_pool = NULL;
+    return cache_program(program);
+
+error:
+    /* made by initialize_globals when it ran */
+    if (globalIntegers)
+        integer_table_clear(globalIntegers);
+    if (globalBooleans)
+        boolean_table_clear(globalBooleans);
+    if (ast)
+        ast_table_clear(ast);
+    intern_pool_free(intern_pool);
+    intern_pool = NULL;
+    tracked_free(copy);
+    return NULL;
+}
+
+/* Reads input as a value of type: true or false, or a whole int */
+static bool parse_input(const char *input, Type type, int *value) {
+    if (type == BOOL) {
+        *value = !strcmp(input, "true");
+        return (*value) || (!strcmp(input, "false"));
+    }
+    char *end;
+    errno = 0;
+    long number = strtol(input, &end, 10);
+    if ((end == input) || (*end) || (errno == ERANGE) ||
+        (number < INT_MIN) || (number > INT_MAX)) {
+        errno = 0;
+        return false;
+    }
+    *value = (int)number;
+    return true;
+}
+
+static void call_program(Program *program, const char *funcname,
+                         char **inputs, size_t len, char *response) {
+    ast = program->ast;
+    globalIntegers = program->globalIntegers;
+    globalBooleans = program->globalBooleans;
+
+    /* a missing function or a wrong count is reported by
+     * interpret_function */
+    AST *tree = ast_table_get_ptr(ast, funcname);
+    errno = 0;
+    int values[MAX_FUNCTION_INPUTS];
+    for (size_t i = 0; (tree) && (tree->type == AST_FUNCTION) &&
+                       (tree->value.func->arglen == len) && (i < len);
+         i++) {
+        /* args are stored in reverse order of their declaration */
+        Type type = tree->value.func->args[len - 1 - i].type;
+        if (!parse_input(inputs[i], type, values + i)) {
+            snprintf(response, RESPONSE_LEN,
+                     "ERROR Invalid input \"%s\", expected %s", inputs[i],
+                     type == INT ? "an int" : "true or false");
+            return;
+        }
+    }
+
+    int output;
+    if (!interpret_function(funcname, values, len, &output)) {
+        snprintf(response, RESPONSE_LEN, "ERROR Runtime Error: %s",
+                 runtime_error_msg);
+        return;
+    }
+
+    if (ast_table_get(ast, funcname).value.func->return_type == BOOL)
+        snprintf(response, RESPONSE_LEN, "OK %s", output ? "true" : "false");
+    else
+        snprintf(response, RESPONSE_LEN, "OK %d", output);
+}
+
+/* Fills in the response of request, on a worker */
+static void handle_request(Request *request) {
+    char **words = request->words;
+    char error[ERROR_MSG_LEN];
+    Program *program;
+    if (!strcmp(words[0], "CALL")) {
+        program = acquire_program(words[1]);
+        if (!program) {
+            snprintf(request->response, RESPONSE_LEN, "MISSING %s", words[1]);
+            return;
+        }
+    } else {
+        program = compile_program(request->source, request->length, error);
+        if (!program) {
+            snprintf(request->response, RESPONSE_LEN, "ERROR %s", error);
+            return;
+        }
+    }
+
+    if (!strcmp(words[0], "LOAD")) {
+        if (program->uncached)
+            snprintf(request->response, RESPONSE_LEN,
+                     "ERROR Another program is cached under hash %s",
+                     program->hash);
+        else
+            snprintf(request->response, RESPONSE_LEN, "OK %s", program->hash);
+    } else {
+        call_program(program, words[2], words + 3, request->word_count - 3,
+                     request->response);
+    }
+    release_program(program);
+}
+
+static void *serve_requests(void *arg) {
+    pthread_mutex_lock(&request_lock);
+    while (true) {
+        while (!first_request)
+            pthread_cond_wait(&request_ready, &request_lock);
+        Request *request = first_request;
+        first_request = request->next;
+        if (!first_request)
+            last_request = NULL;
+        pthread_mutex_unlock(&request_lock);
+
+        handle_request(request);
+
+        pthread_mutex_lock(&request_lock);
+        request->done = true;
+        pthread_cond_broadcast(&request_done);
+    }
+    return NULL;
+}
+
+/* Queues request for the workers and waits for its response */
+static void submit_request(Request *request) {
+    pthread_mutex_lock(&request_lock);
+    if (last_request)
+        last_request->next = request;
+    else
+        first_request = request;
+    last_request = request;
+    pthread_cond_signal(&request_ready);
+    while (!request->done)
+        pthread_cond_wait(&request_done, &request_lock);
+    pthread_mutex_unlock(&request_lock);
+}
+
+/* Reads length, which a client sends, as the length of a source */
+static bool parse_length(const char *length, size_t *len) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(length, &end, 10);
+    if ((end == length) || (*end) || (errno == ERANGE) ||
+        (length[0] == '-') || (value > MAX_SOURCE_LENGTH)) {
+        errno = 0;
+        return false;
+    }
+    *len = value;
+    return true;
+}
+
+static char *read_source(FILE *in, size_t len) {
+    char *source = tracked_malloc(MEMORY_LEXER, len + 2);
+    if (!source)
+        return NULL;
+    if (fread(source, 1, len, in) != len) {
+        tracked_free(source);
+        return NULL;
+    }
+    source[len] = source[len + 1] = 0;
+    return source;
+}
+
+static void *serve_client(void *arg) {
+    int client = (int)(intptr_t)arg;
+    FILE *in = fdopen(client, "r");
+    FILE *out = fdopen(dup(client), "w");
+    if ((!in) || (!out)) {
+        if (in)
+            fclose(in);
+        else
+            close(client);
+        if (out)
+            fclose(out);
+        return NULL;
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+
+    while (getline(&line, &line_capacity, in) > 0) {
+        char *words[MAX_FUNCTION_INPUTS + 3];
+        size_t word_count = 0;
+        char *saveptr;
+        for (char *word = strtok_r(line, " \t\r\n", &saveptr);
+             word && (word_count < MAX_FUNCTION_INPUTS + 3);
+             word = strtok_r(NULL, " \t\r\n", &saveptr)) {
+            words[word_count++] = word;
+        }
+        if (!word_count)
+            continue;
+
+        Request request = {.words = words, .word_count = word_count};
+        bool with_source = ((!strcmp(words[0], "LOAD")) && (word_count == 2)) ||
+                           ((!strcmp(words[0], "RUN")) && (word_count >= 3));
+        if (with_source) {
+            if (!parse_length(words[1], &request.length)) {
+                /* the source that follows can not be skipped */
+                fprintf(out, "ERROR Invalid source length, at most %d "
+                             "bytes\n", MAX_SOURCE_LENGTH);
+                break;
+            }
+            request.source = read_source(in, request.length);
+            if (!request.source) {
+                fprintf(out, "ERROR Could not read program source\n");
+                break;
+            }
+        }
+
+        if ((with_source) || ((!strcmp(words[0], "CALL")) && (word_count >= 3)))
+            submit_request(&request);
+        else
+            snprintf(request.response, RESPONSE_LEN, "ERROR Invalid request");
+        tracked_free(request.source);
+        fprintf(out, "%s\n", request.response);
+        fflush(out);
+    }
+
+    free(line);
+    fclose(out);
+    fclose(in);
+    return NULL;
+}
+
+/* Starts a thread reading each connection, on the thread calling it */
+static void accept_connections(int server_fd) {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, CONNECTION_STACK_SIZE);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    while (true) {
+        int client = accept(server_fd, NULL, NULL);
+        if (client < 0) {
+            if (errno != EINTR)
+                perror("accept");
+            continue;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, serve_client,
+                           (void *)(intptr_t)client)) {
+            fprintf(stderr, "Could not start a thread for a connection\n");
+            close(client);
+        }
+    }
+}
+
+int server_interpretation(const char *socket_path, size_t workers,
+                          size_t cache_size, bool optimize, bool lazy_args,
+                          bool fuse) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    unlink(socket_path);
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) ||
+        listen(server_fd, 64)) {
+        fprintf(stderr, "Could not listen on \"%s\"\n", socket_path);
+        close(server_fd);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    max_cached_programs = cache_size;
+    programs = program_table_new(cache_size * 2 + 1);
+    optimize_programs = optimize;
+    lazy_arguments = lazy_args;
+    fuse_programs = fuse;
+
+    ExecutionBudget budget = get_execution_budget();
+    if (!budget.max_depth) {
+        budget.max_depth = DEFAULT_MAX_DEPTH;
+        set_execution_budget(budget);
+    }
+
+    pthread_attr_t attributes;
+    if ((!programs) || (pthread_attr_init(&attributes)) ||
+        (pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE))) {
+        fprintf(stderr, "Memory Error\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Listening on %s with %zu workers\n", socket_path,
+            workers);
+
+    for (size_t i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, serve_requests, NULL)) {
+            fprintf(stderr, "Could not start worker %zu\n", i);
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    pthread_attr_destroy(&attributes);
+
+    accept_connections(server_fd);
+    close(server_fd);
+    return 0;
+}
+
+#endif
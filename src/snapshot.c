@@ -0,0 +1,356 @@
+#include "common.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC 0x3250414e534b /* "KSNAP2" */
+/* Written instead of an expression type for a function without a body */
+#define NO_EXPRESSION 0xff
+
+/*
+ * File layout: a header, then every definition with its verification status
+ * and, for a variable, its evaluated value. Expressions are written in
+ * prefix order. Names are written out and interned again when restored, so
+ * the snapshot does not depend on the process that wrote it.
+ */
+typedef struct {
+    uint64_t magic;
+    uint64_t definition_count;
+    uint64_t checksum; /* of everything after the header */
+} SnapshotHeader;
+
+void put_bytes(Writer *writer, const void *data, size_t size) {
+    if (writer->length + size > writer->capacity) {
+        size_t capacity = writer->capacity ? writer->capacity * 2 : 4096;
+        while (capacity < writer->length + size)
+            capacity *= 2;
+        char *grown = tracked_realloc(MEMORY_INTERPRETER, writer->data,
+                                      capacity);
+        if (!grown) {
+            writer->failed = true;
+            return;
+        }
+        writer->data = grown;
+        writer->capacity = capacity;
+    }
+    memcpy(writer->data + writer->length, data, size);
+    writer->length += size;
+}
+
+void put_expression(Writer *writer, Expression *exp) {
+    if (!exp) {
+        put_byte(writer, NO_EXPRESSION);
+        return;
+    }
+    put_byte(writer, exp->type);
+    put_int(writer, exp->line);
+    put_int(writer, exp->column);
+    put_int(writer, exp->end_line);
+    put_int(writer, exp->end_column);
+
+    switch (exp->type) {
+    case UNDEFINED:
+        return;
+    case INTEGER_EXPRESSION:
+        put_int(writer, exp->value.integer);
+        return;
+    case BOOLEAN_EXPRESSION:
+        put_byte(writer, exp->value.boolean);
+        return;
+    case VARIABLE_EXPRESSION:
+        put_string(writer, exp->value.variable);
+        return;
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        put_expression(writer, exp->value.unary.fst);
+        return;
+    case IF_EXPRESSION:
+        put_expression(writer, exp->value.if_statement.condition);
+        put_expression(writer, exp->value.if_statement.yes);
+        put_expression(writer, exp->value.if_statement.no);
+        return;
+    case FUNCTION_CALL_EXPRESSION:
+        put_string(writer, exp->value.function_call.funcname);
+        put_size(writer, exp->value.function_call.arglen);
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            put_expression(writer, exp->value.function_call.args[i]);
+        }
+        return;
+    default:
+        put_expression(writer, exp->value.binary.fst);
+        put_expression(writer, exp->value.binary.snd);
+        return;
+    }
+}
+
+static void put_definition(Writer *writer, AST *tree) {
+    put_byte(writer, tree->type);
+    put_byte(writer, tree->semantically_correct);
+    put_size(writer, tree->definition_index);
+
+    if (tree->type == AST_FUNCTION) {
+        Function *func = tree->value.func;
+        put_string(writer, func->funcname);
+        put_byte(writer, func->return_type);
+        put_size(writer, func->arglen);
+        for (size_t i = 0; i < func->arglen; i++) {
+            put_string(writer, func->args[i].name);
+            put_byte(writer, func->args[i].type);
+        }
+        put_expression(writer, func->expression);
+        return;
+    }
+
+    Variable *var = tree->value.var;
+    put_string(writer, var->name);
+    put_byte(writer, var->type);
+    put_expression(writer, var->expression);
+
+    /* a variable whose evaluation failed has no value */
+    int *integer = integer_table_get_ptr(globalIntegers, var->name);
+    errno = 0;
+    bool *boolean = boolean_table_get_ptr(globalBooleans, var->name);
+    errno = 0;
+    put_byte(writer, (integer) || (boolean));
+    put_int(writer, integer ? *integer : boolean ? *boolean : 0);
+}
+
+/* Saves the definitions of the REPL session and the values of its globals
+ * to path */
+bool save_snapshot(const char *path) {
+    Writer writer = {0};
+    SnapshotHeader header = {.magic = SNAPSHOT_MAGIC};
+    put_bytes(&writer, &header, sizeof(header));
+
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if (tree->type == AST_EXPRESSION)
+            continue;
+        put_definition(&writer, tree);
+        header.definition_count++;
+    }
+    if (writer.failed) {
+        tracked_free(writer.data);
+        fprintf(stderr, "Memory Error\n");
+        return false;
+    }
+
+    header.checksum = content_hash(writer.data + sizeof(header),
+                                   writer.length - sizeof(header));
+    memcpy(writer.data, &header, sizeof(header));
+
+    FILE *file = fopen(path, "wb");
+    bool written = (file) &&
+                   (fwrite(writer.data, 1, writer.length, file) ==
+                    writer.length);
+    if ((file) && (fclose(file)))
+        written = false;
+    tracked_free(writer.data);
+    if (!written) {
+        fprintf(stderr, "Could not write snapshot \"%s\"\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool take_bytes(Reader *reader, void *data, size_t size) {
+    if ((reader->failed) || ((size_t)(reader->end - reader->cursor) < size)) {
+        reader->failed = true;
+        memset(data, 0, size);
+        return false;
+    }
+    memcpy(data, reader->cursor, size);
+    reader->cursor += size;
+    return true;
+}
+
+const char *take_string(Reader *reader) {
+    uint64_t length = take_size(reader);
+    if ((reader->failed) ||
+        ((uint64_t)(reader->end - reader->cursor) < length)) {
+        reader->failed = true;
+        return NULL;
+    }
+    const char *str = intern_string(reader->cursor, length);
+    reader->cursor += length;
+    reader->failed = !str;
+    return str;
+}
+
+void *take_node(Reader *reader, size_t size) {
+    void *node = reader->failed ? NULL : arena_alloc(reader->arena, size);
+    if (!node)
+        reader->failed = true;
+    return node;
+}
+
+/* Unlike a function body, an operand is never missing */
+static Expression *take_operand(Reader *reader) {
+    Expression *exp = take_expression(reader);
+    if (!exp)
+        reader->failed = true;
+    return exp;
+}
+
+Expression *take_expression(Reader *reader) {
+    uint8_t type = take_byte(reader);
+    if ((type == NO_EXPRESSION) || (reader->failed))
+        return NULL;
+    Expression *exp = take_node(reader, sizeof(Expression));
+    if ((!exp) || (type > FUNCTION_CALL_EXPRESSION)) {
+        reader->failed = true;
+        return NULL;
+    }
+    *exp = (Expression){.type = type};
+    exp->line = take_int(reader);
+    exp->column = take_int(reader);
+    exp->end_line = take_int(reader);
+    exp->end_column = take_int(reader);
+
+    switch (exp->type) {
+    case UNDEFINED:
+        break;
+    case INTEGER_EXPRESSION:
+        exp->value.integer = take_int(reader);
+        break;
+    case BOOLEAN_EXPRESSION:
+        exp->value.boolean = take_byte(reader);
+        break;
+    case VARIABLE_EXPRESSION:
+        exp->value.variable = take_string(reader);
+        break;
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        exp->value.unary.fst = take_operand(reader);
+        break;
+    case IF_EXPRESSION:
+        exp->value.if_statement.condition = take_operand(reader);
+        exp->value.if_statement.yes = take_operand(reader);
+        exp->value.if_statement.no = take_operand(reader);
+        break;
+    case FUNCTION_CALL_EXPRESSION: {
+        exp->value.function_call.funcname = take_string(reader);
+        uint64_t arglen = take_size(reader);
+        /* every argument takes at least a byte */
+        if ((uint64_t)(reader->end - reader->cursor) < arglen) {
+            reader->failed = true;
+            break;
+        }
+        exp->value.function_call.arglen = arglen;
+        exp->value.function_call.args =
+            take_node(reader, sizeof(Expression *) * arglen + 1);
+        for (size_t i = 0; (!reader->failed) && (i < arglen); i++) {
+            exp->value.function_call.args[i] = take_operand(reader);
+        }
+        break;
+    }
+    default:
+        exp->value.binary.fst = take_operand(reader);
+        exp->value.binary.snd = take_operand(reader);
+        break;
+    }
+
+    return exp;
+}
+
+static bool take_definition(Reader *reader, size_t *next_index) {
+    /* initializers are not evaluated in order */
+    AST tree = {.type = take_byte(reader)};
+    tree.semantically_correct = take_byte(reader);
+    tree.definition_index = take_size(reader);
+    if (tree.definition_index >= *next_index)
+        *next_index = tree.definition_index + 1;
+    tree.arena = arena_new();
+    reader->arena = tree.arena;
+    if ((!tree.arena) ||
+        ((tree.type != AST_FUNCTION) && (tree.type != AST_VARIABLE)))
+        reader->failed = true;
+
+    const char *name = NULL;
+    bool has_value = false;
+    int value = 0;
+    if ((!reader->failed) && (tree.type == AST_FUNCTION)) {
+        name = take_string(reader);
+        Type return_type = take_type(reader);
+        uint64_t arglen = take_size(reader);
+        if ((uint64_t)(reader->end - reader->cursor) < arglen)
+            reader->failed = true;
+        Function *func =
+            take_node(reader, sizeof(Function) + sizeof(Argument) * arglen);
+        if (func) {
+            *func = (Function){
+                .funcname = name, .return_type = return_type, .arglen = arglen};
+            for (size_t i = 0; i < arglen; i++) {
+                const char *argname = take_string(reader);
+                func->args[i] = (Argument){.name = argname,
+                                           .type = take_type(reader)};
+            }
+            func->expression = take_expression(reader);
+        }
+        tree.value.func = func;
+    } else if (!reader->failed) {
+        name = take_string(reader);
+        Type type = take_type(reader);
+        Variable *var = take_node(reader, sizeof(Variable));
+        if (var) {
+            *var = (Variable){.name = name, .type = type};
+            var->expression = take_operand(reader);
+        }
+        tree.value.var = var;
+        has_value = take_byte(reader);
+        value = take_int(reader);
+    }
+
+    if ((reader->failed) || (!name) ||
+        (!ast_table_insert(ast, name, tree))) {
+        errno = 0;
+        arena_release(tree.arena);
+        return false;
+    }
+    if ((has_value) && (tree.value.var->type == INT))
+        return integer_table_insert(globalIntegers, name, value);
+    if (has_value)
+        return boolean_table_insert(globalBooleans, name, value != 0);
+    return true;
+}
+
+/* Replaces the definitions and globals of this thread with the ones saved
+ * to path */
+bool restore_snapshot(const char *path) {
+    Source source;
+    if (!load_source(path, &source)) {
+        fprintf(stderr, "Could not open snapshot \"%s\"\n", path);
+        return false;
+    }
+
+    SnapshotHeader header;
+    Reader reader = {.cursor = source.data,
+                     .end = source.data + source.length};
+    take_bytes(&reader, &header, sizeof(header));
+    if ((reader.failed) || (header.magic != SNAPSHOT_MAGIC) ||
+        (header.checksum !=
+         content_hash(reader.cursor, reader.end - reader.cursor))) {
+        unload_source(&source);
+        fprintf(stderr, "\"%s\" is not a snapshot\n", path);
+        return false;
+    }
+
+    ast = ast_table_new(header.definition_count * 2 + 100);
+    globalIntegers = integer_table_new(100);
+    globalBooleans = boolean_table_new(100);
+    bool restored = (ast) && (globalIntegers) && (globalBooleans);
+    size_t next_index = 0;
+    for (uint64_t i = 0; (restored) && (i < header.definition_count); i++) {
+        restored = take_definition(&reader, &next_index);
+    }
+    unload_source(&source);
+    if (!restored) {
+        fprintf(stderr, "Could not restore snapshot \"%s\"\n", path);
+        return false;
+    }
+    /* new definitions come after the restored ones */
+    set_next_definition_index(next_index);
+    return true;
+}
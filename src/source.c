@@ -0,0 +1,87 @@
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+bool load_source(const char *file_name, Source *source) {
+    FILE *file = fopen(file_name, "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    *source = (Source){.length = length,
+                       .data = tracked_calloc(MEMORY_LEXER, length + 2, 1)};
+    if ((length < 0) || (!source->data) ||
+        (fread(source->data, 1, length, file) != (size_t)length)) {
+        tracked_free(source->data);
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+    return true;
+}
+
+void unload_source(Source *source) {
+    tracked_free(source->data);
+    *source = (Source){0};
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool load_source(const char *file_name, Source *source) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info)) {
+        close(fd);
+        return false;
+    }
+
+    /* Reserve zeroed pages for the file and two NUL terminators, then map
+     * the file over the start of them. Pages are private, so the scanner
+     * can write to them without touching the file. */
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t length = info.st_size;
+    size_t mapping_length =
+        (length + 2 + page_size - 1) / page_size * page_size;
+
+    char *data = mmap(NULL, mapping_length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if ((length) && (mmap(data, length, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+        munmap(data, mapping_length);
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+    account_memory(MEMORY_LEXER, mapping_length);
+    *source = (Source){
+        .data = data, .length = length, .mapping_length = mapping_length};
+    return true;
+}
+
+void unload_source(Source *source) {
+    munmap(source->data, source->mapping_length);
+    account_memory(MEMORY_LEXER, -(ptrdiff_t)source->mapping_length);
+    *source = (Source){0};
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include "common.h"
+#include <errno.h>
+#include <string.h>
+
+/* Sets needed for the arguments of func that evaluating exp always
+ * evaluates. Calls need the arguments their callee is strict in, as far
+ * as it is known yet. */
+static void mark_needed(Expression *exp, Function *func, bool *needed) {
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return;
+    case VARIABLE_EXPRESSION:
+        for (size_t i = 0; i < func->arglen; i++) {
+            if (!strcmp(func->args[i].name, exp->value.variable)) {
+                needed[i] = true;
+                return;
+            }
+        }
+        return;
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        mark_needed(exp->value.unary.fst, func, needed);
+        return;
+    case AND_EXPRESSION:
+    case OR_EXPRESSION:
+        /* the second operand may be short circuited */
+        mark_needed(exp->value.binary.fst, func, needed);
+        return;
+    case IF_EXPRESSION: {
+        bool yes[func->arglen + 1];
+        bool no[func->arglen + 1];
+        memset(yes, 0, sizeof(yes));
+        memset(no, 0, sizeof(no));
+        mark_needed(exp->value.if_statement.condition, func, needed);
+        mark_needed(exp->value.if_statement.yes, func, yes);
+        mark_needed(exp->value.if_statement.no, func, no);
+        for (size_t i = 0; i < func->arglen; i++) {
+            needed[i] = needed[i] || (yes[i] && no[i]);
+        }
+        return;
+    }
+    case FUNCTION_CALL_EXPRESSION: {
+        AST *tree = ast_table_get_ptr(ast, exp->value.function_call.funcname);
+        errno = 0;
+        if ((!tree) || (tree->type != AST_FUNCTION))
+            return;
+        Function *callee = tree->value.func;
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            if (!callee->args[i].lazy)
+                mark_needed(exp->value.function_call.args[i], func, needed);
+        }
+        return;
+    }
+    default:
+        mark_needed(exp->value.binary.fst, func, needed);
+        mark_needed(exp->value.binary.snd, func, needed);
+        return;
+    }
+}
+
+/* Starts from every argument being strict and marks the ones found not to
+ * be lazy until nothing changes, so that recursive functions stay strict in
+ * the arguments every path through them needs. Runs on a verified
+ * program. */
+void analyze_strictness() {
+    double start = trace_begin();
+    size_t size = ast_table_size(ast);
+    Function **functions =
+        tracked_malloc(MEMORY_INTERPRETER, size * sizeof(Function *) + 1);
+    if (!functions) {
+        trace_end("phase", "strictness", start);
+        return;
+    }
+
+    size_t len = 0;
+    char *key;
+    AST *tree;
+    ast_table_iter(ast);
+    while (NULL != (tree = ast_table_iter_next(ast, &key))) {
+        if ((tree->type == AST_FUNCTION) && (tree->semantically_correct) &&
+            (tree->value.func->expression))
+            functions[len++] = tree->value.func;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < len; i++) {
+            Function *func = functions[i];
+            bool needed[func->arglen + 1];
+            memset(needed, 0, sizeof(needed));
+            mark_needed(func->expression, func, needed);
+            for (size_t j = 0; j < func->arglen; j++) {
+                if ((!needed[j]) && (!func->args[j].lazy)) {
+                    func->args[j].lazy = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    tracked_free(functions);
+    trace_end("phase", "strictness", start);
+}
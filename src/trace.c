@@ -0,0 +1,112 @@
+#include "common.h"
+#include <stdatomic.h>
+#include <string.h>
+
+/* Spans recorded so far, written out as Chrome trace events */
+typedef struct {
+    const char *category;
+    const char *name;
+    double start;
+    double duration;
+    unsigned thread;
+} TraceEvent;
+
+bool tracing = false;
+
+static const char *trace_path;
+static double trace_origin;
+static TraceEvent *events;
+static size_t event_count;
+static size_t event_capacity;
+/* Spans end on the verification threads too */
+static atomic_flag events_lock = ATOMIC_FLAG_INIT;
+static atomic_uint thread_count;
+static _Thread_local unsigned trace_thread;
+
+bool start_trace(const char *path) {
+    trace_path = path;
+    trace_origin = monotonic_seconds();
+    tracing = true;
+    return true;
+}
+
+/* Returns the start of a span, to be passed to trace_end */
+double trace_begin() { return tracing ? monotonic_seconds() : 0; }
+
+/* Records a span; name must outlive the trace, like interned names do */
+void trace_end(const char *category, const char *name, double start) {
+    if (!tracing)
+        return;
+    double end = monotonic_seconds();
+    if (!trace_thread)
+        trace_thread = atomic_fetch_add(&thread_count, 1) + 1;
+
+    while (atomic_flag_test_and_set_explicit(&events_lock,
+                                             memory_order_acquire))
+        ;
+    if (event_count == event_capacity) {
+        size_t capacity = event_capacity ? event_capacity * 2 : 1024;
+        TraceEvent *grown = tracked_realloc(MEMORY_INTERPRETER, events,
+                                            capacity * sizeof(TraceEvent));
+        if (!grown) {
+            atomic_flag_clear_explicit(&events_lock, memory_order_release);
+            return;
+        }
+        events = grown;
+        event_capacity = capacity;
+    }
+    events[event_count++] = (TraceEvent){.category = category,
+                                         .name = name,
+                                         .start = start,
+                                         .duration = end - start,
+                                         .thread = trace_thread};
+    atomic_flag_clear_explicit(&events_lock, memory_order_release);
+}
+
+static void write_json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        if ((*str == '"') || (*str == '\\'))
+            fprintf(out, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(out, "\\u%04x", *str);
+        else
+            fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+/* Writes the spans in the Chrome trace event format, which chrome://tracing
+ * and Perfetto open */
+bool finish_trace() {
+    if (!tracing)
+        return true;
+    tracing = false;
+
+    FILE *out = fopen(trace_path, "w");
+    if (!out) {
+        fprintf(stderr, "Could not open file \"%s\"\n", trace_path);
+        return false;
+    }
+
+    fprintf(out, "{\"traceEvents\": [\n");
+    for (size_t i = 0; i < event_count; i++) {
+        TraceEvent *event = events + i;
+        fprintf(out, "{\"name\": ");
+        write_json_string(out, event->name);
+        fprintf(out, ", \"cat\": ");
+        write_json_string(out, event->category);
+        fprintf(out,
+                ", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, "
+                "\"tid\": %u}%s\n",
+                (event->start - trace_origin) * 1e6, event->duration * 1e6,
+                event->thread, i + 1 < event_count ? "," : "");
+    }
+    fprintf(out, "], \"displayTimeUnit\": \"ms\"}\n");
+    fclose(out);
+
+    tracked_free(events);
+    events = NULL;
+    event_count = event_capacity = 0;
+    return true;
+}
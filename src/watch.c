@@ -0,0 +1,692 @@
+#include "common.h"
+#include "parser.tab.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#define ERROR_MSG_LEN 500
+#define NO_DEFINITION SIZE_MAX
+
+size_t hash_function(const char *str);
+
+static inline void clean_index(size_t index) {}
+
+DS_TABLE_DEC(definition, size_t);
+DS_TABLE_DEF(definition, size_t, clean_index);
+
+/* Text of a top level definition, from its first character to its ';',
+ * which is only parsed again when its hash changes */
+typedef struct {
+    const char *start; /* into the source, while it is loaded */
+    size_t length;
+    int line;
+    int column;
+    uint64_t hash;
+    size_t definition; /* NO_DEFINITION until it is matched or parsed */
+    const char *name;  /* set when it is parsed */
+} Span;
+
+/* A verified definition, kept at the same index for as long as its name is
+ * defined, so that the references between definitions survive edits.
+ * Positions inside a reused tree are the ones it was parsed at, which only
+ * hot spot listings read. */
+typedef struct {
+    const char *name; /* NULL once the name is no longer defined */
+    size_t position;  /* of its span, or the next free index once removed */
+    size_t *references; /* definitions it uses, once per use */
+    size_t reference_count;
+    size_t *dependents; /* definitions using it, once per use */
+    size_t dependent_count;
+    size_t dependent_capacity;
+    /* while reloading */
+    bool replaced; /* its text changed or is gone */
+    bool dirty;    /* its value may differ from the last run */
+} Definition;
+
+/* What the last program that verified left besides ast and the global
+ * tables, which hold the program itself */
+typedef struct {
+    Span *spans;
+    size_t span_count;
+    Definition *definitions;
+    size_t definition_count;
+    size_t definition_capacity;
+    size_t free_definition; /* first index of a removed one, to reuse */
+    definition_table_t *indices; /* of the definitions by name */
+    bool globals_failed; /* an error stopped evaluating them last run */
+    bool has_output;
+    int output;
+} Watcher;
+
+/* Splits source into spans at each ';' outside comments, which are skipped
+ * the way the lexer skips them, without lexing the text between */
+static Span *split_spans(Source *source, size_t *count) {
+    /* where a span may end or a line or comment start; data is followed by
+     * a NUL byte */
+    static const bool stops[256] = {
+        [0] = true, [';'] = true, ['\n'] = true, ['/'] = true};
+
+    size_t capacity = 64;
+    Span *spans = tracked_malloc(MEMORY_AST, capacity * sizeof(Span));
+    if (!spans)
+        return NULL;
+
+    const char *p = source->data;
+    const char *end = p + source->length;
+    const char *line_start = p;
+    int line = 1;
+    size_t len = 0;
+    bool in_span = false;
+    while (p < end) {
+        if (*p == '\n') {
+            line++;
+            line_start = ++p;
+            continue;
+        }
+        if ((*p == '/') && (end - p > 2) && (p[1] == '/') && (p[2] != '\n')) {
+            p = memchr(p, '\n', end - p);
+            if (!p)
+                p = end;
+            continue;
+        }
+        if ((!in_span) && ((*p == ' ') || (*p == '\t') || (*p == '\r'))) {
+            p++;
+            continue;
+        }
+
+        if (!in_span) {
+            if (len == capacity) {
+                Span *grown = tracked_realloc(MEMORY_AST, spans,
+                                              2 * capacity * sizeof(Span));
+                if (!grown) {
+                    tracked_free(spans);
+                    return NULL;
+                }
+                spans = grown;
+                capacity *= 2;
+            }
+            spans[len++] = (Span){.start = p,
+                                  .line = line,
+                                  .column = p - line_start + 1,
+                                  .definition = NO_DEFINITION};
+            in_span = true;
+        }
+        if (*p == ';') {
+            spans[len - 1].length = p + 1 - spans[len - 1].start;
+            in_span = false;
+        }
+        do {
+            p++;
+        } while ((in_span) && (!stops[(unsigned char)*p]));
+    }
+    /* text after the last ';', which fails to parse */
+    if (in_span)
+        spans[len - 1].length = end - spans[len - 1].start;
+
+    for (size_t i = 0; i < len; i++) {
+        spans[i].hash = word_hash(spans[i].start, spans[i].length);
+    }
+    *count = len;
+    return spans;
+}
+
+/* Gives the spans whose text is unchanged the definition they had, each
+ * definition being taken once, and marks the definitions left without a
+ * span as replaced. Returns the number of spans left to parse. */
+static size_t match_spans(Watcher *watcher, Span *spans, size_t count) {
+    for (size_t i = 0; i < watcher->definition_count; i++) {
+        watcher->definitions[i].replaced = watcher->definitions[i].name;
+    }
+
+    /* open addressing over the hashes of the previous spans */
+    size_t slot_count = 2;
+    while (slot_count < 2 * watcher->span_count)
+        slot_count *= 2;
+    size_t mask = slot_count - 1;
+    Span **slots =
+        tracked_calloc(MEMORY_INTERPRETER, slot_count, sizeof(Span *));
+    if (!slots)
+        return count;
+    for (size_t i = 0; i < watcher->span_count; i++) {
+        Span *span = watcher->spans + i;
+        if (span->definition == NO_DEFINITION)
+            continue;
+        size_t slot = span->hash & mask;
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = span;
+    }
+
+    size_t unmatched = 0;
+    for (size_t i = 0; i < count; i++) {
+        Span *span = spans + i;
+        for (size_t slot = span->hash & mask; slots[slot];
+             slot = (slot + 1) & mask) {
+            Definition *def = watcher->definitions + slots[slot]->definition;
+            if ((slots[slot]->hash == span->hash) && (def->replaced)) {
+                span->definition = slots[slot]->definition;
+                def->position = i;
+                def->replaced = false;
+                break;
+            }
+        }
+        unmatched += span->definition == NO_DEFINITION;
+    }
+    tracked_free(slots);
+    return unmatched;
+}
+
+/* Names the definition a span starts, if any */
+static const char *span_name(Span *span) {
+    FastLexer lexer;
+    fast_lexer_init(&lexer, span->start, span->length, span->line,
+                    span->column);
+    int first = fast_lexer_next(&lexer);
+    if (((first == KW_VALDEF) || (first == KW_FUNCDEF)) &&
+        (fast_lexer_next(&lexer) == IDENTIFIER))
+        return intern_view(lexer.view);
+    return NULL;
+}
+
+/* Parses the unmatched spans into ast, a table of their own */
+static bool parse_spans(Watcher *watcher, Span *spans, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Span *span = spans + i;
+        if (span->definition != NO_DEFINITION)
+            continue;
+        if (parse_buffer_at(span->start, span->length, span->line,
+                            span->column, i))
+            return false;
+        /* NULL when it was nothing but characters the lexer skips */
+        span->name = span_name(span);
+        if (!span->name)
+            continue;
+
+        size_t *index =
+            definition_table_get_ptr(watcher->indices, span->name);
+        errno = 0;
+        if ((index) && (!watcher->definitions[*index].replaced)) {
+            snprintf(syntax_error_msg, ERROR_MSG_LEN,
+                     "ERROR: Redefinition of %s in %s:%d:%d", span->name,
+                     filename, span->line, span->column);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Counts the globals and functions exp uses, and with names, lists them */
+static size_t collect_references(Expression *exp, Function *func,
+                                 const char **names, size_t len) {
+    switch (exp->type) {
+    case INTEGER_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return len;
+    case VARIABLE_EXPRESSION:
+        for (size_t i = 0; func && (i < func->arglen); i++) {
+            if (!strcmp(func->args[i].name, exp->value.variable))
+                return len;
+        }
+        if (names)
+            names[len] = exp->value.variable;
+        return len + 1;
+    case MINUS_EXPRESSION:
+    case NOT_EXPRESSION:
+        return collect_references(exp->value.unary.fst, func, names, len);
+    case IF_EXPRESSION:
+        len = collect_references(exp->value.if_statement.condition, func,
+                                 names, len);
+        len = collect_references(exp->value.if_statement.yes, func, names,
+                                 len);
+        return collect_references(exp->value.if_statement.no, func, names,
+                                  len);
+    case FUNCTION_CALL_EXPRESSION:
+        if (names)
+            names[len] = exp->value.function_call.funcname;
+        len++;
+        for (size_t i = 0; i < exp->value.function_call.arglen; i++) {
+            len = collect_references(exp->value.function_call.args[i], func,
+                                     names, len);
+        }
+        return len;
+    default:
+        len = collect_references(exp->value.binary.fst, func, names, len);
+        return collect_references(exp->value.binary.snd, func, names, len);
+    }
+}
+
+static bool add_dependent(Definition *def, size_t dependent) {
+    if (def->dependent_count == def->dependent_capacity) {
+        size_t capacity =
+            def->dependent_capacity ? 2 * def->dependent_capacity : 4;
+        size_t *grown = tracked_realloc(MEMORY_INTERPRETER, def->dependents,
+                                        capacity * sizeof(size_t));
+        if (!grown)
+            return false;
+        def->dependents = grown;
+        def->dependent_capacity = capacity;
+    }
+    def->dependents[def->dependent_count++] = dependent;
+    return true;
+}
+
+static void remove_dependent(Definition *def, size_t dependent) {
+    for (size_t i = 0; i < def->dependent_count; i++) {
+        if (def->dependents[i] == dependent) {
+            def->dependents[i] = def->dependents[--def->dependent_count];
+            return;
+        }
+    }
+}
+
+/* Links a parsed definition to the ones it uses */
+static bool resolve_references(Watcher *watcher, size_t index) {
+    Definition *def = watcher->definitions + index;
+    AST *tree = ast_table_get_ptr(ast, def->name);
+    Function *func = tree->type == AST_FUNCTION ? tree->value.func : NULL;
+    Expression *exp = func ? func->expression : tree->value.var->expression;
+
+    size_t count = collect_references(exp, func, NULL, 0);
+    const char **names =
+        tracked_malloc(MEMORY_INTERPRETER, count * sizeof(char *) + 1);
+    def->references =
+        tracked_malloc(MEMORY_INTERPRETER, count * sizeof(size_t) + 1);
+    if ((!names) || (!def->references)) {
+        tracked_free(names);
+        return false;
+    }
+    collect_references(exp, func, names, 0);
+
+    bool resolved = true;
+    for (size_t i = 0; resolved && (i < count); i++) {
+        /* every name is defined, the program verified */
+        size_t *used = definition_table_get_ptr(watcher->indices, names[i]);
+        errno = 0;
+        if (!used)
+            continue;
+        def->references[def->reference_count++] = *used;
+        resolved = add_dependent(watcher->definitions + *used, index);
+    }
+    tracked_free(names);
+    return resolved;
+}
+
+/* An index for a new definition, the one a removed definition had if any */
+static size_t take_definition_index(Watcher *watcher) {
+    if (watcher->free_definition != NO_DEFINITION) {
+        size_t index = watcher->free_definition;
+        watcher->free_definition = watcher->definitions[index].position;
+        return index;
+    }
+    if (watcher->definition_count == watcher->definition_capacity) {
+        size_t capacity = 2 * watcher->definition_capacity + 64;
+        Definition *grown =
+            tracked_realloc(MEMORY_INTERPRETER, watcher->definitions,
+                            capacity * sizeof(Definition));
+        if (!grown)
+            return NO_DEFINITION;
+        watcher->definitions = grown;
+        watcher->definition_capacity = capacity;
+    }
+    return watcher->definition_count++;
+}
+
+/* Replaces the definitions of the previous program with the ones parsed
+ * from spans, the new program having verified */
+static bool update_definitions(Watcher *watcher, Span *spans, size_t count) {
+    for (size_t i = 0; i < watcher->definition_count; i++) {
+        Definition *def = watcher->definitions + i;
+        if (!def->replaced)
+            continue;
+        for (size_t k = 0; k < def->reference_count; k++) {
+            remove_dependent(watcher->definitions + def->references[k], i);
+        }
+        tracked_free(def->references);
+        def->references = NULL;
+        def->reference_count = 0;
+    }
+
+    /* a replaced definition parsed again keeps its index and dependents */
+    for (size_t i = 0; i < count; i++) {
+        Span *span = spans + i;
+        if ((span->definition != NO_DEFINITION) || (!span->name))
+            continue;
+        size_t *index =
+            definition_table_get_ptr(watcher->indices, span->name);
+        errno = 0;
+        if (!index)
+            continue;
+        span->definition = *index;
+        watcher->definitions[*index].replaced = false;
+        watcher->definitions[*index].position = i;
+    }
+
+    /* the replaced definitions left are gone, and so are their values */
+    for (size_t i = 0; i < watcher->definition_count; i++) {
+        Definition *def = watcher->definitions + i;
+        if (!def->replaced)
+            continue;
+        definition_table_delete(watcher->indices, def->name);
+        integer_table_delete(globalIntegers, def->name);
+        boolean_table_delete(globalBooleans, def->name);
+        errno = 0;
+        tracked_free(def->dependents);
+        *def = (Definition){.position = watcher->free_definition};
+        watcher->free_definition = i;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        Span *span = spans + i;
+        if ((span->definition != NO_DEFINITION) || (!span->name))
+            continue;
+        span->definition = take_definition_index(watcher);
+        if (span->definition == NO_DEFINITION)
+            return false;
+        watcher->definitions[span->definition] =
+            (Definition){.name = span->name, .position = i};
+        definition_table_insert(watcher->indices, span->name,
+                                span->definition);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if ((spans[i].name) &&
+            (!resolve_references(watcher, spans[i].definition)))
+            return false;
+    }
+    return true;
+}
+
+/* Marks the definitions parsed from spans and every definition using them,
+ * directly or not, as dirty, and lists them in dirty */
+static size_t mark_dirty(Watcher *watcher, Span *spans, size_t count,
+                         size_t *dirty) {
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (spans[i].name) {
+            watcher->definitions[spans[i].definition].dirty = true;
+            dirty[len++] = spans[i].definition;
+        }
+    }
+    for (size_t visited = 0; visited < len; visited++) {
+        Definition *def = watcher->definitions + dirty[visited];
+        for (size_t k = 0; k < def->dependent_count; k++) {
+            Definition *dependent = watcher->definitions + def->dependents[k];
+            if (!dependent->dirty) {
+                dependent->dirty = true;
+                dirty[len++] = def->dependents[k];
+            }
+        }
+    }
+    return len;
+}
+
+/* Evaluates the dirty globals again and runs main if it is dirty */
+static void run_program(Watcher *watcher, const size_t *dirty, size_t count,
+                        int input) {
+    for (size_t i = 0; i < count; i++) {
+        const char *name = watcher->definitions[dirty[i]].name;
+        integer_table_delete(globalIntegers, name);
+        boolean_table_delete(globalBooleans, name);
+        errno = 0;
+    }
+
+    double start = trace_begin();
+    /* after an error, the globals following it were never evaluated */
+    bool initialized = watcher->globals_failed ? evaluate_globals() : true;
+    for (size_t i = 0; initialized && (i < count); i++) {
+        AST *tree =
+            ast_table_get_ptr(ast, watcher->definitions[dirty[i]].name);
+        if (tree->type == AST_VARIABLE)
+            initialized = evaluate_global(tree->value.var);
+    }
+    trace_end("phase", "initialize globals", start);
+    watcher->globals_failed = !initialized;
+    if (!initialized) {
+        watcher->has_output = false;
+        fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+        return;
+    }
+
+    size_t *main_index = definition_table_get_ptr(watcher->indices, "main");
+    errno = 0;
+    if ((!watcher->has_output) || (!main_index) ||
+        (watcher->definitions[*main_index].dirty)) {
+        watcher->has_output = interpret_main(input, &watcher->output);
+        if (!watcher->has_output) {
+            fprintf(stderr, "Runtime Error: %s\n", runtime_error_msg);
+            return;
+        }
+    }
+    printf("Input: %d\nOutput: %d\n", input, watcher->output);
+    fflush(stdout);
+}
+
+/* A tree verified again for a change, as it was before */
+typedef struct {
+    const char *name;
+    size_t definition_index;
+} VerifiedTree;
+
+/* Swaps the trees of the parsed spans into ast for the ones of the replaced
+ * definitions, and back if the new program does not verify, along with the
+ * state of the trees using them */
+static bool verify_changes(Watcher *watcher, Span *spans, size_t count,
+                           ast_table_t *parsed) {
+    size_t replaced_count = 0;
+    size_t dependent_count = 0;
+    for (size_t i = 0; i < watcher->definition_count; i++) {
+        if (!watcher->definitions[i].replaced)
+            continue;
+        replaced_count++;
+        dependent_count += watcher->definitions[i].dependent_count;
+    }
+    AST *replaced =
+        tracked_malloc(MEMORY_INTERPRETER, replaced_count * sizeof(AST) + 1);
+    VerifiedTree *dependents = tracked_malloc(
+        MEMORY_INTERPRETER, dependent_count * sizeof(VerifiedTree) + 1);
+    if ((!replaced) || (!dependents)) {
+        tracked_free(replaced);
+        tracked_free(dependents);
+        snprintf(semantic_error_msg, ERROR_MSG_LEN, "Out of memory");
+        return false;
+    }
+
+    replaced_count = 0;
+    dependent_count = 0;
+    for (size_t i = 0; i < watcher->definition_count; i++) {
+        Definition *def = watcher->definitions + i;
+        if (!def->replaced)
+            continue;
+        replaced[replaced_count] = *ast_table_get_ptr(ast, def->name);
+        arena_retain(replaced[replaced_count++].arena);
+        ast_table_delete(ast, def->name);
+
+        /* the definitions using it are verified again; all of them were
+         * verified, so the ones not yet marked are saved once */
+        for (size_t k = 0; k < def->dependent_count; k++) {
+            Definition *dependent = watcher->definitions + def->dependents[k];
+            if (dependent->replaced)
+                continue;
+            AST *tree = ast_table_get_ptr(ast, dependent->name);
+            if (!tree->semantically_correct)
+                continue;
+            dependents[dependent_count++] = (VerifiedTree){
+                .name = dependent->name,
+                .definition_index = tree->definition_index};
+            tree->semantically_correct = false;
+            tree->definition_index = dependent->position;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!spans[i].name)
+            continue;
+        AST tree = *ast_table_get_ptr(parsed, spans[i].name);
+        arena_retain(tree.arena);
+        ast_table_insert(ast, spans[i].name, tree);
+    }
+
+    double start = trace_begin();
+    bool verified = verify_semantics();
+    trace_end("phase", "verify", start);
+
+    if (!verified) {
+        for (size_t i = 0; i < count; i++) {
+            if (spans[i].name)
+                ast_table_delete(ast, spans[i].name);
+        }
+        replaced_count = 0;
+        for (size_t i = 0; i < watcher->definition_count; i++) {
+            Definition *def = watcher->definitions + i;
+            if (def->replaced)
+                ast_table_insert(ast, def->name, replaced[replaced_count++]);
+        }
+        for (size_t i = 0; i < dependent_count; i++) {
+            AST *tree = ast_table_get_ptr(ast, dependents[i].name);
+            tree->semantically_correct = true;
+            tree->definition_index = dependents[i].definition_index;
+        }
+    } else {
+        for (size_t i = 0; i < replaced_count; i++) {
+            arena_release(replaced[i].arena);
+        }
+    }
+    tracked_free(replaced);
+    tracked_free(dependents);
+    return verified;
+}
+
+/* Loads the file again and, once it verifies, runs it in place of the
+ * previous program. Only the definitions whose text changed are parsed, the
+ * ones using them verified, and the ones depending on them evaluated. A
+ * program that fails to parse or verify leaves the previous one to compare
+ * the next change against. */
+static void reload(Watcher *watcher, const char *file_name, int input) {
+    double reload_start = monotonic_seconds();
+    Source source;
+    double start = trace_begin();
+    if (!load_source(file_name, &source)) {
+        fprintf(stderr, "Could not open file \"%s\"\n", file_name);
+        return;
+    }
+    trace_end("phase", "load", start);
+    if (memoizing)
+        set_memo_program(content_hash(source.data, source.length));
+
+    size_t count;
+    Span *spans = split_spans(&source, &count);
+    if (!spans) {
+        unload_source(&source);
+        fprintf(stderr, "Out of memory\n");
+        return;
+    }
+
+    start = trace_begin();
+    ast_table_t *program = ast;
+    size_t parsed_count = match_spans(watcher, spans, count);
+    ast_table_t *parsed = ast = ast_table_new(parsed_count + 1);
+    syntax_error_msg[0] = 0;
+    bool built = parse_spans(watcher, spans, count);
+    ast = program;
+    trace_end("phase", "parse", start);
+    unload_source(&source);
+
+    bool verified = built && verify_changes(watcher, spans, count, parsed);
+    ast_table_clear(parsed);
+    if (!verified) {
+        if (!built)
+            fprintf(stderr, "%s\n", syntax_error_msg);
+        else
+            fprintf(stderr, "Semantic Error: %s\n", semantic_error_msg);
+        tracked_free(spans);
+        return;
+    }
+
+    size_t *dirty = NULL;
+    if ((!update_definitions(watcher, spans, count)) ||
+        (!(dirty = tracked_malloc(MEMORY_INTERPRETER,
+                                  watcher->definition_count * sizeof(size_t) +
+                                      1)))) {
+        /* what uses what is no longer known */
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    tracked_free(watcher->spans);
+    watcher->spans = spans;
+    watcher->span_count = count;
+
+    size_t dirty_count = mark_dirty(watcher, spans, count, dirty);
+    run_program(watcher, dirty, dirty_count, input);
+    for (size_t i = 0; i < dirty_count; i++) {
+        watcher->definitions[dirty[i]].dirty = false;
+    }
+    tracked_free(dirty);
+
+    fprintf(stderr,
+            "Reloaded in %.1f ms, %zu of %zu definitions reparsed, "
+            "%zu rerun\n",
+            (monotonic_seconds() - reload_start) * 1000, parsed_count, count,
+            dirty_count);
+}
+
+int watch_interpretation(const char *file_name, int input) {
+#ifndef __linux__
+    fprintf(stderr, "Watch mode needs inotify, which is Linux only\n");
+    return 1;
+#else
+    filename = file_name;
+
+    /* the directory is watched, as editors often save by writing another
+     * file and renaming it over this one */
+    const char *slash = strrchr(file_name, '/');
+    const char *base = slash ? slash + 1 : file_name;
+    char directory[strlen(file_name) + 2];
+    if (slash)
+        snprintf(directory, sizeof(directory), "%.*s",
+                 (int)(slash == file_name ? 1 : slash - file_name),
+                 file_name);
+    else
+        strcpy(directory, ".");
+
+    int watched = inotify_init1(IN_CLOEXEC);
+    if ((watched < 0) ||
+        (inotify_add_watch(watched, directory, IN_CLOSE_WRITE | IN_MOVED_TO) <
+         0)) {
+        fprintf(stderr, "Could not watch \"%s\"\n", directory);
+        return 1;
+    }
+
+    ast = ast_table_new(100);
+    globalIntegers = integer_table_new(100);
+    globalBooleans = boolean_table_new(100);
+    Watcher watcher = {.free_definition = NO_DEFINITION,
+                       .indices = definition_table_new(100)};
+    reload(&watcher, file_name, input);
+
+    _Alignas(struct inotify_event) char events[4096];
+    while (true) {
+        ssize_t length = read(watched, events, sizeof(events));
+        if ((length < 0) && (errno == EINTR))
+            continue;
+        if (length <= 0)
+            break;
+
+        bool changed = false;
+        for (char *p = events; p < events + length;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            if ((event->len) && (!strcmp(event->name, base)))
+                changed = true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        if (changed)
+            reload(&watcher, file_name, input);
+    }
+    close(watched);
+    return 1;
+#endif
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+# Runs programs importing modules, from a module cache or not:
+# tests/module_test.sh KARILANG
+karilang=$1
+directory=$(mktemp -d)
+cache=$directory/cache
+trap 'rm -rf "$directory"' EXIT
+
+failed=0
+# run PROGRAM EXPECTED: runs PROGRAM with 7 importing base.txt then
+# scaled.txt, the output must match EXPECTED
+run() {
+    printf '%s\n' "$1" >"$directory/program.txt"
+    output=$("$karilang" --module-cache "$cache" \
+        --import "$directory/base.txt" --import "$directory/scaled.txt" \
+        "$directory/program.txt" 7 2>&1)
+    if ! printf '%s\n' "$output" | grep -q -- "$2"; then
+        printf 'program "%s"\n  expected "%s"\n  got "%s"\n' "$1" "$2" \
+            "$output"
+        failed=1
+    fi
+}
+# artifact MODULE: the inode of the artifact of MODULE, which changes when
+# the module is compiled again
+artifact() {
+    ls -i "$cache" | while read -r inode file; do
+        grep -q "$1" "$cache/$file" && echo "$inode"
+    done
+}
+check() {
+    if [ "$1" != "$2" ]; then
+        printf '%s\n' "$3"
+        failed=1
+    fi
+}
+
+printf '%s\n' 'valdef offset: int = 1;' \
+    'funcdef pick(c: bool, a: int, b: int) -> int = if c then a else b;' \
+    >"$directory/base.txt"
+printf '%s\n' 'funcdef scaled(n: int) -> int = n * 10 + offset;' \
+    >"$directory/scaled.txt"
+main='funcdef main(n: int) -> int = scaled(n);'
+
+# a miss compiles both modules, a hit opens their artifacts
+run "$main" '^Output: 71$'
+check "$(ls "$cache" | wc -l | tr -d ' ')" 2 "no artifact per module"
+base=$(artifact pick)
+scaled=$(artifact scaled)
+run "$main" '^Output: 71$'
+check "$(artifact pick)" "$base" "base.txt compiled again on a hit"
+check "$(artifact scaled)" "$scaled" "scaled.txt compiled again on a hit"
+
+# editing a body compiles that module alone again
+printf '%s\n' 'valdef offset: int = 2;' \
+    'funcdef pick(c: bool, a: int, b: int) -> int = if c then a else b;' \
+    >"$directory/base.txt"
+run "$main" '^Output: 72$'
+check "$(artifact scaled)" "$scaled" "scaled.txt compiled again on a body edit"
+
+# the arguments of an imported function keep their order and types
+run 'funcdef main(n: int) -> int = pick(n > 5, n, 0);' '^Output: 7$'
+run 'funcdef main(n: int) -> int = pick(n < 5, n, 0 + -n);' '^Output: -7$'
+run 'funcdef main(n: int) -> int = pick(n, n, n);' '^Semantic Error'
+
+# an imported name can not be defined again
+run "$main
+valdef offset: int = 3;" '^ERROR: Redefinition of offset, imported from'
+
+# a damaged artifact is reported and removed, the next run compiles again
+for file in "$cache"/*; do
+    grep -q pick "$file" || continue
+    size=$(wc -c <"$file")
+    printf '\377\377\377\377' |
+        dd of="$file" bs=1 seek=$((size - 4)) conv=notrunc 2>/dev/null
+done
+both='funcdef main(n: int) -> int = pick(true, scaled(n), 0);'
+run "$both" 'The artifact of ".*base.txt" is damaged'
+run "$both" '^Output: 72$'
+exit $failed
@@ -0,0 +1,43 @@
+/* Sends its standard input to a KariLang server and writes the responses to
+ * standard output, for tests to script requests with */
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s SOCKET\n", argv[0]);
+        return 1;
+    }
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(argv[1]) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long\n", argv[1]);
+        return 1;
+    }
+    strcpy(address.sun_path, argv[1]);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((server < 0) ||
+        (connect(server, (struct sockaddr *)&address, sizeof(address)))) {
+        perror("connect");
+        return 1;
+    }
+
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+        if (write(server, buffer, length) != length) {
+            perror("write");
+            return 1;
+        }
+    }
+    /* the server answers every request it got before the end of input */
+    shutdown(server, SHUT_WR);
+    while ((length = read(server, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, length, stdout);
+    }
+    close(server);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#!/bin/sh
+# Scripts requests against a server: tests/server_test.sh KARILANG CLIENT
+karilang=$1
+client=$2
+directory=$(mktemp -d)
+socket=$directory/server.sock
+trap 'kill $server $idle 2>/dev/null; rm -rf "$directory"' EXIT
+
+"$karilang" --serve "$socket" --workers 2 --cache-size 4 --optimize --fuse \
+    2>/dev/null &
+server=$!
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$socket" ] && break
+    sleep 0.1
+done
+
+failed=0
+# request REQUEST EXPECTED: sends REQUEST, the response must match EXPECTED
+request() {
+    response=$(printf '%b' "$1" | timeout 10 "$client" "$socket")
+    if ! printf '%s\n' "$response" | grep -q -- "$2"; then
+        printf 'request "%s"\n  expected "%s"\n  got "%s"\n' "$1" "$2" \
+            "$response"
+        failed=1
+    fi
+}
+# length SOURCE: the length of SOURCE in bytes
+length() {
+    printf '%s' "$1" | wc -c | tr -d ' '
+}
+
+square='funcdef main(n: int) -> int = n * n;'
+request "LOAD $(length "$square")\n$square" '^OK [0-9a-f]*$'
+request "RUN $(length "$square") main 7\n$square" '^OK 49$'
+request "RUN $(length "$square") main x\n$square" '^ERROR Invalid input "x"'
+
+# a length that can not be allocated is refused before reading the source
+request 'LOAD 18446744073709551615\nfuncdef' '^ERROR Invalid source length'
+request 'LOAD 99999999999999999999\nfuncdef' '^ERROR Invalid source length'
+request 'LOAD -1\nfuncdef' '^ERROR Invalid source length'
+request 'LOAD 12x\nfuncdef' '^ERROR Invalid source length'
+
+# a recursion too deep for the stack fails the request alone
+deep='funcdef d(n: int) -> int = if n == 0 then 0 else 1 + d(n + -1);'
+request "RUN $(length "$deep") d 1000000\n$deep" \
+    '^ERROR Runtime Error: Execution budget exhausted at a call depth'
+request "RUN $(length "$deep") d 50000\n$deep" '^OK 50000$'
+
+# a program is called by its hash once loaded
+hash=$(printf 'LOAD %s\n%s' "$(length "$square")" "$square" |
+    timeout 10 "$client" "$socket" | cut -d ' ' -f 2)
+request "CALL $hash main 12" '^OK 144$'
+request "CALL 0123456789abcdef0123456789abcdef main 12" '^MISSING'
+
+# connections waiting to send a request do not hold a worker
+mkfifo "$directory/idle"
+exec 3<>"$directory/idle"
+idle=
+for _ in 1 2 3; do
+    "$client" "$socket" <"$directory/idle" >/dev/null &
+    idle="$idle $!"
+done
+request "RUN $(length "$square") main 5\n$square" '^OK 25$'
+
+# and the server still serves the next client
+request "RUN $(length "$square") main 3\n$square" '^OK 9$'
+exit $failed
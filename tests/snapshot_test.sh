@@ -0,0 +1,61 @@
+#!/bin/sh
+# Saves REPL sessions to snapshots and restores them:
+# tests/snapshot_test.sh KARILANG
+karilang=$1
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+
+failed=0
+# session RESTORED INPUT EXPECTED...: runs INPUT in a REPL started from the
+# snapshot RESTORED, or from nothing when empty; each EXPECTED must match a
+# line of its output
+session() {
+    restored=$1
+    input=$2
+    shift 2
+    if [ -n "$restored" ]; then
+        output=$(printf '%s\nexit\n' "$input" |
+            "$karilang" --restore "$directory/$restored" 2>&1)
+    else
+        output=$(printf '%s\nexit\n' "$input" | "$karilang" 2>&1)
+    fi
+    for expected in "$@"; do
+        if ! printf '%s\n' "$output" | grep -q -- "$expected"; then
+            printf 'session "%s"\n  expected "%s"\n  got "%s"\n' "$input" \
+                "$expected" "$output"
+            failed=1
+        fi
+    done
+}
+
+# definitions that did not verify are saved too
+session '' "valdef a: int = 6;
+funcdef twice(n: int) -> int = n * 2;
+funcdef later(n: int) -> int = missing(n);
+:save $directory/one.snap" 'Saved 3 definitions'
+
+# a restored session is saved again with what was added to it
+session one.snap "twice(a);
+valdef b: int = twice(a) + 1;
+b;
+:save $directory/two.snap" '^\(>>> \)*12$' '^\(>>> \)*13$' \
+    'Saved 4 definitions'
+session two.snap 'b + a;
+twice(b);' '^\(>>> \)*19$' '^\(>>> \)*26$'
+session two.snap 'later(1);' "'later' function did not verify"
+
+# definitions made after a restore are numbered after the restored ones;
+# an int valdef of a one letter name and a constant takes 46 bytes, its
+# number 2 bytes in, after the 24 byte header
+session '' "valdef c: int = 1;
+:save $directory/first.snap" 'Saved 1 definitions'
+session first.snap "valdef d: int = 2;
+:save $directory/second.snap" 'Saved 2 definitions'
+numbers=$(for offset in 26 72; do
+    od -An -t u8 -j $offset -N 8 "$directory/second.snap" | tr -d ' '
+done | sort | tr '\n' ' ')
+if [ "$numbers" != "0 1 " ]; then
+    printf 'definitions numbered "%s" after a restore\n' "$numbers"
+    failed=1
+fi
+exit $failed
@@ -0,0 +1,79 @@
+/* Fills a DS.h table far past the buckets it was created with, so that it
+ * grows many times, and checks every entry is still found once */
+#include "../src/DS.h"
+#include <stdio.h>
+
+#define KEY_COUNT 20000
+
+IMPLEMENT_HASH_FUNCTION;
+
+static inline void clean_number(int number) {}
+
+DS_TABLE_DEC(number, int);
+DS_TABLE_DEF(number, int, clean_number);
+
+static char keys[KEY_COUNT][16];
+
+static bool fail(const char *message, size_t i) {
+    fprintf(stderr, "%s, at key %zu\n", message, i);
+    return false;
+}
+
+static bool check_entries(number_table_t *tb, size_t step) {
+    for (size_t i = 0; i < KEY_COUNT; i++) {
+        int *value = number_table_get_ptr(tb, keys[i]);
+        errno = 0;
+        if ((i % step == 0) && ((!value) || (*value != (int)i)))
+            return fail("An entry is lost", i);
+        if ((i % step != 0) && (value))
+            return fail("A deleted entry is found", i);
+    }
+
+    /* an iteration visits every entry once */
+    size_t visited = 0, sum = 0, expected = 0;
+    char *key;
+    int *value;
+    number_table_iter(tb);
+    while (NULL != (value = number_table_iter_next(tb, &key))) {
+        if (strcmp(key, keys[*value]))
+            return fail("An entry is under another key", *value);
+        visited++;
+        sum += *value;
+    }
+    for (size_t i = 0; i < KEY_COUNT; i += step) {
+        expected += i;
+    }
+    if ((visited != number_table_size(tb)) || (sum != expected))
+        return fail("An iteration does not visit every entry once", visited);
+    return true;
+}
+
+int main() {
+    number_table_t *tb = number_table_new(4);
+    if (!tb)
+        return 1;
+
+    for (size_t i = 0; i < KEY_COUNT; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "key%zu", i);
+        if (!number_table_insert(tb, keys[i], i))
+            return !fail("An insert fails", i);
+    }
+    if (tb->array_length <= 4)
+        return !fail("The table does not grow", tb->array_length);
+    if (number_table_insert(tb, keys[0], 0))
+        return !fail("A key is inserted twice", 0);
+    errno = 0;
+    if (!check_entries(tb, 1))
+        return 1;
+
+    for (size_t i = 1; i < KEY_COUNT; i += 2) {
+        if (!number_table_delete(tb, keys[i]))
+            return !fail("A delete fails", i);
+    }
+    if (!check_entries(tb, 2))
+        return 1;
+
+    number_table_clear(tb);
+    printf("%d entries found after growing\n", KEY_COUNT);
+    return 0;
+}
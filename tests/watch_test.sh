@@ -0,0 +1,71 @@
+#!/bin/sh
+# Scripts edits of a watched program: tests/watch_test.sh KARILANG
+karilang=$1
+directory=$(mktemp -d)
+program=$directory/program.txt
+log=$directory/log
+trap 'kill $watcher 2>/dev/null; rm -rf "$directory"' EXIT
+
+failed=0
+reloads=0
+# a reload ends with one of these lines, or with the output before them
+ends='Reloaded\|Error\|ERROR'
+# save SOURCE EXPECTED: saves SOURCE as the program, the output of the reload
+# must match EXPECTED
+save() {
+    printf '%s\n' "$1" >"$program.new"
+    mv "$program.new" "$program"
+    reloads=$((reloads + 1))
+    for _ in $(seq 50); do
+        [ "$(grep -c "$ends" "$log")" -ge "$reloads" ] && break
+        sleep 0.1
+    done
+    if ! grep "Output\\|$ends" "$log" | tail -n 2 |
+        grep -q -- "$2"; then
+        printf 'program "%s"\n  expected "%s"\n  got "%s"\n' "$1" "$2" \
+            "$(tail -n 3 "$log")"
+        failed=1
+    fi
+}
+
+base='valdef base: int = 1;'
+g='funcdef g(n: int) -> int = n + base;'
+main='funcdef main(n: int) -> int = g(n);'
+printf '%s\n' "$base" "$g" "$main" >"$program"
+"$karilang" --watch "$program" 10 >"$log" 2>&1 &
+watcher=$!
+reloads=1
+for _ in $(seq 50); do
+    grep -q 'Reloaded' "$log" && break
+    sleep 0.1
+done
+grep -q '^Output: 11$' "$log" || { echo "no first run"; failed=1; }
+
+# only the edited definition is parsed again, its users run again
+base='valdef base: int = 5;'
+save "$base
+$g
+$main" '^Output: 15$'
+save "$base
+$g
+$main" '0 of 3 definitions reparsed'
+
+# a broken program keeps the last one that worked
+save "$base
+funcdef g(n: int) -> int = n + ;
+$main" '^ERROR: syntax error'
+save "$base
+funcdef g(n: int) -> int = n + missing;
+$main" '^Semantic Error'
+save "$base
+$g
+$main" '^Output: 15$'
+
+# a renamed definition replaces the old one
+save "$base
+funcdef h(n: int) -> int = n * base;
+funcdef main(n: int) -> int = h(n);" '^Output: 50$'
+save "$base
+funcdef h(n: int) -> int = n * base;
+$main" "^Semantic Error"
+exit $failed